@@ -0,0 +1,159 @@
+#include "Allocator.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace ECS
+{
+Allocator &Allocator::GetDefault()
+{
+	static HeapAllocator allocator;
+	return allocator;
+}
+
+void *HeapAllocator::Allocate(size_t byteSize, int alignment)
+{
+	return ::operator new(byteSize, std::align_val_t(alignment));
+}
+
+void HeapAllocator::Deallocate(void *block, [[maybe_unused]] size_t byteSize, int alignment)
+{
+	::operator delete(block, std::align_val_t(alignment));
+}
+
+ArenaAllocator::ArenaAllocator(size_t regionByteSize, Allocator &upstream)
+	: upstream(&upstream), regionByteSize(regionByteSize), cursor(nullptr), end(nullptr), lastBlock(nullptr)
+{
+}
+
+ArenaAllocator::~ArenaAllocator() { Reset(); }
+
+void *ArenaAllocator::Allocate(size_t byteSize, int alignment)
+{
+	char *block = (char *)(((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (!cursor || block + byteSize > end)
+	{
+		if (byteSize + alignment > regionByteSize)
+		{
+			void *data = upstream->Allocate(byteSize, alignment);
+			regions.push_back({data, byteSize, alignment});
+			return data;
+		}
+
+		char *data = (char *)upstream->Allocate(regionByteSize, alignof(std::max_align_t));
+		regions.push_back({data, regionByteSize, alignof(std::max_align_t)});
+		cursor = data;
+		end = data + regionByteSize;
+		block = (char *)(((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	}
+
+	cursor = block + byteSize;
+	lastBlock = block;
+	return block;
+}
+
+void ArenaAllocator::Deallocate(void *block, [[maybe_unused]] size_t byteSize, [[maybe_unused]] int alignment)
+{
+	// Only the most recent block can be given back, like a temporary freed before anything else is allocated. Growing
+	// columns allocate their new block before freeing the old one, so old blocks stay in the arena until Reset.
+	if (block && block == lastBlock)
+	{
+		cursor = (char *)block;
+		lastBlock = nullptr;
+	}
+}
+
+void ArenaAllocator::Reset()
+{
+	for (Region &region : regions) upstream->Deallocate(region.data, region.byteSize, region.alignment);
+	regions.clear();
+	cursor = end = nullptr;
+	lastBlock = nullptr;
+}
+
+size_t ArenaAllocator::GetByteSize() const
+{
+	size_t byteSize = 0;
+	for (const Region &region : regions) byteSize += region.byteSize;
+	return byteSize;
+}
+
+PoolAllocator::PoolAllocator(Allocator &upstream) : upstream(&upstream) {}
+
+PoolAllocator::~PoolAllocator() { Clear(); }
+
+void *PoolAllocator::Allocate(size_t byteSize, int alignment)
+{
+	size_t sizeClass = GetSizeClass(byteSize);
+	auto it = freeBlocks.find({sizeClass, alignment});
+	if (it == freeBlocks.end() || it->second.empty()) return upstream->Allocate(sizeClass, alignment);
+
+	void *block = it->second.back();
+	it->second.pop_back();
+	return block;
+}
+
+void PoolAllocator::Deallocate(void *block, size_t byteSize, int alignment)
+{
+	if (block) freeBlocks[{GetSizeClass(byteSize), alignment}].push_back(block);
+}
+
+void PoolAllocator::Clear()
+{
+	for (auto &[key, blocks] : freeBlocks)
+		for (void *block : blocks) upstream->Deallocate(block, key.first, key.second);
+	freeBlocks.clear();
+}
+
+size_t PoolAllocator::GetSizeClass(size_t byteSize) { return std::bit_ceil(std::max(byteSize, (size_t)64)); }
+
+HugePageAllocator::HugePageAllocator(size_t minByteSize, Allocator &upstream)
+	: upstream(&upstream), minByteSize(minByteSize)
+{
+}
+
+#ifdef __linux__
+static size_t GetMappedSize(size_t byteSize)
+{
+	return (byteSize + HugePageAllocator::hugePageSize - 1) / HugePageAllocator::hugePageSize *
+		   HugePageAllocator::hugePageSize;
+}
+#endif
+
+void *HugePageAllocator::Allocate(size_t byteSize, int alignment)
+{
+#ifdef __linux__
+	if (byteSize >= minByteSize && alignment <= 4096)
+	{
+		size_t mappedSize = GetMappedSize(byteSize);
+		void *block =
+			mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (block != MAP_FAILED) return block;
+
+		// No reserved huge pages, ask for transparent ones instead.
+		block = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED) throw std::bad_alloc();
+		madvise(block, mappedSize, MADV_HUGEPAGE);
+		return block;
+	}
+#endif
+	return upstream->Allocate(byteSize, alignment);
+}
+
+void HugePageAllocator::Deallocate(void *block, size_t byteSize, int alignment)
+{
+#ifdef __linux__
+	if (byteSize >= minByteSize && alignment <= 4096)
+	{
+		if (block) munmap(block, GetMappedSize(byteSize));
+		return;
+	}
+#endif
+	upstream->Deallocate(block, byteSize, alignment);
+}
+} // namespace ECS
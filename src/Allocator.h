@@ -0,0 +1,125 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace ECS
+{
+/// @brief Source of memory for component storage. A world hands it's allocator to archetypes, sparse sets and the
+/// chunk pool, every PopbackArray remembers the allocator it got it's memory from.
+/// Only the default heap allocator is thread safe, other allocators can be shared only by worlds used from one thread.
+class Allocator
+{
+  public:
+	virtual ~Allocator() = default;
+
+	/// @brief Allocates a block of memory.
+	/// @param byteSize size of the block
+	/// @param alignment alignment of the block, a power of two
+	/// @return pointer to the block, throws std::bad_alloc on failure
+	virtual void *Allocate(size_t byteSize, int alignment) = 0;
+
+	/// @brief Frees a block returned by Allocate.
+	/// @param block pointer to the block, can be nullptr
+	/// @param byteSize size the block was allocated with
+	/// @param alignment alignment the block was allocated with
+	virtual void Deallocate(void *block, size_t byteSize, int alignment) = 0;
+
+	/// @brief Gets the heap allocator used by worlds that aren't given one.
+	static Allocator &GetDefault();
+};
+
+/// @brief Allocator using aligned operator new and delete.
+class HeapAllocator : public Allocator
+{
+  public:
+	void *Allocate(size_t byteSize, int alignment) override;
+	void Deallocate(void *block, size_t byteSize, int alignment) override;
+};
+
+/// @brief Bump allocator carving blocks out of large regions taken from an upstream allocator. Deallocation is free,
+/// except for the most recent block, memory is given back only by Reset or when the arena is destroyed. Meant for
+/// worlds with a bounded lifetime, like a level or a test fixture, that are thrown away as a whole.
+class ArenaAllocator : public Allocator
+{
+	struct Region
+	{
+		void *data;
+		size_t byteSize;
+		int alignment;
+	};
+
+	Allocator *upstream;
+	size_t regionByteSize;
+	std::vector<Region> regions;
+
+	/// @brief Free part of the current region.
+	char *cursor;
+	char *end;
+	void *lastBlock;
+
+  public:
+	/// @param regionByteSize size of regions requested from upstream, larger blocks get a region of their own
+	/// @param upstream allocator of the regions
+	ArenaAllocator(size_t regionByteSize = 2 * 1024 * 1024, Allocator &upstream = Allocator::GetDefault());
+	ArenaAllocator(const ArenaAllocator &) = delete;
+	ArenaAllocator &operator=(const ArenaAllocator &) = delete;
+	~ArenaAllocator();
+
+	void *Allocate(size_t byteSize, int alignment) override;
+	void Deallocate(void *block, size_t byteSize, int alignment) override;
+
+	/// @brief Frees all regions at once, no block allocated before may be used afterwards.
+	void Reset();
+
+	/// @brief Gets the number of bytes taken from upstream.
+	size_t GetByteSize() const;
+};
+
+/// @brief Allocator rounding blocks up to power of two size classes and keeping freed blocks in a free list per class,
+/// so columns growing in different archetypes reuse each other's old blocks instead of going to the upstream allocator.
+class PoolAllocator : public Allocator
+{
+	Allocator *upstream;
+	std::map<std::pair<size_t, int>, std::vector<void *>> freeBlocks;
+
+  public:
+	/// @param upstream allocator of blocks that are not in the free lists
+	PoolAllocator(Allocator &upstream = Allocator::GetDefault());
+	PoolAllocator(const PoolAllocator &) = delete;
+	PoolAllocator &operator=(const PoolAllocator &) = delete;
+	~PoolAllocator();
+
+	void *Allocate(size_t byteSize, int alignment) override;
+	void Deallocate(void *block, size_t byteSize, int alignment) override;
+
+	/// @brief Gives all pooled blocks back to upstream.
+	void Clear();
+
+	/// @brief Gets the size class of a block.
+	/// @param byteSize requested size
+	/// @return smallest power of two not less than byteSize
+	static size_t GetSizeClass(size_t byteSize);
+};
+
+/// @brief Allocator mapping large blocks straight from the OS backed by huge pages, cutting TLB misses when iterating
+/// large columns. Tries MAP_HUGETLB first, then falls back to regular pages with madvise(MADV_HUGEPAGE) so transparent
+/// huge pages can be used. Blocks smaller than minByteSize, and all blocks on systems without mmap, go to upstream.
+/// Works best as the upstream of an ArenaAllocator or a PoolAllocator.
+class HugePageAllocator : public Allocator
+{
+	Allocator *upstream;
+	size_t minByteSize;
+
+  public:
+	static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+	/// @param minByteSize size from which blocks are mapped
+	/// @param upstream allocator of smaller blocks
+	HugePageAllocator(size_t minByteSize = hugePageSize / 2, Allocator &upstream = Allocator::GetDefault());
+
+	void *Allocate(size_t byteSize, int alignment) override;
+	void Deallocate(void *block, size_t byteSize, int alignment) override;
+};
+} // namespace ECS
@@ -0,0 +1,284 @@
+#include "CommandBuffer.h"
+#include <atomic>
+#include <new>
+
+namespace ECS
+{
+static constexpr size_t commandBlockSize = 16384;
+static std::atomic<uint64_t> nextBufferID = 1;
+
+CommandBuffer::Lane::~Lane()
+{
+	Clear();
+	for (auto &[block, byteSize] : blocks) ::operator delete(block, std::align_val_t(cacheLineSize));
+}
+
+void *CommandBuffer::Lane::Allocate(size_t byteSize, size_t alignment)
+{
+	while (true)
+	{
+		if (currentBlock < blocks.size())
+		{
+			auto [block, blockSize] = blocks[currentBlock];
+			uintptr_t address = (uintptr_t)block + blockOffset;
+			size_t offset = (address + alignment - 1) / alignment * alignment - (uintptr_t)block;
+			if (offset + byteSize <= blockSize)
+			{
+				blockOffset = offset + byteSize;
+				return (char *)block + offset;
+			}
+
+			currentBlock++;
+			blockOffset = 0;
+			continue;
+		}
+
+		size_t blockSize = std::max(commandBlockSize, byteSize + alignment);
+		blocks.emplace_back(::operator new(blockSize, std::align_val_t(cacheLineSize)), blockSize);
+	}
+}
+
+void CommandBuffer::Lane::Clear()
+{
+	for (auto &component : components) ComponentInfo::Destroy(component.componentID, component.data);
+	commands.clear();
+	components.clear();
+	currentBlock = 0;
+	blockOffset = 0;
+}
+
+CommandBuffer::CommandBuffer() : bufferID(nextBufferID++) {}
+
+void CommandBuffer::Destroy(EntityHandle entity) { GetLane().commands.push_back({CommandType::Destroy, entity, 0, 0}); }
+
+bool CommandBuffer::Empty()
+{
+	std::lock_guard lock(lanesMutex);
+	for (auto &lane : lanes)
+		if (!lane->commands.empty()) return false;
+	return true;
+}
+
+void CommandBuffer::Playback(World &world)
+{
+	struct PendingEntity
+	{
+		EntityHandle entity;
+		ComponentMask mask;
+		bool destroyed;
+		std::vector<RecordedComponent> added;
+		int sourceID;
+		int destinationID;
+	};
+
+	struct PendingCreate
+	{
+		std::span<RecordedComponent> components;
+		int archetypeID;
+	};
+
+	EntityRegistry &registry = world.GetRegistry();
+	ArchetypePool &archetypePool = world.GetArchetypePool();
+
+	// Fold commands into a single transition per entity.
+	std::vector<PendingEntity> pending;
+	std::unordered_map<uint32_t, int> pendingIndex;
+	std::vector<PendingCreate> creates;
+	std::vector<ComponentMask> createMasks;
+	for (auto &lane : lanes)
+	{
+		for (Command &command : lane->commands)
+		{
+			if (command.type == CommandType::Create)
+			{
+				ComponentMask mask;
+				std::span<RecordedComponent> components(lane->components.data() + command.firstComponent,
+														command.componentID);
+				for (auto &component : components)
+				{
+					assert(!mask.Test(component.componentID) &&
+						   "Trying to add multiple components of same type to an entity");
+					if (!ComponentInfo::IsSparse(component.componentID)) mask.Set(component.componentID);
+				}
+				creates.push_back({components, -1});
+				createMasks.push_back(mask);
+				continue;
+			}
+
+			if (!world.IsAlive(command.entity)) continue;
+
+			auto [it, inserted] = pendingIndex.try_emplace(command.entity.index, (int)pending.size());
+			if (inserted)
+			{
+				int archetypeID = registry.GetSlot(command.entity).archetypeID;
+				ComponentMask mask = archetypeID == -1 ? ComponentMask() : archetypePool.GetArchetypes()[archetypeID].mask;
+				pending.push_back({command.entity, mask, false, {}, archetypeID, -1});
+			}
+
+			PendingEntity &entity = pending[it->second];
+			if (entity.destroyed) continue;
+
+			// Sparse components don't affect archetypes, so they are applied right away.
+			if (command.type != CommandType::Destroy && ComponentInfo::IsSparse(command.componentID))
+			{
+				SparseSet &sparseSet = world.GetSparseSet(command.componentID);
+				if (command.type == CommandType::AddComponent)
+				{
+					RecordedComponent &component = lane->components[command.firstComponent];
+					ComponentInfo::MoveConstruct(component.componentID, sparseSet.Add(command.entity), component.data);
+				}
+				else
+					sparseSet.Remove(command.entity);
+				continue;
+			}
+
+			switch (command.type)
+			{
+			case CommandType::Destroy:
+				entity.destroyed = true;
+				break;
+			case CommandType::AddComponent:
+				assert(!entity.mask.Test(command.componentID) &&
+					   "Trying to add multiple components of same type to an entity");
+				entity.mask.Set(command.componentID);
+				entity.added.push_back(lane->components[command.firstComponent]);
+				break;
+			case CommandType::RemoveComponent:
+				assert(entity.mask.Test(command.componentID) && "Trying to remove component that is not on an entity");
+				entity.mask.Reset(command.componentID);
+				std::erase_if(entity.added, [&](auto &component) { return component.componentID == command.componentID; });
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	// Resolve destination archetypes before taking pointers, creating archetypes can reallocate the pool.
+	auto getArchetypeID = [&](const ComponentMask &mask) {
+		Archetype *archetype = archetypePool.GetArchetype(mask);
+		if (!archetype) archetype = archetypePool.AddArchetype(mask);
+		return archetype->archetypeID;
+	};
+	for (auto &entity : pending)
+		entity.destinationID = entity.destroyed || entity.mask.Empty() ? -1 : getArchetypeID(entity.mask);
+	for (int i = 0; i < creates.size(); i++)
+		creates[i].archetypeID = createMasks[i].Empty() ? -1 : getArchetypeID(createMasks[i]);
+	std::span<Archetype> archetypes = archetypePool.GetArchetypes();
+
+	// Move entities out of every source archetype in one pass, highest positions first.
+	std::vector<int> order;
+	for (int i = 0; i < pending.size(); i++)
+		if (pending[i].sourceID != -1 && pending[i].sourceID != pending[i].destinationID) order.push_back(i);
+	std::sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+		if (pending[lhs].sourceID != pending[rhs].sourceID) return pending[lhs].sourceID < pending[rhs].sourceID;
+		return registry.GetSlot(pending[lhs].entity).index > registry.GetSlot(pending[rhs].entity).index;
+	});
+
+	std::vector<int> indices;
+	std::vector<Archetype *> destinations;
+	for (int begin = 0, end = 0; begin < order.size(); begin = end)
+	{
+		int sourceID = pending[order[begin]].sourceID;
+		indices.clear();
+		destinations.clear();
+		for (end = begin; end < order.size() && pending[order[end]].sourceID == sourceID; end++)
+		{
+			PendingEntity &entity = pending[order[end]];
+			indices.push_back(registry.GetSlot(entity.entity).index);
+			destinations.push_back(entity.destinationID == -1 ? nullptr : &archetypes[entity.destinationID]);
+		}
+		archetypes[sourceID].MoveEntities(indices, destinations);
+	}
+
+	// Entities without components are appended to their new archetypes in bulk.
+	order.clear();
+	for (int i = 0; i < pending.size(); i++)
+		if (pending[i].sourceID == -1 && pending[i].destinationID != -1) order.push_back(i);
+	std::stable_sort(order.begin(), order.end(),
+					 [&](int lhs, int rhs) { return pending[lhs].destinationID < pending[rhs].destinationID; });
+
+	std::vector<EntityHandle> handles;
+	for (int begin = 0, end = 0; begin < order.size(); begin = end)
+	{
+		int destinationID = pending[order[begin]].destinationID;
+		handles.clear();
+		for (end = begin; end < order.size() && pending[order[end]].destinationID == destinationID; end++)
+			handles.push_back(pending[order[end]].entity);
+		archetypes[destinationID].AllocateEntities(handles);
+	}
+
+	for (auto &entity : pending)
+	{
+		if (entity.destroyed)
+		{
+			world.RemoveSparseComponents(entity.entity);
+			registry.Destroy(entity.entity);
+			continue;
+		}
+
+		EntityRegistry::Slot &slot = registry.GetSlot(entity.entity);
+		const ComponentMask *sourceMask = entity.sourceID == -1 ? nullptr : &archetypes[entity.sourceID].mask;
+		for (auto &component : entity.added)
+		{
+			Archetype &archetype = archetypes[slot.archetypeID];
+			if (sourceMask && sourceMask->Test(component.componentID))
+				archetype.DestroyComponent(component.componentID, slot.index);
+			archetype.ConstructComponent(component.componentID, slot.index, component.data);
+		}
+	}
+
+	// Created entities are grouped by archetype, and every group is appended at once.
+	order.clear();
+	for (int i = 0; i < creates.size(); i++) order.push_back(i);
+	std::stable_sort(order.begin(), order.end(),
+					 [&](int lhs, int rhs) { return creates[lhs].archetypeID < creates[rhs].archetypeID; });
+
+	for (int begin = 0, end = 0; begin < order.size(); begin = end)
+	{
+		int archetypeID = creates[order[begin]].archetypeID;
+		handles.clear();
+		for (end = begin; end < order.size() && creates[order[end]].archetypeID == archetypeID; end++)
+			handles.push_back(registry.Create());
+
+		int first = archetypeID == -1 ? 0 : archetypes[archetypeID].AllocateEntities(handles);
+		for (int i = begin; i < end; i++)
+		{
+			for (auto &component : creates[order[i]].components)
+			{
+				if (ComponentInfo::IsSparse(component.componentID))
+					ComponentInfo::MoveConstruct(component.componentID,
+												 world.GetSparseSet(component.componentID).Add(handles[i - begin]),
+												 component.data);
+				else
+					archetypes[archetypeID].ConstructComponent(component.componentID, first + i - begin,
+																component.data);
+			}
+		}
+	}
+
+	for (auto &lane : lanes) lane->Clear();
+}
+
+CommandBuffer::Lane &CommandBuffer::GetLane()
+{
+	thread_local uint64_t cachedBufferID = 0;
+	thread_local Lane *cachedLane = nullptr;
+	if (cachedBufferID == bufferID) return *cachedLane;
+
+	std::lock_guard lock(lanesMutex);
+	Lane *&lane = threadLanes[std::this_thread::get_id()];
+	if (!lane) lane = lanes.emplace_back(std::make_unique<Lane>()).get();
+
+	cachedBufferID = bufferID;
+	cachedLane = lane;
+	return *lane;
+}
+
+void *CommandBuffer::RecordComponent(Lane &lane, int componentID, size_t byteSize, size_t alignment)
+{
+	void *data = lane.Allocate(byteSize, alignment);
+	lane.components.push_back({componentID, data});
+	return data;
+}
+} // namespace ECS
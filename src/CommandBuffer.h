@@ -0,0 +1,121 @@
+#pragma once
+#include "ECS.h"
+#include <mutex>
+#include <thread>
+
+namespace ECS
+{
+/// @brief Records structural changes, and applies them to a world later, at a point where no spans or iterators of it
+/// are in use. Every thread records into it's own lane, so recording from a ParallelForEach or from systems is safe
+/// without locking. Playback must not run concurrently with recording.
+/// Changes of a single entity are applied in the order they were recorded, lanes are played back in the order their
+/// threads first recorded into them.
+class CommandBuffer
+{
+	enum class CommandType
+	{
+		Create,
+		Destroy,
+		AddComponent,
+		RemoveComponent,
+	};
+
+	struct Command
+	{
+		CommandType type;
+		EntityHandle entity;
+
+		/// @brief ID of the added or removed component, or the number of components of a created entity.
+		int componentID;
+
+		/// @brief Index of the first component of the command in it's lane's component list.
+		int firstComponent;
+	};
+
+	struct RecordedComponent
+	{
+		int componentID;
+		void *data;
+	};
+
+	/// @brief Commands of a single thread, components are constructed in blocks that are never reallocated.
+	struct Lane
+	{
+		std::vector<Command> commands;
+		std::vector<RecordedComponent> components;
+		std::vector<std::pair<void *, size_t>> blocks;
+		size_t currentBlock = 0;
+		size_t blockOffset = 0;
+
+		~Lane();
+		void *Allocate(size_t byteSize, size_t alignment);
+		void Clear();
+	};
+
+	std::vector<std::unique_ptr<Lane>> lanes;
+	std::unordered_map<std::thread::id, Lane *> threadLanes;
+	std::mutex lanesMutex;
+	uint64_t bufferID;
+
+  public:
+	CommandBuffer();
+	CommandBuffer(const CommandBuffer &) = delete;
+	CommandBuffer &operator=(const CommandBuffer &) = delete;
+
+	/// @brief Records creation of an entity with components.
+	/// @tparam ...TComponents List of component types that will be added to the entity
+	/// @param ...components List of components that will be added to the entity
+	template <ComponentDerived... TComponents> void Create(TComponents &&...components);
+
+	/// @brief Records destruction of an entity, stale handles are ignored during playback.
+	/// @param entity handle to the entity
+	void Destroy(EntityHandle entity);
+
+	/// @brief Records adding a component to an entity.
+	/// @tparam T type of new component
+	/// @param entity handle to the entity
+	/// @param component new component
+	template <ComponentDerived T> void AddComponent(EntityHandle entity, T &&component);
+
+	/// @brief Records removing a component from an entity.
+	/// @tparam T Type of removed component
+	/// @param entity handle to the entity
+	template <ComponentDerived T> void RemoveComponent(EntityHandle entity);
+
+	/// @brief Checks whether no commands are recorded.
+	bool Empty();
+
+	/// @brief Applies all recorded commands and clears the buffer.
+	/// Commands are folded into one transition per entity first, then entities are moved archetype by archetype,
+	/// reserving every destination once, and created entities are appended to their archetypes in bulk.
+	/// @param world world the commands are applied to
+	void Playback(World &world);
+
+  private:
+	Lane &GetLane();
+	void *RecordComponent(Lane &lane, int componentID, size_t byteSize, size_t alignment);
+};
+
+template <ComponentDerived... TComponents> void CommandBuffer::Create(TComponents &&...components)
+{
+	Lane &lane = GetLane();
+	Command command = {CommandType::Create, EntityHandle(), sizeof...(TComponents), (int)lane.components.size()};
+	((new (RecordComponent(lane, TComponents::___componentID, sizeof(TComponents), alignof(TComponents)))
+		  TComponents(std::move(components))),
+	 ...);
+	lane.commands.push_back(command);
+}
+
+template <ComponentDerived T> void CommandBuffer::AddComponent(EntityHandle entity, T &&component)
+{
+	Lane &lane = GetLane();
+	Command command = {CommandType::AddComponent, entity, T::___componentID, (int)lane.components.size()};
+	new (RecordComponent(lane, T::___componentID, sizeof(T), alignof(T))) T(std::move(component));
+	lane.commands.push_back(command);
+}
+
+template <ComponentDerived T> void CommandBuffer::RemoveComponent(EntityHandle entity)
+{
+	GetLane().commands.push_back({CommandType::RemoveComponent, entity, T::___componentID, 0});
+}
+} // namespace ECS
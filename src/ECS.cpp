@@ -1,18 +1,40 @@
 #include "ECS.h"
-#include <algorithm>
 #include <cstring>
 namespace ECS
 {
 std::vector<int> ComponentInfo::byteSizes = {};
+std::vector<int> ComponentInfo::alignments = {};
+std::vector<int> ComponentInfo::fieldSizes = {};
+std::vector<int> ComponentInfo::splitBlockSizes = {};
 std::vector<ComponentInfo::MoveConstructorPtr> ComponentInfo::moveConstructors = {};
 std::vector<ComponentInfo::DestructorPtr> ComponentInfo::destructors = {};
+std::vector<bool> ComponentInfo::triviallyCopyable = {};
+std::vector<bool> ComponentInfo::triviallyDestructible = {};
+std::vector<bool> ComponentInfo::sparse = {};
+std::vector<uint64_t> ComponentInfo::keys = {};
+std::vector<ComponentInfo::SerializerPtr> ComponentInfo::serializers = {};
+std::vector<ComponentInfo::DeserializerPtr> ComponentInfo::deserializers = {};
 
-int ComponentInfo::RegisterComponent(int byteSize, ComponentInfo::MoveConstructorPtr moveConstructor,
-									 ComponentInfo::DestructorPtr destructor)
+int ComponentInfo::RegisterComponent(int byteSize, int alignment, int fieldSize, int splitBlockSize,
+									 ComponentInfo::MoveConstructorPtr moveConstructor,
+									 ComponentInfo::DestructorPtr destructor, bool isTriviallyCopyable,
+									 bool isTriviallyDestructible, bool isSparse, uint64_t key,
+									 ComponentInfo::SerializerPtr serializer, ComponentInfo::DeserializerPtr deserializer)
 {
+	assert(FindByKey(key) == -1 && "Two component types have the same key, give one of them another componentName");
 	byteSizes.push_back(byteSize);
+	alignments.push_back(alignment);
+	fieldSizes.push_back(fieldSize);
+	splitBlockSizes.push_back(splitBlockSize);
 	moveConstructors.push_back(moveConstructor);
 	destructors.push_back(destructor);
+	triviallyCopyable.push_back(isTriviallyCopyable);
+	triviallyDestructible.push_back(isTriviallyDestructible);
+	sparse.push_back(isSparse);
+	keys.push_back(key);
+	serializers.push_back(serializer);
+	deserializers.push_back(deserializer);
+	assert(byteSizes.size() <= ECS_MAX_COMPONENTS && "Too many component types, increase ECS_MAX_COMPONENTS");
 	return byteSizes.size() - 1;
 }
 
@@ -24,6 +46,30 @@ int ComponentInfo::GetByteSize(int id)
 	return byteSizes[id];
 }
 
+int ComponentInfo::GetAlignment(int id)
+{
+	assert(0 <= id && id < alignments.size() && "Invalid Component ID");
+	return alignments[id];
+}
+
+int ComponentInfo::GetFieldSize(int id)
+{
+	assert(0 <= id && id < fieldSizes.size() && "Invalid Component ID");
+	return fieldSizes[id];
+}
+
+int ComponentInfo::GetSplitBlockSize(int id)
+{
+	assert(0 <= id && id < splitBlockSizes.size() && "Invalid Component ID");
+	return splitBlockSizes[id];
+}
+
+bool ComponentInfo::IsSparse(int id)
+{
+	assert(0 <= id && id < sparse.size() && "Invalid Component ID");
+	return sparse[id];
+}
+
 ComponentInfo::DestructorPtr ComponentInfo::GetDestructor(int id)
 {
 	assert(0 <= id && id < destructors.size() && "Invalid Component ID");
@@ -36,22 +82,240 @@ ComponentInfo::MoveConstructorPtr ComponentInfo::GetMoveConstructor(int id)
 	return moveConstructors[id];
 }
 
-Entity::Entity() : archetypeID(-1), id(0) {}
+bool ComponentInfo::IsTriviallyCopyable(int id)
+{
+	assert(0 <= id && id < triviallyCopyable.size() && "Invalid Component ID");
+	return triviallyCopyable[id];
+}
+
+bool ComponentInfo::IsTriviallyDestructible(int id)
+{
+	assert(0 <= id && id < triviallyDestructible.size() && "Invalid Component ID");
+	return triviallyDestructible[id];
+}
+
+uint64_t ComponentInfo::GetKey(int id)
+{
+	assert(0 <= id && id < keys.size() && "Invalid Component ID");
+	return keys[id];
+}
+
+int ComponentInfo::FindByKey(uint64_t key)
+{
+	auto it = std::find(keys.begin(), keys.end(), key);
+	return it == keys.end() ? -1 : (int)(it - keys.begin());
+}
+
+ComponentInfo::SerializerPtr ComponentInfo::GetSerializer(int id)
+{
+	assert(0 <= id && id < serializers.size() && "Invalid Component ID");
+	return serializers[id];
+}
+
+ComponentInfo::DeserializerPtr ComponentInfo::GetDeserializer(int id)
+{
+	assert(0 <= id && id < deserializers.size() && "Invalid Component ID");
+	return deserializers[id];
+}
+
+void ComponentInfo::MoveConstruct(int id, void *destination, void *source)
+{
+	if (IsTriviallyCopyable(id))
+		memcpy(destination, source, GetByteSize(id));
+	else
+		GetMoveConstructor(id)(destination, source);
+}
+
+void ComponentInfo::Destroy(int id, void *component)
+{
+	if (!IsTriviallyDestructible(id)) GetDestructor(id)(component);
+}
+
+bool ComponentMask::Contains(const ComponentMask &other) const
+{
+	for (int i = 0; i < wordCount; i++)
+		if ((words[i] & other.words[i]) != other.words[i]) return false;
+	return true;
+}
+
+bool ComponentMask::Intersects(const ComponentMask &other) const
+{
+	for (int i = 0; i < wordCount; i++)
+		if (words[i] & other.words[i]) return true;
+	return false;
+}
+
+ColumnIndex::ColumnIndex(const ComponentMask &columns) : columns(columns)
+{
+	int offset = 0;
+	for (int i = 0; i < ComponentMask::wordCount; i++)
+	{
+		wordOffsets[i] = offset;
+		offset += std::popcount(columns.words[i]);
+	}
+}
+
+bool ComponentMask::Empty() const
+{
+	for (int i = 0; i < wordCount; i++)
+		if (words[i]) return false;
+	return true;
+}
+
+int ComponentMask::Count() const
+{
+	int count = 0;
+	for (int i = 0; i < wordCount; i++) count += std::popcount(words[i]);
+	return count;
+}
+
+size_t ComponentMask::Hash() const
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (int i = 0; i < wordCount; i++)
+	{
+		hash ^= words[i];
+		hash *= 0x100000001b3;
+		hash ^= hash >> 32;
+	}
+	return hash;
+}
+
+EntityHandle EntityRegistry::Create()
+{
+	version++;
+	if (freeSlots.empty())
+	{
+		slots.push_back({0, -1, 0});
+		if (slots.size() > pageVersions.size() * pageSize) pageVersions.push_back(0);
+		pageVersions.back() = version;
+		return EntityHandle{(uint32_t)slots.size() - 1, 0};
+	}
+
+	uint32_t index = freeSlots.back();
+	freeSlots.pop_back();
+	slots[index].index = 0;
+	return EntityHandle{index, slots[index].generation};
+}
+
+void EntityRegistry::Destroy(EntityHandle entity)
+{
+	assert(IsAlive(entity) && "Trying to destroy an entity that is already destroyed");
+	Slot &slot = slots[entity.index];
+	assert(slot.archetypeID == -1 && "Trying to free slot of an entity that is still stored in an archetype");
+
+	slot.generation++;
+	slot.index = -1;
+	freeSlots.push_back(entity.index);
+	version++;
+	pageVersions[entity.index / pageSize] = version;
+}
+
+void EntityRegistry::Assign(std::span<const uint32_t> generations, std::span<const uint32_t> freeSlots)
+{
+	version++;
+	if (slots.size() != generations.size())
+	{
+		for (size_t page = std::min(slots.size(), generations.size()) / pageSize; page < pageVersions.size(); page++)
+			pageVersions[page] = version;
+		pageVersions.resize((generations.size() + pageSize - 1) / pageSize, version);
+	}
+
+	slots.resize(generations.size(), {0, -1, 0});
+	for (int i = 0; i < generations.size(); i++)
+	{
+		// Slots that were free have no position, the caller puts their entities back into archetypes.
+		if (slots[i].index == -1) slots[i] = {0, -1, 0};
+		if (slots[i].generation != generations[i]) pageVersions[i / pageSize] = version;
+		slots[i].generation = generations[i];
+	}
+	for (uint32_t index : freeSlots) slots[index] = {generations[index], -1, -1};
+	this->freeSlots.assign(freeSlots.begin(), freeSlots.end());
+}
+
+SparseSet::SparseSet(int componentID, Allocator &allocator)
+	: componentID(componentID), components(allocator), capacity(0)
+{
+}
+
+SparseSet::~SparseSet()
+{
+	if (ComponentInfo::IsTag(componentID) || ComponentInfo::IsTriviallyDestructible(componentID)) return;
+	for (int i = 0; i < entities.size(); i++)
+		ComponentInfo::Destroy(componentID, components.at(i, ComponentInfo::GetByteSize(componentID)));
+}
+
+void *SparseSet::Add(EntityHandle entity)
+{
+	assert(!Contains(entity) && "Trying to add multiple components of same type to an entity");
+	if (entity.index >= positions.size()) positions.resize(entity.index + 1, -1);
+	positions[entity.index] = entities.size();
+	entities.push_back(entity);
+
+	// Sparse tags store no components, their pointers point to the entity's handle like tags in archetypes.
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	if (byteSize == 0) return &entities.back();
+
+	if (entities.size() > capacity)
+	{
+		int newCapacity = std::max((int)entities.size(), (int)((capacity + 1) * 1.7));
+		int alignment = ComponentInfo::GetAlignment(componentID);
+		if (ComponentInfo::IsTriviallyCopyable(componentID))
+			components.reserve(capacity, newCapacity, byteSize, alignment);
+		else
+			components.reserve(capacity, newCapacity, byteSize, alignment, ComponentInfo::GetMoveConstructor(componentID));
+		capacity = newCapacity;
+	}
+	return components.at(entities.size() - 1, byteSize);
+}
+
+void SparseSet::Remove(EntityHandle entity)
+{
+	assert(Contains(entity) && "Trying to remove component that is not on an entity");
+	int position = positions[entity.index];
+	int last = entities.size() - 1;
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	if (byteSize != 0)
+	{
+		ComponentInfo::Destroy(componentID, components.at(position, byteSize));
+		if (position != last)
+			ComponentInfo::MoveConstruct(componentID, components.at(position, byteSize), components.at(last, byteSize));
+	}
+
+	entities[position] = entities[last];
+	positions[entities[position].index] = position;
+	positions[entity.index] = -1;
+	entities.pop_back();
+}
+
+void *SparseSet::Get(EntityHandle entity)
+{
+	assert(Contains(entity) && "Trying to get component that is not on an entity");
+	if (ComponentInfo::IsTag(componentID)) return &entities[positions[entity.index]];
+	return components.at(positions[entity.index], ComponentInfo::GetByteSize(componentID));
+}
+
+const void *SparseSet::Get(EntityHandle entity) const
+{
+	assert(Contains(entity) && "Trying to get component that is not on an entity");
+	if (ComponentInfo::IsTag(componentID)) return &entities[positions[entity.index]];
+	return components.at(positions[entity.index], ComponentInfo::GetByteSize(componentID));
+}
+
+Entity::Entity() : world(&World::GetDefault()) {}
 
 Entity::Entity(Entity &&rhs) : Entity()
 {
-	std::swap(archetypeID, rhs.archetypeID);
-	std::swap(id, rhs.id);
-	if (archetypeID != -1) ArchetypePool::GetArchetypes()[archetypeID].entityReferences.at<Entity *>(id) = this;
+	std::swap(world, rhs.world);
+	std::swap(handle, rhs.handle);
 }
 
 Entity &Entity::operator=(Entity &&rhs)
 {
 	if (this != &rhs)
 	{
-		std::swap(archetypeID, rhs.archetypeID);
-		std::swap(id, rhs.id);
-		if (archetypeID != -1) ArchetypePool::GetArchetypes()[archetypeID].entityReferences.at<Entity *>(id) = this;
+		std::swap(world, rhs.world);
+		std::swap(handle, rhs.handle);
 	}
 
 	return *this;
@@ -59,64 +323,96 @@ Entity &Entity::operator=(Entity &&rhs)
 
 Entity::~Entity()
 {
-	if (archetypeID == -1) return;
+	if (world->IsAlive(handle)) world->Destroy(handle);
+	handle = EntityHandle();
+}
+
+ChunkPool::~ChunkPool() { Clear(); }
 
-	Archetype &archetype = ArchetypePool::GetArchetypes()[archetypeID];
-	archetype.RemoveEntity(id);
+void *ChunkPool::Acquire(size_t byteSize, int alignment)
+{
+	auto it = freeBlocks.find({byteSize, alignment});
+	if (it == freeBlocks.end() || it->second.empty()) return allocator->Allocate(byteSize, alignment);
 
-	id = 0;
-	archetypeID = -1;
+	void *block = it->second.back();
+	it->second.pop_back();
+	return block;
 }
 
-bool Entity::HasComponent(int componentID) const
+void ChunkPool::Release(void *block, size_t byteSize, int alignment)
 {
-	if (archetypeID >= ArchetypePool::GetArchetypes().size()) return false;
-	return ArchetypePool::GetArchetypes()[archetypeID].denseComponentMap.contains(componentID);
+	if (block) freeBlocks[{byteSize, alignment}].push_back(block);
 }
 
-void *Entity::GetComponent(int componentID)
+void ChunkPool::Clear()
 {
-	if (archetypeID >= ArchetypePool::GetArchetypes().size()) return nullptr;
-	return ArchetypePool::GetArchetypes()[archetypeID].sparseComponentArray[componentID].at(
-		id, ComponentInfo::GetByteSize(componentID));
+	for (auto &[key, blocks] : freeBlocks)
+		for (void *block : blocks) allocator->Deallocate(block, key.first, key.second);
+	freeBlocks.clear();
 }
 
-const void *Entity::GetComponent(int componentID) const
+size_t ChunkPool::GetByteSize() const
 {
-	if (archetypeID >= ArchetypePool::GetArchetypes().size()) return nullptr;
-	return ArchetypePool::GetArchetypes()[archetypeID].sparseComponentArray[componentID].at(
-		id, ComponentInfo::GetByteSize(componentID));
+	size_t byteSize = 0;
+	for (auto &[key, blocks] : freeBlocks) byteSize += key.first * blocks.size();
+	return byteSize;
 }
 
-Archetype::Archetype() : sparseComponentArray(nullptr), entityCount(0), entityCapacity(0) {}
+Archetype::Archetype()
+	: world(nullptr), archetypeID(-1), entityCount(0), entityCapacity(0), chunkCapacity(0)
+{
+}
 
-Archetype::Archetype(const std::set<int> &componentIDs)
-	: entityCount(0), entityCapacity(0), denseComponentMap(componentIDs)
+Archetype::Archetype(const ComponentMask &componentMask, World *world, int archetypeID, int chunkByteSize)
+	: world(world), archetypeID(archetypeID), mask(componentMask), entityCount(0), entityCapacity(0),
+	  chunkCapacity(0)
 {
-	int max = 0;
-	for (auto &&i : componentIDs) max = i + 1 > max ? i + 1 : max;
+	ComponentMask columnMask;
+	int entityByteSize = sizeof(EntityHandle);
+	componentMask.ForEach([&](int id) {
+		if (ComponentInfo::IsTag(id)) return;
+		denseComponentMap.push_back(id);
+		columnMask.Set(id);
+		entityByteSize += ComponentInfo::GetByteSize(id);
+	});
 
-	sparseComponentArray = new PopbackArray[max];
+	columnIndex = ColumnIndex(columnMask);
+	if (chunkByteSize != 0)
+		chunkCapacity = std::max(chunkByteSize / entityByteSize, 1);
+	else
+		AddGrowingChunk();
 }
 
 Archetype::Archetype(Archetype &&rhs) : Archetype()
 {
-	std::swap(sparseComponentArray, rhs.sparseComponentArray);
-	std::swap(entityReferences, rhs.entityReferences);
+	std::swap(world, rhs.world);
+	std::swap(archetypeID, rhs.archetypeID);
+	std::swap(chunks, rhs.chunks);
+	std::swap(mask, rhs.mask);
 	std::swap(denseComponentMap, rhs.denseComponentMap);
 	std::swap(entityCount, rhs.entityCount);
 	std::swap(entityCapacity, rhs.entityCapacity);
+	std::swap(chunkCapacity, rhs.chunkCapacity);
+	std::swap(columnIndex, rhs.columnIndex);
+	std::swap(addEdges, rhs.addEdges);
+	std::swap(removeEdges, rhs.removeEdges);
 }
 
 Archetype &Archetype::operator=(Archetype &&rhs)
 {
 	if (this != &rhs)
 	{
-		std::swap(sparseComponentArray, rhs.sparseComponentArray);
-		std::swap(entityReferences, rhs.entityReferences);
+		std::swap(world, rhs.world);
+		std::swap(archetypeID, rhs.archetypeID);
+		std::swap(chunks, rhs.chunks);
+		std::swap(mask, rhs.mask);
 		std::swap(denseComponentMap, rhs.denseComponentMap);
 		std::swap(entityCount, rhs.entityCount);
 		std::swap(entityCapacity, rhs.entityCapacity);
+		std::swap(chunkCapacity, rhs.chunkCapacity);
+		std::swap(columnIndex, rhs.columnIndex);
+		std::swap(addEdges, rhs.addEdges);
+		std::swap(removeEdges, rhs.removeEdges);
 	}
 
 	return *this;
@@ -124,112 +420,819 @@ Archetype &Archetype::operator=(Archetype &&rhs)
 
 Archetype::~Archetype()
 {
-	if (sparseComponentArray)
+	for (auto &componentID : denseComponentMap)
 	{
-		for (auto &componentID : denseComponentMap)
-		{
-			int byteSize = ComponentInfo::GetByteSize(componentID);
-			auto moveConstructor = ComponentInfo::GetMoveConstructor(componentID);
-			for (int j = 0; j < entityCount; j++)
-			{
-				void *component = sparseComponentArray[componentID].at(j, byteSize);
-				ComponentInfo::GetDestructor(componentID)(component);
-			}
-		}
-		entityCount = 0;
-		delete[] sparseComponentArray;
-		sparseComponentArray = nullptr;
+		if (ComponentInfo::IsTriviallyDestructible(componentID)) continue;
+
+		auto destructor = ComponentInfo::GetDestructor(componentID);
+		for (int j = 0; j < entityCount; j++) destructor(GetComponent(componentID, j));
 	}
+	entityCount = 0;
+
+	if (chunkCapacity != 0)
+		while (!chunks.empty()) ReleaseChunk();
 }
 
 void Archetype::MoveEntity(int index, Archetype *newArchetype)
 {
-	if (newArchetype->entityCount + 1 >= newArchetype->entityCapacity)
-		newArchetype->Reserve((newArchetype->entityCapacity + 1) * 1.7);
+	newArchetype->EnsureCapacity(newArchetype->entityCount + 1);
 
+	int last = entityCount - 1;
 	for (auto &componentID : denseComponentMap)
 	{
-		int byteSize = ComponentInfo::GetByteSize(componentID);
-		auto moveConstructor = ComponentInfo::GetMoveConstructor(componentID);
-
-		if (newArchetype->denseComponentMap.contains(componentID))
-			newArchetype->sparseComponentArray[componentID].append(
-				sparseComponentArray[componentID].at(index, byteSize), newArchetype->entityCount, byteSize,
-				moveConstructor);
+		if (newArchetype->mask.Test(componentID))
+			newArchetype->MoveComponent(componentID, newArchetype->entityCount, *this, index);
 		else
-		{
-			void *component = sparseComponentArray[componentID].at(index, byteSize);
-			ComponentInfo::GetDestructor(componentID)(component);
-		}
-		sparseComponentArray[componentID].pop(index, entityCount, byteSize, moveConstructor);
+			DestroyComponent(componentID, index);
+
+		if (index != last) MoveComponent(componentID, index, *this, last);
 	}
 
-	entityReferences.at<Entity *>(index)->archetypeID = newArchetype - &ArchetypePool::archetypes[0];
-	entityReferences.at<Entity *>(index)->id = newArchetype->entityCount;
+	EntityHandle entity = GetEntity(index);
+	EntityRegistry &registry = world->GetRegistry();
+	EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	slot.archetypeID = newArchetype->archetypeID;
+	slot.index = newArchetype->entityCount;
+	newArchetype->GetEntity(newArchetype->entityCount) = entity;
+	newArchetype->MarkEntitiesAdded(newArchetype->entityCount, 1, mask);
 
-	newArchetype->entityReferences.append(entityReferences.at<Entity *>(index), newArchetype->entityCount);
-	entityReferences.pop<Entity *>(index, entityCount);
-	if (index < entityCount - 1) entityReferences.at<Entity *>(index)->id = index;
+	if (index != last)
+	{
+		GetEntity(index) = GetEntity(last);
+		MarkEntitiesChanged(index, 1);
+		registry.GetSlot(GetEntity(index)).index = index;
+	}
 
 	entityCount--;
 	newArchetype->entityCount++;
+	if (chunkCapacity != 0 && entityCapacity - entityCount > 2 * chunkCapacity) ReleaseChunk();
 }
 
 void Archetype::RemoveEntity(int index)
 {
+	int last = entityCount - 1;
 	for (auto &componentID : denseComponentMap)
 	{
-		int byteSize = ComponentInfo::GetByteSize(componentID);
-		auto moveConstructor = ComponentInfo::GetMoveConstructor(componentID);
+		DestroyComponent(componentID, index);
+		if (index != last) MoveComponent(componentID, index, *this, last);
+	}
 
-		void *component = sparseComponentArray[componentID].at(index, byteSize);
-		ComponentInfo::GetDestructor(componentID)(component);
-		sparseComponentArray[componentID].pop(index, entityCount, byteSize, moveConstructor);
+	if (index != last)
+	{
+		GetEntity(index) = GetEntity(last);
+		MarkEntitiesChanged(index, 1);
+		world->GetRegistry().GetSlot(GetEntity(index)).index = index;
 	}
-	entityReferences.pop(index, entityCount, sizeof(Entity *));
-	if (index < entityCount - 1) entityReferences.at<Entity *>(index)->id = index;
+
 	entityCount--;
+	if (chunkCapacity != 0 && entityCapacity - entityCount > 2 * chunkCapacity) ReleaseChunk();
 }
 
-void Archetype::Reserve(int newCapacity)
+void Archetype::MoveEntities(std::span<const int> indices, std::span<Archetype *const> destinations)
+{
+	assert(indices.size() == destinations.size() && "Every moved entity needs a destination");
+
+	std::vector<int> newIndices(indices.size());
+	std::unordered_map<Archetype *, int> counts;
+	for (Archetype *destination : destinations)
+		if (destination) counts[destination]++;
+	for (auto &[destination, count] : counts)
+	{
+		destination->EnsureCapacity(destination->entityCount + count);
+		count = destination->entityCount;
+	}
+	for (int i = 0; i < indices.size(); i++)
+		if (destinations[i]) newIndices[i] = counts[destinations[i]]++;
+
+	// Removing in descending order means the last entity is never one that still has to be moved, so every column can
+	// be processed on it's own with plain swap-pops.
+	for (auto &componentID : denseComponentMap)
+	{
+		for (int i = 0; i < indices.size(); i++)
+		{
+			Archetype *destination = destinations[i];
+			if (destination && destination->mask.Test(componentID))
+				destination->MoveComponent(componentID, newIndices[i], *this, indices[i]);
+			else
+				DestroyComponent(componentID, indices[i]);
+
+			int last = entityCount - 1 - i;
+			if (indices[i] != last) MoveComponent(componentID, indices[i], *this, last);
+		}
+	}
+
+	EntityRegistry &registry = world->GetRegistry();
+	for (int i = 0; i < indices.size(); i++)
+	{
+		EntityHandle entity = GetEntity(indices[i]);
+		EntityRegistry::Slot &slot = registry.GetSlot(entity);
+		if (Archetype *destination = destinations[i])
+		{
+			slot.archetypeID = destination->archetypeID;
+			slot.index = newIndices[i];
+			destination->GetEntity(newIndices[i]) = entity;
+			destination->MarkEntitiesAdded(newIndices[i], 1, mask);
+		}
+		else
+		{
+			slot.archetypeID = -1;
+			slot.index = 0;
+		}
+
+		int last = entityCount - 1 - i;
+		if (indices[i] != last)
+		{
+			GetEntity(indices[i]) = GetEntity(last);
+			MarkEntitiesChanged(indices[i], 1);
+			registry.GetSlot(GetEntity(indices[i])).index = indices[i];
+		}
+	}
+
+	for (auto &[destination, count] : counts) destination->entityCount = count;
+	entityCount -= indices.size();
+	while (chunkCapacity != 0 && entityCapacity - entityCount > 2 * chunkCapacity) ReleaseChunk();
+}
+
+void Archetype::RemoveEntities(std::span<const int> indices)
+{
+	// Same order as MoveEntities, the entity filling a hole always comes from past the remaining removed ones.
+	for (auto &componentID : denseComponentMap)
+	{
+		if (!ComponentInfo::IsTriviallyDestructible(componentID))
+			for (int index : indices) DestroyComponent(componentID, index);
+
+		for (int i = 0; i < indices.size(); i++)
+		{
+			int last = entityCount - 1 - i;
+			if (indices[i] != last) MoveComponent(componentID, indices[i], *this, last);
+		}
+	}
+
+	EntityRegistry &registry = world->GetRegistry();
+	for (int i = 0; i < indices.size(); i++)
+	{
+		EntityRegistry::Slot &slot = registry.GetSlot(GetEntity(indices[i]));
+		slot.archetypeID = -1;
+		slot.index = 0;
+
+		int last = entityCount - 1 - i;
+		if (indices[i] != last)
+		{
+			GetEntity(indices[i]) = GetEntity(last);
+			MarkEntitiesChanged(indices[i], 1);
+			registry.GetSlot(GetEntity(indices[i])).index = indices[i];
+		}
+	}
+
+	entityCount -= indices.size();
+	while (chunkCapacity != 0 && entityCapacity - entityCount > 2 * chunkCapacity) ReleaseChunk();
+}
+
+int Archetype::MoveAllEntities(Archetype *destination)
 {
+	int count = entityCount;
+	if (count == 0) return destination ? destination->entityCount : 0;
+
 	for (auto &componentID : denseComponentMap)
+		if ((!destination || !destination->mask.Test(componentID)) &&
+			!ComponentInfo::IsTriviallyDestructible(componentID))
+			for (int i = 0; i < count; i++) DestroyComponent(componentID, i);
+
+	EntityRegistry &registry = world->GetRegistry();
+	if (destination && destination->entityCount == 0 && destination->chunkCapacity == chunkCapacity)
+	{
+		// Both archetypes lay columns out by the same capacity, so shared columns are handed over as they are.
+		if (chunkCapacity != 0)
+			while (!destination->chunks.empty()) destination->ReleaseChunk();
+		destination->chunks.clear();
+
+		int capacity = chunkCapacity == 0 ? entityCapacity : chunkCapacity;
+		for (Chunk &chunk : chunks)
+		{
+			Chunk &handedChunk = destination->chunks.emplace_back();
+			handedChunk.columns.resize(destination->denseComponentMap.size());
+			for (int column = 0; column < destination->denseComponentMap.size(); column++)
+			{
+				int componentID = destination->denseComponentMap[column];
+				if (mask.Test(componentID))
+					handedChunk.columns[column] = std::move(chunk.columns[columnIndex[componentID]]);
+				else
+					handedChunk.columns[column] = destination->AllocateColumn(componentID, capacity);
+			}
+			for (int column = 0; column < denseComponentMap.size(); column++)
+				if (!destination->mask.Test(denseComponentMap[column]))
+					ReleaseColumn(denseComponentMap[column], chunk.columns[column], capacity);
+			handedChunk.entityReferences = std::move(chunk.entityReferences);
+			handedChunk.changedTicks.assign(destination->denseComponentMap.size(), 0);
+			handedChunk.addedTicks.assign(destination->denseComponentMap.size(), 0);
+		}
+
+		chunks.clear();
+		if (chunkCapacity == 0) AddGrowingChunk();
+		destination->entityCapacity = entityCapacity;
+		entityCapacity = 0;
+
+		for (int i = 0; i < count; i++) registry.GetSlot(destination->GetEntity(i)).archetypeID = destination->archetypeID;
+		destination->entityCount = count;
+		destination->MarkEntitiesAdded(0, count, mask);
+		entityCount = 0;
+		return 0;
+	}
+
+	int first = destination ? destination->entityCount : 0;
+	if (destination)
+	{
+		destination->EnsureCapacity(first + count);
+		for (auto &componentID : denseComponentMap)
+		{
+			if (!destination->mask.Test(componentID)) continue;
+			if (ComponentInfo::IsSplit(componentID) || !ComponentInfo::IsTriviallyCopyable(componentID))
+			{
+				for (int i = 0; i < count; i++) destination->MoveComponent(componentID, first + i, *this, i);
+				continue;
+			}
+
+			// Trivially copyable columns are copied in runs that don't cross a chunk of either archetype.
+			int byteSize = ComponentInfo::GetByteSize(componentID);
+			for (int i = 0; i < count;)
+			{
+				int run = count - i;
+				if (chunkCapacity != 0) run = std::min(run, chunkCapacity - i % chunkCapacity);
+				if (destination->chunkCapacity != 0)
+					run = std::min(run, destination->chunkCapacity - (first + i) % destination->chunkCapacity);
+				memcpy(destination->GetComponent(componentID, first + i), GetComponent(componentID, i),
+					   (size_t)run * byteSize);
+				i += run;
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++)
 	{
+		EntityHandle entity = GetEntity(i);
+		EntityRegistry::Slot &slot = registry.GetSlot(entity);
+		if (destination)
+		{
+			slot.archetypeID = destination->archetypeID;
+			slot.index = first + i;
+			destination->GetEntity(first + i) = entity;
+		}
+		else
+		{
+			slot.archetypeID = -1;
+			slot.index = 0;
+		}
+	}
+
+	if (destination)
+	{
+		destination->entityCount += count;
+		destination->MarkEntitiesAdded(first, count, mask);
+	}
+	entityCount = 0;
+	while (chunkCapacity != 0 && entityCapacity - entityCount > 2 * chunkCapacity) ReleaseChunk();
+	return first;
+}
+
+int Archetype::AllocateEntities(std::span<const EntityHandle> entities)
+{
+	EnsureCapacity(entityCount + entities.size());
+
+	int first = entityCount;
+	EntityRegistry &registry = world->GetRegistry();
+	for (EntityHandle entity : entities)
+	{
+		EntityRegistry::Slot &slot = registry.GetSlot(entity);
+		slot.archetypeID = archetypeID;
+		slot.index = entityCount;
+		GetEntity(entityCount) = entity;
+		entityCount++;
+	}
+	MarkEntitiesAdded(first, entities.size(), ComponentMask());
+	return first;
+}
+
+void Archetype::Reserve(int newCapacity)
+{
+	if (chunkCapacity != 0)
+	{
+		while (entityCapacity < newCapacity) AddChunk();
+		return;
+	}
+
+	Chunk &chunk = chunks[0];
+	for (int i = 0; i < denseComponentMap.size(); i++)
+	{
+		int componentID = denseComponentMap[i];
+		PopbackArray &column = chunk.columns[i];
 		int byteSize = ComponentInfo::GetByteSize(componentID);
-		auto moveConstructor = ComponentInfo::GetMoveConstructor(componentID);
+		int alignment = ComponentInfo::GetColumnAlignment(componentID);
+		int oldColumnCapacity = GetColumnCapacity(componentID, entityCapacity);
+		int newColumnCapacity = GetColumnCapacity(componentID, newCapacity);
 
-		sparseComponentArray[componentID].reserve(entityCapacity, newCapacity, byteSize, moveConstructor);
+		if (ComponentInfo::IsSplit(componentID) && ComponentInfo::GetSplitBlockSize(componentID) == 0)
+		{
+			// Fully split columns store every field in a run as long as the capacity, so they have to be laid out again.
+			int fieldSize = ComponentInfo::GetFieldSize(componentID);
+			PopbackArray resized(world->GetAllocator());
+			resized.reserve(0, newColumnCapacity, byteSize, alignment);
+			for (int field = 0; field < byteSize / fieldSize && entityCount != 0; field++)
+				memcpy(resized.at(field * newColumnCapacity, fieldSize), column.at(field * oldColumnCapacity, fieldSize),
+					   std::min(entityCount, newCapacity) * fieldSize);
+			column = std::move(resized);
+		}
+		else if (ComponentInfo::IsTriviallyCopyable(componentID))
+			column.reserve(oldColumnCapacity, newColumnCapacity, byteSize, alignment);
+		else
+			column.reserve(oldColumnCapacity, newColumnCapacity, byteSize, alignment,
+						   ComponentInfo::GetMoveConstructor(componentID));
 	}
-	entityReferences.reserve(entityCapacity, newCapacity, sizeof(Entity *));
+	chunk.entityReferences.reserve(entityCapacity, newCapacity, sizeof(EntityHandle), cacheLineSize);
 
 	entityCapacity = newCapacity;
 }
 
-std::span<Entity *> Archetype::GetEntities()
+void Archetype::EnsureCapacity(int count)
 {
-	Entity **begin = (Entity **)entityReferences.data();
-	Entity **end = begin + entityCount;
+	if (count <= entityCapacity) return;
 
-	return std::span<Entity *>(begin, end);
+	if (chunkCapacity != 0)
+		Reserve(count);
+	else
+		Reserve(std::max(count, (int)((entityCapacity + 1) * 1.7)));
 }
 
-std::vector<Archetype> ArchetypePool::archetypes = {};
+void Archetype::ShrinkToFit()
+{
+	if (chunkCapacity != 0)
+	{
+		while (chunks.size() > GetChunkCount()) ReleaseChunk();
+		return;
+	}
+	if (entityCount == entityCapacity) return;
+
+	if (entityCount != 0)
+	{
+		Reserve(entityCount);
+		return;
+	}
 
-Archetype *ArchetypePool::AddArchetype(Archetype &&archetype)
+	chunks.clear();
+	AddGrowingChunk();
+	entityCapacity = 0;
+}
+
+size_t Archetype::GetByteSize() const
 {
-	auto it = std::find_if(archetypes.begin(), archetypes.end(), [&archetype](const Archetype &a) {
-		return archetype.denseComponentMap == a.denseComponentMap;
-	});
-	assert(it == archetypes.end() && "Trying to add archetype with non unique component mask");
+	int capacity = chunkCapacity == 0 ? entityCapacity : chunkCapacity;
+	size_t byteSize = (size_t)capacity * sizeof(EntityHandle);
+	for (auto &componentID : denseComponentMap)
+		byteSize += (size_t)GetColumnCapacity(componentID, capacity) * ComponentInfo::GetByteSize(componentID);
+	return chunkCapacity == 0 ? byteSize : byteSize * chunks.size();
+}
+
+void *Archetype::GetComponent(int componentID, int index)
+{
+	assert(!ComponentInfo::IsSplit(componentID) && "Split components are accessed by fields");
+	if (ComponentInfo::IsTag(componentID)) return &GetEntity(index);
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	int column = columnIndex[componentID];
+	if (chunkCapacity == 0) return chunks[0].columns[column].at(index, byteSize);
+	return chunks[index / chunkCapacity].columns[column].at(index % chunkCapacity, byteSize);
+}
+
+const void *Archetype::GetComponent(int componentID, int index) const
+{
+	assert(!ComponentInfo::IsSplit(componentID) && "Split components are accessed by fields");
+	if (ComponentInfo::IsTag(componentID)) return &GetEntity(index);
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	int column = columnIndex[componentID];
+	if (chunkCapacity == 0) return chunks[0].columns[column].at(index, byteSize);
+	return chunks[index / chunkCapacity].columns[column].at(index % chunkCapacity, byteSize);
+}
+
+void *Archetype::GetField(int componentID, int index, int field)
+{
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	int blockSize = GetSplitBlockSize(componentID);
+
+	int position = chunkCapacity == 0 ? index : index % chunkCapacity;
+	Chunk &chunk = chunks[chunkCapacity == 0 ? 0 : index / chunkCapacity];
+	size_t offset = (size_t)(position / blockSize) * blockSize * byteSize +
+					((size_t)field * blockSize + position % blockSize) * fieldSize;
+	return (char *)chunk.columns[columnIndex[componentID]].data() + offset;
+}
+
+int Archetype::GetSplitBlockSize(int componentID) const
+{
+	return GetSplitBlockSize(componentID, chunkCapacity == 0 ? entityCapacity : chunkCapacity);
+}
+
+void Archetype::MoveComponent(int componentID, int index, Archetype &source, int sourceIndex)
+{
+	if (!ComponentInfo::IsSplit(componentID))
+	{
+		ComponentInfo::MoveConstruct(componentID, GetComponent(componentID, index),
+									 source.GetComponent(componentID, sourceIndex));
+		return;
+	}
+
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	for (int field = 0; field < ComponentInfo::GetByteSize(componentID) / fieldSize; field++)
+		memcpy(GetField(componentID, index, field), source.GetField(componentID, sourceIndex, field), fieldSize);
+}
+
+void Archetype::ConstructComponent(int componentID, int index, void *component)
+{
+	if (ComponentInfo::IsTag(componentID)) return;
+	if (!ComponentInfo::IsSplit(componentID))
+	{
+		ComponentInfo::MoveConstruct(componentID, GetComponent(componentID, index), component);
+		return;
+	}
+
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	for (int field = 0; field < ComponentInfo::GetByteSize(componentID) / fieldSize; field++)
+		memcpy(GetField(componentID, index, field), (char *)component + field * fieldSize, fieldSize);
+}
+
+void Archetype::DestroyComponent(int componentID, int index)
+{
+	if (!ComponentInfo::IsTriviallyDestructible(componentID))
+		ComponentInfo::GetDestructor(componentID)(GetComponent(componentID, index));
+}
+
+EntityHandle &Archetype::GetEntity(int index)
+{
+	if (chunkCapacity == 0) return chunks[0].entityReferences.at<EntityHandle>(index);
+	return chunks[index / chunkCapacity].entityReferences.at<EntityHandle>(index % chunkCapacity);
+}
+
+const EntityHandle &Archetype::GetEntity(int index) const
+{
+	if (chunkCapacity == 0) return chunks[0].entityReferences.at<EntityHandle>(index);
+	return chunks[index / chunkCapacity].entityReferences.at<EntityHandle>(index % chunkCapacity);
+}
+
+bool ChangeFilter::Matches(const Archetype &archetype, int chunk) const
+{
+	const Chunk &data = archetype.chunks[chunk];
+	for (int componentID : changed)
+		if (data.changedTicks[archetype.columnIndex[componentID]] <= since) return false;
+	for (int componentID : added)
+		if (data.addedTicks[archetype.columnIndex[componentID]] <= since) return false;
+	return true;
+}
+
+void Archetype::MarkEntitiesChanged(int first, int count)
+{
+	if (count == 0) return;
+	uint64_t tick = world->GetChangeTick();
+	if (chunkCapacity == 0)
+	{
+		std::fill(chunks[0].changedTicks.begin(), chunks[0].changedTicks.end(), tick);
+		return;
+	}
+
+	for (int chunk = first / chunkCapacity; chunk <= (first + count - 1) / chunkCapacity; chunk++)
+		std::fill(chunks[chunk].changedTicks.begin(), chunks[chunk].changedTicks.end(), tick);
+}
+
+void Archetype::MarkEntitiesAdded(int first, int count, const ComponentMask &previousMask)
+{
+	if (count == 0) return;
+	MarkEntitiesChanged(first, count);
+
+	uint64_t tick = world->GetChangeTick();
+	int lastChunk = chunkCapacity == 0 ? 0 : (first + count - 1) / chunkCapacity;
+	for (int column = 0; column < denseComponentMap.size(); column++)
+	{
+		if (previousMask.Test(denseComponentMap[column])) continue;
+		for (int chunk = chunkCapacity == 0 ? 0 : first / chunkCapacity; chunk <= lastChunk; chunk++)
+			chunks[chunk].addedTicks[column] = tick;
+	}
+}
+
+void Archetype::AddGrowingChunk()
+{
+	Chunk &chunk = chunks.emplace_back();
+	chunk.entityReferences = PopbackArray(world->GetAllocator());
+	chunk.columns.reserve(denseComponentMap.size());
+	for (int i = 0; i < denseComponentMap.size(); i++) chunk.columns.emplace_back(world->GetAllocator());
+	chunk.changedTicks.assign(denseComponentMap.size(), 0);
+	chunk.addedTicks.assign(denseComponentMap.size(), 0);
+}
+
+void Archetype::AddChunk()
+{
+	Chunk &chunk = chunks.emplace_back();
+	chunk.entityReferences = PopbackArray(world->GetAllocator());
+	chunk.columns.reserve(denseComponentMap.size());
+	for (auto &componentID : denseComponentMap) chunk.columns.push_back(AllocateColumn(componentID, chunkCapacity));
+	chunk.changedTicks.assign(denseComponentMap.size(), 0);
+	chunk.addedTicks.assign(denseComponentMap.size(), 0);
+	size_t entitiesByteSize = chunkCapacity * sizeof(EntityHandle);
+	chunk.entityReferences.assign(world->GetChunkPool().Acquire(entitiesByteSize, cacheLineSize), entitiesByteSize,
+								  cacheLineSize);
+
+	entityCapacity += chunkCapacity;
+}
+
+void Archetype::ReleaseChunk()
+{
+	Chunk &chunk = chunks.back();
+	for (int column = 0; column < denseComponentMap.size(); column++)
+		ReleaseColumn(denseComponentMap[column], chunk.columns[column], chunkCapacity);
+	world->GetChunkPool().Release(chunk.entityReferences.release(), chunkCapacity * sizeof(EntityHandle),
+								  cacheLineSize);
+
+	chunks.pop_back();
+	entityCapacity -= chunkCapacity;
+}
+
+PopbackArray Archetype::AllocateColumn(int componentID, int capacity)
+{
+	PopbackArray column(world->GetAllocator());
+	int alignment = ComponentInfo::GetColumnAlignment(componentID);
+	int columnCapacity = GetColumnCapacity(componentID, capacity);
+	if (chunkCapacity == 0)
+		column.reserve(0, columnCapacity, ComponentInfo::GetByteSize(componentID), alignment);
+	else
+	{
+		size_t byteSize = (size_t)columnCapacity * ComponentInfo::GetByteSize(componentID);
+		column.assign(world->GetChunkPool().Acquire(byteSize, alignment), byteSize, alignment);
+	}
+	return column;
+}
 
-	archetypes.emplace_back(std::move(archetype));
+void Archetype::ReleaseColumn(int componentID, PopbackArray &column, int capacity)
+{
+	if (chunkCapacity == 0)
+	{
+		column = PopbackArray(world->GetAllocator());
+		return;
+	}
+
+	world->GetChunkPool().Release(column.release(),
+								  GetColumnCapacity(componentID, capacity) * ComponentInfo::GetByteSize(componentID),
+								  ComponentInfo::GetColumnAlignment(componentID));
+}
+
+int Archetype::GetSplitBlockSize(int componentID, int capacity)
+{
+	int blockSize = ComponentInfo::GetSplitBlockSize(componentID);
+	if (blockSize != 0) return blockSize;
+
+	// Fully split columns round their capacity so that every field starts on a cache line.
+	int granularity = std::max(cacheLineSize / ComponentInfo::GetFieldSize(componentID), 1);
+	return std::max((capacity + granularity - 1) / granularity * granularity, granularity);
+}
+
+int Archetype::GetColumnCapacity(int componentID, int capacity)
+{
+	if (!ComponentInfo::IsSplit(componentID)) return capacity;
+
+	int blockSize = GetSplitBlockSize(componentID, capacity);
+	return (capacity + blockSize - 1) / blockSize * blockSize;
+}
+
+ArchetypePool::ArchetypePool(World *world) : world(world), chunkByteSize(0), removalCount(0) {}
+
+Archetype *ArchetypePool::AddArchetype(const ComponentMask &componentMask)
+{
+	[[maybe_unused]] auto [it, inserted] = archetypeIndex.try_emplace(componentMask, (int)archetypes.size());
+	assert(inserted && "Trying to add archetype with non unique component mask");
+
+	archetypes.emplace_back(componentMask, world, (int)archetypes.size(), chunkByteSize);
 	return &archetypes.back();
 }
 
-Archetype *ArchetypePool::GetArchetype(const std::set<int> &componentsID)
+Archetype *ArchetypePool::GetArchetype(const ComponentMask &componentMask)
+{
+	auto it = archetypeIndex.find(componentMask);
+	if (it == archetypeIndex.end()) return nullptr;
+	return &archetypes[it->second];
+}
+
+Archetype *ArchetypePool::GetArchetypeWith(int archetypeID, int componentID)
+{
+	auto edge = archetypes[archetypeID].addEdges.find(componentID);
+	if (edge != archetypes[archetypeID].addEdges.end()) return &archetypes[edge->second];
+
+	ComponentMask componentMask = archetypes[archetypeID].mask;
+	componentMask.Set(componentID);
+
+	Archetype *newArchetype = nullptr;
+	if (!(newArchetype = GetArchetype(componentMask))) newArchetype = AddArchetype(componentMask);
+
+	int newArchetypeID = newArchetype->archetypeID;
+	archetypes[archetypeID].addEdges[componentID] = newArchetypeID;
+	newArchetype->removeEdges[componentID] = archetypeID;
+	return newArchetype;
+}
+
+Archetype *ArchetypePool::GetArchetypeWithout(int archetypeID, int componentID)
+{
+	auto edge = archetypes[archetypeID].removeEdges.find(componentID);
+	if (edge != archetypes[archetypeID].removeEdges.end()) return &archetypes[edge->second];
+
+	ComponentMask componentMask = archetypes[archetypeID].mask;
+	componentMask.Reset(componentID);
+	assert(!componentMask.Empty() && "Trying to get archetype with no components");
+
+	Archetype *newArchetype = nullptr;
+	if (!(newArchetype = GetArchetype(componentMask))) newArchetype = AddArchetype(componentMask);
+
+	int newArchetypeID = newArchetype->archetypeID;
+	archetypes[archetypeID].removeEdges[componentID] = newArchetypeID;
+	newArchetype->addEdges[componentID] = archetypeID;
+	return newArchetype;
+}
+
+int ArchetypePool::RemoveEmptyArchetypes()
+{
+	std::vector<int> newIDs(archetypes.size(), -1);
+	int keptCount = 0;
+	for (int i = 0; i < archetypes.size(); i++)
+		if (archetypes[i].entityCount != 0) newIDs[i] = keptCount++;
+
+	int removedCount = (int)archetypes.size() - keptCount;
+	if (removedCount == 0) return 0;
+
+	auto remapEdges = [&](std::unordered_map<int, int> &edges) {
+		for (auto it = edges.begin(); it != edges.end();)
+		{
+			if (newIDs[it->second] == -1)
+				it = edges.erase(it);
+			else
+			{
+				it->second = newIDs[it->second];
+				++it;
+			}
+		}
+	};
+
+	EntityRegistry &registry = world->GetRegistry();
+	archetypeIndex.clear();
+	for (int i = 0; i < archetypes.size(); i++)
+	{
+		if (newIDs[i] == -1) continue;
+
+		Archetype &archetype = archetypes[i];
+		archetype.archetypeID = newIDs[i];
+		remapEdges(archetype.addEdges);
+		remapEdges(archetype.removeEdges);
+		for (int j = 0; j < archetype.entityCount; j++) registry.GetSlot(archetype.GetEntity(j)).archetypeID = newIDs[i];
+
+		archetypeIndex.emplace(archetype.mask, newIDs[i]);
+		if (newIDs[i] != i) archetypes[newIDs[i]] = std::move(archetype);
+	}
+	archetypes.erase(archetypes.begin() + keptCount, archetypes.end());
+
+	removalCount++;
+	return removedCount;
+}
+
+World::World(Allocator &allocator)
+	: allocator(&allocator), chunkPool(allocator), archetypePool(this), threadPool(nullptr), changeTick(1)
+{
+}
+
+World &World::GetDefault()
+{
+	static World world;
+	return world;
+}
+
+EntityHandle World::Create() { return registry.Create(); }
+
+void World::Destroy(EntityHandle entity)
+{
+	assert(IsAlive(entity) && "Trying to destroy an entity that is already destroyed");
+	EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	if (slot.archetypeID != -1) archetypePool.GetArchetypes()[slot.archetypeID].RemoveEntity(slot.index);
+
+	slot.archetypeID = -1;
+	RemoveSparseComponents(entity);
+	registry.Destroy(entity);
+}
+
+void World::DestroyBatch(std::span<const EntityHandle> entities)
+{
+	// Group positions by archetype with a counting sort, archetype IDs are dense.
+	std::span<Archetype> archetypes = archetypePool.GetArchetypes();
+	std::vector<int> offsets(archetypes.size() + 1);
+	for (EntityHandle entity : entities)
+	{
+		assert(IsAlive(entity) && "Trying to destroy an entity that is already destroyed");
+		const EntityRegistry::Slot &slot = registry.GetSlot(entity);
+		if (slot.archetypeID != -1) offsets[slot.archetypeID + 1]++;
+	}
+	for (int i = 1; i < offsets.size(); i++) offsets[i] += offsets[i - 1];
+
+	std::vector<int> positions(offsets.back());
+	std::vector<int> next(offsets.begin(), offsets.end() - 1);
+	for (EntityHandle entity : entities)
+	{
+		const EntityRegistry::Slot &slot = registry.GetSlot(entity);
+		if (slot.archetypeID != -1) positions[next[slot.archetypeID]++] = slot.index;
+	}
+
+	std::vector<bool> removed;
+	for (int archetypeID = 0; archetypeID < archetypes.size(); archetypeID++)
+	{
+		std::span<int> indices(positions.data() + offsets[archetypeID], positions.data() + offsets[archetypeID + 1]);
+		if (indices.empty()) continue;
+
+		// Large batches are ordered by marking positions, small ones by sorting them.
+		Archetype &archetype = archetypes[archetypeID];
+		if (indices.size() * 16 >= archetype.entityCount)
+		{
+			removed.assign(archetype.entityCount, false);
+			for (int index : indices)
+			{
+				assert(!removed[index] && "Trying to destroy an entity multiple times");
+				removed[index] = true;
+			}
+			int i = 0;
+			for (int index = archetype.entityCount - 1; index >= 0; index--)
+				if (removed[index]) indices[i++] = index;
+		}
+		else
+		{
+			std::sort(indices.begin(), indices.end(), std::greater<int>());
+			assert(std::adjacent_find(indices.begin(), indices.end()) == indices.end() &&
+				   "Trying to destroy an entity multiple times");
+		}
+		archetype.RemoveEntities(indices);
+	}
+
+	for (EntityHandle entity : entities)
+	{
+		RemoveSparseComponents(entity);
+		registry.Destroy(entity);
+	}
+}
+
+size_t World::Trim(const TrimPolicy &policy)
+{
+	auto getByteSize = [&]() {
+		size_t byteSize = chunkPool.GetByteSize();
+		for (Archetype &archetype : archetypePool.GetArchetypes()) byteSize += archetype.GetByteSize();
+		return byteSize;
+	};
+	size_t oldByteSize = getByteSize();
+
+	for (Archetype &archetype : archetypePool.GetArchetypes())
+		if (archetype.entityCount < archetype.entityCapacity * policy.minOccupancy) archetype.ShrinkToFit();
+	if (policy.removeEmptyArchetypes) archetypePool.RemoveEmptyArchetypes();
+	if (policy.releasePooledChunks) chunkPool.Clear();
+
+	return oldByteSize - getByteSize();
+}
+
+SparseSet &World::GetSparseSet(int componentID)
+{
+	assert(ComponentInfo::IsSparse(componentID) && "Component is not sparse");
+	if (componentID >= sparseSets.size()) sparseSets.resize(componentID + 1);
+	if (!sparseSets[componentID]) sparseSets[componentID] = std::make_unique<SparseSet>(componentID, *allocator);
+	return *sparseSets[componentID];
+}
+
+void World::RemoveSparseComponents(EntityHandle entity)
+{
+	for (auto &sparseSet : sparseSets)
+		if (sparseSet && sparseSet->Contains(entity)) sparseSet->Remove(entity);
+}
+
+bool World::HasComponent(EntityHandle entity, int componentID) const
+{
+	assert(IsAlive(entity) && "Trying to access a destroyed entity");
+	if (ComponentInfo::IsSparse(componentID))
+		return componentID < sparseSets.size() && sparseSets[componentID] && sparseSets[componentID]->Contains(entity);
+
+	const EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	if (slot.archetypeID == -1) return false;
+	return archetypePool.GetArchetypes()[slot.archetypeID].mask.Test(componentID);
+}
+
+void *World::GetComponent(EntityHandle entity, int componentID)
+{
+	assert(HasComponent(entity, componentID) && "Trying to get component that is not on an entity");
+	if (ComponentInfo::IsSparse(componentID)) return sparseSets[componentID]->Get(entity);
+	const EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	Archetype &archetype = archetypePool.GetArchetypes()[slot.archetypeID];
+	archetype.MarkChanged(componentID, archetype.chunkCapacity == 0 ? 0 : slot.index / archetype.chunkCapacity,
+						  changeTick);
+	return archetype.GetComponent(componentID, slot.index);
+}
+
+const void *World::GetComponent(EntityHandle entity, int componentID) const
 {
-	for (auto &i : archetypes)
-		if (i.denseComponentMap == componentsID) return &i;
-	return nullptr;
+	assert(HasComponent(entity, componentID) && "Trying to get component that is not on an entity");
+	if (ComponentInfo::IsSparse(componentID)) return std::as_const(*sparseSets[componentID]).Get(entity);
+	const EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	return archetypePool.GetArchetypes()[slot.archetypeID].GetComponent(componentID, slot.index);
 }
 } // namespace ECS
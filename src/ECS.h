@@ -1,19 +1,70 @@
 #pragma once
+#include "Allocator.h"
 #include "PopbackArray.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <concepts>
+#include <cstdint>
 #include <iostream>
-#include <set>
+#include <map>
+#include <memory>
+#include <source_location>
 #include <span>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifndef ECS_MAX_COMPONENTS
+/// @brief Upper bound on the number of registered component types, determines the size of ComponentMask.
+#define ECS_MAX_COMPONENTS 1024
+#endif
+
 namespace ECS
 {
 static consteval int ceil(double num) { return (int)num + (num != int(num)); }
+static constexpr int cacheLineSize = 64;
 template <typename TComponent> struct Component;
 template <typename TComponent>
 concept ComponentDerived = std::is_base_of_v<Component<TComponent>, TComponent>;
 
+/// @brief Component stored split by field instead of as an array of structs. Opted into by declaring the type of it's
+/// fields, `using SplitField = float;`, all fields must have that type. Entities are stored in blocks of
+/// `static constexpr int splitBlockSize` entities (AoSoA), or fully split (SoA) if it's not declared.
+template <typename TComponent>
+concept SplitComponent = ComponentDerived<TComponent> && requires { typename TComponent::SplitField; };
+
+/// @brief Component stored in a sparse set keyed by entity instead of in archetype columns, opted into by declaring
+/// `static constexpr bool sparseStorage = true;`. It's not part of archetype masks, so adding and removing it never
+/// moves the entity, and queries test membership of every entity instead. Meant for components toggled every few frames.
+template <typename TComponent>
+concept SparseComponent = ComponentDerived<TComponent> && requires { requires TComponent::sparseStorage; };
+
+/// @brief Component without data, `struct Tag : Component<Tag> {};`. Tags are only part of archetype's mask, they have no
+/// column and cost nothing per entity when entities are moved. Iteration yields references to tags that must not be
+/// written to.
+template <typename TComponent>
+concept TagComponent =
+	ComponentDerived<TComponent> && std::is_empty_v<TComponent> && std::is_trivially_destructible_v<TComponent>;
+
+class SnapshotWriter;
+class SnapshotReader;
+
+/// @brief Component written to snapshots by a hook instead of as raw bytes, needed by components that are not trivially
+/// copyable. Opted into by declaring `void Serialize(SnapshotWriter &writer) const;` and
+/// `static T Deserialize(SnapshotReader &reader);`, see Snapshot.h.
+template <typename TComponent>
+concept SerializableComponent =
+	ComponentDerived<TComponent> && requires(const TComponent &component, SnapshotWriter &writer, SnapshotReader &reader) {
+		component.Serialize(writer);
+		{ TComponent::Deserialize(reader) } -> std::same_as<TComponent>;
+	};
+
 /// @brief Holds information about components, like byte size, destructors, maximum components, accessed using
 /// ComponentIDs.
 class ComponentInfo
@@ -21,21 +72,64 @@ class ComponentInfo
   public:
 	typedef void (*MoveConstructorPtr)(void *, void *);
 	typedef void (*DestructorPtr)(void *);
+	typedef void (*SerializerPtr)(const void *, SnapshotWriter &);
+	typedef void (*DeserializerPtr)(void *, SnapshotReader &);
 
   private:
 	static std::vector<int> byteSizes;
+	static std::vector<int> alignments;
+	static std::vector<int> fieldSizes;
+	static std::vector<int> splitBlockSizes;
 	static std::vector<MoveConstructorPtr> moveConstructors;
 	static std::vector<DestructorPtr> destructors;
+	static std::vector<bool> triviallyCopyable;
+	static std::vector<bool> triviallyDestructible;
+	static std::vector<bool> sparse;
+	static std::vector<uint64_t> keys;
+	static std::vector<SerializerPtr> serializers;
+	static std::vector<DeserializerPtr> deserializers;
 
   private:
-	static int RegisterComponent(int byteSize, MoveConstructorPtr moveConstructor, DestructorPtr destructor);
+	static int RegisterComponent(int byteSize, int alignment, int fieldSize, int splitBlockSize,
+								 MoveConstructorPtr moveConstructor, DestructorPtr destructor, bool isTriviallyCopyable,
+								 bool isTriviallyDestructible, bool isSparse, uint64_t key, SerializerPtr serializer,
+								 DeserializerPtr deserializer);
 
 	/// @brief Registers a component, saving it's byte size and destructor function.
 	/// @tparam T Component type
 	/// @return unique id, used in GetByteSize and GetDestructor functions
 	template <ComponentDerived T> static int RegisterComponent()
 	{
-		return RegisterComponent(sizeof(T), Component<T>::Move, Component<T>::Destroy);
+		int fieldSize = 0;
+		int splitBlockSize = 0;
+		if constexpr (SplitComponent<T>)
+		{
+			static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+						  "Split components have to be trivially copyable and destructible");
+			static_assert(sizeof(T) % sizeof(typename T::SplitField) == 0, "Split component has padding");
+			fieldSize = sizeof(typename T::SplitField);
+			if constexpr (requires { T::splitBlockSize; }) splitBlockSize = T::splitBlockSize;
+		}
+		static_assert(!(SplitComponent<T> && SparseComponent<T>), "Sparse components can't be split");
+
+		// Keys of types without a declared name come from the compiler's name of this function, which includes T.
+		uint64_t key;
+		if constexpr (requires { T::componentName; })
+			key = HashName(T::componentName);
+		else
+			key = HashName(std::source_location::current().function_name());
+
+		SerializerPtr serializer = nullptr;
+		DeserializerPtr deserializer = nullptr;
+		if constexpr (SerializableComponent<T>)
+		{
+			serializer = Component<T>::Write;
+			deserializer = Component<T>::Read;
+		}
+
+		return RegisterComponent(TagComponent<T> ? 0 : sizeof(T), alignof(T), fieldSize, splitBlockSize, Component<T>::Move,
+								 Component<T>::Destroy, std::is_trivially_copyable_v<T>,
+								 std::is_trivially_destructible_v<T>, SparseComponent<T>, key, serializer, deserializer);
 	}
 
   public:
@@ -45,9 +139,45 @@ class ComponentInfo
 
 	/// @brief Get byte size of a component.
 	/// @param id ID of component
-	/// @return Byte size of the component
+	/// @return Byte size of the component, 0 for tags
 	static int GetByteSize(int id);
 
+	/// @brief Get alignment of a component.
+	/// @param id ID of component
+	/// @return alignof of the component
+	static int GetAlignment(int id);
+
+	/// @brief Get alignment of columns storing a component, at least cacheLineSize so columns start on a cache line
+	/// and aligned SIMD loads can be used on them.
+	/// @param id ID of component
+	/// @return max(alignof, cacheLineSize)
+	static int GetColumnAlignment(int id) { return std::max(GetAlignment(id), cacheLineSize); }
+
+	/// @brief Checks whether a component is stored split by field.
+	/// @param id ID of component
+	/// @return true if component is a SplitComponent
+	static bool IsSplit(int id) { return GetFieldSize(id) != 0; }
+
+	/// @brief Checks whether a component is a tag without storage.
+	/// @param id ID of component
+	/// @return true if component is a TagComponent
+	static bool IsTag(int id) { return GetByteSize(id) == 0; }
+
+	/// @brief Checks whether a component is stored in a sparse set instead of archetypes.
+	/// @param id ID of component
+	/// @return true if component is a SparseComponent
+	static bool IsSparse(int id);
+
+	/// @brief Get byte size of a field of a split component.
+	/// @param id ID of component
+	/// @return sizeof(SplitField), 0 if component is not split
+	static int GetFieldSize(int id);
+
+	/// @brief Get number of entities in a block of a split component.
+	/// @param id ID of component
+	/// @return splitBlockSize, 0 if component is fully split
+	static int GetSplitBlockSize(int id);
+
 	/// @brief Get destructor of a component.
 	/// @param id ID of component
 	/// @return Destructor of the component.
@@ -58,6 +188,58 @@ class ComponentInfo
 	/// @return Move constructor of the component.
 	static MoveConstructorPtr GetMoveConstructor(int id);
 
+	/// @brief Checks whether a component can be relocated with memcpy instead of it's move constructor.
+	/// @param id ID of component
+	/// @return true if component is trivially copyable
+	static bool IsTriviallyCopyable(int id);
+
+	/// @brief Checks whether a component's destructor can be skipped.
+	/// @param id ID of component
+	/// @return true if component is trivially destructible
+	static bool IsTriviallyDestructible(int id);
+
+	/// @brief Move constructs a component at destination, using memcpy for trivially copyable components.
+	/// @param id ID of component
+	/// @param destination uninitialized memory
+	/// @param source component to be moved from
+	static void MoveConstruct(int id, void *destination, void *source);
+
+	/// @brief Destroys a component, skipping trivially destructible ones.
+	/// @param id ID of component
+	/// @param component component to be destroyed
+	static void Destroy(int id, void *component);
+
+	/// @brief Get the stable key of a component, identifying it in snapshots independently of registration order.
+	/// It's the hash of `static constexpr const char *componentName` if the component declares it, otherwise of the
+	/// compiler's name of the type, which is stable only between builds of the same compiler.
+	/// @param id ID of component
+	/// @return 64 bit key
+	static uint64_t GetKey(int id);
+
+	/// @brief Finds a component by it's stable key.
+	/// @param key key returned by GetKey
+	/// @return ID of the component, -1 if no registered component has the key
+	static int FindByKey(uint64_t key);
+
+	/// @brief Get serialize hook of a component.
+	/// @param id ID of component
+	/// @return hook calling component's Serialize, nullptr if component is not a SerializableComponent
+	static SerializerPtr GetSerializer(int id);
+
+	/// @brief Get deserialize hook of a component.
+	/// @param id ID of component
+	/// @return hook constructing a component returned by Deserialize, nullptr if component is not a
+	/// SerializableComponent
+	static DeserializerPtr GetDeserializer(int id);
+
+	/// @brief Hashes a name with 64 bit FNV-1a.
+	static constexpr uint64_t HashName(std::string_view name)
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		for (char c : name) hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+		return hash;
+	}
+
 	template <typename T> friend class Component;
 };
 
@@ -79,24 +261,331 @@ template <typename T> class Component
 	/// @param source
 	static void Move(void *destination, void *source) { new ((T *)destination) T(std::move(*(T *)source)); }
 
+	/// @brief Function invoking child's serialize hook.
+	/// @param component Pointer to child's memory address
+	/// @param writer
+	static void Write(const void *component, SnapshotWriter &writer) { ((const T *)component)->Serialize(writer); }
+
+	/// @brief Function constructing a child from it's deserialize hook.
+	/// @param destination uninitialized memory
+	/// @param reader
+	static void Read(void *destination, SnapshotReader &reader) { new ((T *)destination) T(T::Deserialize(reader)); }
+
 	friend ComponentInfo;
-	friend class Entity;
+	friend class ComponentMask;
 	friend class Archetype;
 	friend class ArchetypePool;
+	friend class World;
+	friend class CommandBuffer;
+	friend struct ChangeFilter;
 };
 template <typename T> const int Component<T>::___componentID = ComponentInfo::RegisterComponent<T>();
 
+/// @brief View of a split component's column in a chunk. Entities are stored in blocks of blockSize entities, each
+/// block holding blockSize values of the first field, then of the second one and so on. Fully split components have a
+/// single block per chunk.
+template <SplitComponent T> struct SplitSpan
+{
+	typedef typename T::SplitField Field;
+	static constexpr int fieldCount = sizeof(T) / sizeof(Field);
+
+	Field *data;
+	size_t count;
+	size_t blockSize;
+
+	size_t size() const { return count; }
+	size_t GetBlockCount() const { return (count + blockSize - 1) / blockSize; }
+
+	/// @brief Gets blockSize values of a field, of entities in a block. Values past size() in the last block are
+	/// padding with unspecified values, so kernels can always process whole blocks.
+	/// @param block index of the block
+	/// @param field index of the field
+	/// @return pointer to blockSize values
+	Field *GetBlock(size_t block, int field) const { return data + (block * fieldCount + field) * blockSize; }
+
+	/// @brief Gets values of a field of all entities, only fully split components store them contiguously.
+	/// @param field index of the field
+	/// @return span of size() values
+	std::span<Field> GetField(int field) const
+	{
+		assert(GetBlockCount() <= 1 && "Only fully split components store fields contiguously");
+		return std::span<Field>(data + field * blockSize, count);
+	}
+
+	Field &Get(size_t index, int field) const { return GetBlock(index / blockSize, field)[index % blockSize]; }
+
+	/// @brief Gathers fields of an entity.
+	T Load(size_t index) const
+	{
+		std::array<Field, fieldCount> fields;
+		for (int i = 0; i < fieldCount; i++) fields[i] = Get(index, i);
+		return std::bit_cast<T>(fields);
+	}
+
+	/// @brief Scatters fields of a component to an entity.
+	void Store(size_t index, const T &component) const
+	{
+		auto fields = std::bit_cast<std::array<Field, fieldCount>>(component);
+		for (int i = 0; i < fieldCount; i++) Get(index, i) = fields[i];
+	}
+};
+
+template <ComponentDerived T> struct ColumnViewOf
+{
+	typedef std::span<T> Type;
+};
+template <SplitComponent T> struct ColumnViewOf<T>
+{
+	typedef SplitSpan<T> Type;
+};
+
+/// @brief Type chunk iteration returns for a component's column, std::span<T> or SplitSpan<T> for split components.
+template <ComponentDerived T> using ColumnView = typename ColumnViewOf<T>::Type;
+
+/// @brief Fixed size bitset of component IDs, used as a signature identifying an archetype.
+/// Has no heap allocations, so it can be built and hashed cheaply on every structural change.
+class ComponentMask
+{
+	static constexpr int wordBits = 64;
+	static constexpr int wordCount = (ECS_MAX_COMPONENTS + wordBits - 1) / wordBits;
+
+	uint64_t words[wordCount];
+
+	friend class ColumnIndex;
+
+  public:
+	constexpr ComponentMask() : words{} {}
+
+	/// @brief Builds a mask of the given component types.
+	/// @tparam ...T component types
+	/// @return mask with bits of all T set
+	template <ComponentDerived... T> static ComponentMask Of()
+	{
+		ComponentMask mask;
+		((mask.Set(T::___componentID)), ...);
+		return mask;
+	}
+
+	/// @brief Builds a mask of the given component types that are stored in archetypes, skipping sparse components.
+	/// @tparam ...T component types
+	/// @return mask with bits of all T that are not sparse set
+	template <ComponentDerived... T> static ComponentMask OfStored()
+	{
+		ComponentMask mask;
+		((SparseComponent<T> ? void() : mask.Set(T::___componentID)), ...);
+		return mask;
+	}
+
+	void Set(int id) { words[id / wordBits] |= uint64_t(1) << (id % wordBits); }
+	void Reset(int id) { words[id / wordBits] &= ~(uint64_t(1) << (id % wordBits)); }
+	bool Test(int id) const { return (words[id / wordBits] >> (id % wordBits)) & 1; }
+
+	/// @brief Checks whether all bits set in other are also set in this mask.
+	bool Contains(const ComponentMask &other) const;
+
+	/// @brief Checks whether this mask and other have at least one common bit.
+	bool Intersects(const ComponentMask &other) const;
+
+	bool Empty() const;
+
+	/// @brief Gets the number of set bits.
+	int Count() const;
+
+	/// @brief Calls func with the ID of every set bit, in ascending order.
+	template <typename F> void ForEach(F &&func) const
+	{
+		for (int i = 0; i < wordCount; i++)
+			for (uint64_t word = words[i]; word; word &= word - 1) func(i * wordBits + std::countr_zero(word));
+	}
+
+	size_t Hash() const;
+
+	bool operator==(const ComponentMask &rhs) const = default;
+
+	struct Hasher
+	{
+		size_t operator()(const ComponentMask &mask) const { return mask.Hash(); }
+	};
+};
+
+/// @brief Maps component IDs to positions of an archetype's columns in constant time and space independent of the
+/// number of registered components. Position of a column is the number of stored components with lower IDs, counted
+/// from the bits of a single word and the number of bits set in all words before it.
+class ColumnIndex
+{
+	ComponentMask columns;
+	std::array<uint16_t, ComponentMask::wordCount> wordOffsets;
+
+  public:
+	ColumnIndex() : wordOffsets{} {}
+
+	/// @param columns mask of components stored in columns
+	explicit ColumnIndex(const ComponentMask &columns);
+
+	bool Contains(int componentID) const { return columns.Test(componentID); }
+
+	/// @brief Gets position of a component's column.
+	/// @param componentID ID of a component stored in columns
+	int operator[](int componentID) const
+	{
+		assert(Contains(componentID) && "Component is not stored in columns");
+		int word = componentID / ComponentMask::wordBits;
+		uint64_t lower = columns.words[word] & ((uint64_t(1) << (componentID % ComponentMask::wordBits)) - 1);
+		return wordOffsets[word] + std::popcount(lower);
+	}
+};
+
+/// @brief Generational reference to an entity, trivially copyable and cheap to keep across frames.
+/// Handle becomes stale once it's entity is destroyed, which can be checked with World::IsAlive.
+struct EntityHandle
+{
+	uint32_t index = ~0u;
+	uint32_t generation = 0;
+
+	bool operator==(const EntityHandle &rhs) const = default;
+};
+
+class World;
+struct Archetype;
+
+/// @brief Slot table of all entities of a world, mapping handles to their archetype and position in it.
+/// Slots of destroyed entities are recycled, with their generation incremented to invalidate old handles.
+class EntityRegistry
+{
+  public:
+	struct Slot
+	{
+		uint32_t generation;
+		int archetypeID;
+
+		/// @brief Position in the archetype, -1 if the slot is free.
+		int index;
+	};
+
+  private:
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+
+	/// @brief Incremented whenever an entity is created or destroyed.
+	uint64_t version = 0;
+
+	/// @brief Version of the last change of a generation or of the number of slots, per page of pageSize slots.
+	std::vector<uint64_t> pageVersions;
+
+  public:
+	static constexpr int pageSize = 1024;
+
+	/// @brief Allocates a slot for an entity without components.
+	/// @return handle to the new entity
+	EntityHandle Create();
+
+	/// @brief Frees entity's slot, invalidating all handles to it. Entity has to be removed from it's archetype.
+	/// @param entity handle to a living entity
+	void Destroy(EntityHandle entity);
+
+	/// @brief Checks whether handle references an entity that was not destroyed.
+	/// @param entity handle
+	/// @return true if entity is alive, false if handle is stale or null
+	bool IsAlive(EntityHandle entity) const
+	{
+		const Slot *slot = entity.index < slots.size() ? &slots[entity.index] : nullptr;
+		return slot && slot->generation == entity.generation && slot->index != -1;
+	}
+
+	/// @brief Gets slot of an entity.
+	/// @param entity handle to a living entity
+	/// @return reference to the slot
+	Slot &GetSlot(EntityHandle entity) { return slots[entity.index]; }
+	const Slot &GetSlot(EntityHandle entity) const { return slots[entity.index]; }
+
+	/// @brief Gets all slots, indexed by entity index.
+	std::span<const Slot> GetSlots() const { return slots; }
+
+	/// @brief Gets indices of slots of destroyed entities, reused from the back.
+	std::span<const uint32_t> GetFreeSlots() const { return freeSlots; }
+
+	/// @brief Replaces generations of all slots and the list of free slots. Meant for restoring snapshots, slots keep
+	/// their archetype and position, new slots are in no archetype.
+	/// @param generations generation of every slot
+	/// @param freeSlots indices of free slots
+	void Assign(std::span<const uint32_t> generations, std::span<const uint32_t> freeSlots);
+
+	/// @brief Gets a number that changes whenever an entity is created or destroyed.
+	uint64_t GetVersion() const { return version; }
+
+	/// @brief Gets the version at which a generation in a page of slots last changed, or a slot was added to it.
+	/// @param page index of the page, slot index / pageSize
+	uint64_t GetPageVersion(int page) const { return pageVersions[page]; }
+	int GetPageCount() const { return pageVersions.size(); }
+};
+
+/// @brief Storage of a sparse component, mapping entity slot indices to positions in a dense array of components. Adding,
+/// removing and lookup are O(1), removal moves the last component into the hole.
+class SparseSet
+{
+	int componentID;
+
+	/// @brief Entity slot index -> position in the dense arrays, -1 if the entity doesn't have the component.
+	std::vector<int> positions;
+	std::vector<EntityHandle> entities;
+	PopbackArray components;
+	int capacity;
+
+  public:
+	/// @brief Creates an empty set.
+	/// @param componentID ID of sparse component stored in the set
+	/// @param allocator allocator of the components
+	SparseSet(int componentID, Allocator &allocator);
+	SparseSet(const SparseSet &) = delete;
+	SparseSet &operator=(const SparseSet &) = delete;
+	~SparseSet();
+
+	/// @brief Checks whether an entity has the component.
+	/// @param entity handle to a living entity
+	bool Contains(EntityHandle entity) const
+	{
+		return entity.index < positions.size() && positions[entity.index] != -1;
+	}
+
+	/// @brief Adds an entity without constructing it's component, which the caller has to construct.
+	/// @param entity handle to a living entity without the component
+	/// @return pointer to uninitialized memory of the component
+	void *Add(EntityHandle entity);
+
+	/// @brief Destroys component of an entity and removes the entity from the set.
+	/// @param entity handle to an entity with the component
+	void Remove(EntityHandle entity);
+
+	/// @brief Gets component of an entity.
+	/// @param entity handle to an entity with the component
+	/// @return pointer to the component
+	void *Get(EntityHandle entity);
+	const void *Get(EntityHandle entity) const;
+
+	/// @brief Gets handles of all entities in the set, in the order of their components.
+	std::span<const EntityHandle> GetEntities() const { return entities; }
+
+	int GetComponentID() const { return componentID; }
+};
+
 /// @brief Entity class, representing a collection of components.
+/// Thin owning wrapper around an EntityHandle, destroying the entity when it goes out of scope.
 class Entity
 {
+	World *world;
+	EntityHandle handle;
+
   public:
-	unsigned int archetypeID;
-	unsigned int id;
+	/// @brief Constructor with components, creates the entity in the default world.
+	/// @tparam ...TComponents List of component types that will be added to the entity
+	/// @param ...components List of components that will be added to the entity
+	template <ComponentDerived... TComponents> Entity(TComponents &&...components);
 
 	/// @brief Constructor with components.
 	/// @tparam ...TComponents List of component types that will be added to the entity
+	/// @param world world the entity is created in
 	/// @param ...components List of components that will be added to the entity
-	template <ComponentDerived... TComponents> Entity(TComponents &&...components);
+	template <ComponentDerived... TComponents> Entity(World &world, TComponents &&...components);
 
 	Entity();
 	Entity(Entity &&rhs);
@@ -106,6 +595,13 @@ class Entity
 	Entity(const Entity &) = delete;
 	Entity &operator=(const Entity &rhs) = delete;
 
+	/// @brief Gets handle of the owned entity.
+	/// @return handle, null if entity was never given any components
+	EntityHandle GetHandle() const { return handle; }
+
+	/// @brief Gets world the entity lives in.
+	World &GetWorld() const { return *world; }
+
 	/// @brief Adds a component to the entity.
 	/// @tparam T type of new component
 	/// @param component new component
@@ -118,24 +614,17 @@ class Entity
 	/// @brief Checks if entity has a component.
 	/// @tparam T type of checked component
 	/// @return true if component is present, false otherwise
-	template <ComponentDerived T> bool HasComponent() const { return HasComponent(T::___componentID); }
+	template <ComponentDerived T> bool HasComponent() const;
 
 	/// @brief Gets a reference to a component from entity.
 	/// @tparam T type of component
 	/// @return reference to the component
-	template <ComponentDerived T> T &GetComponent() { return *(T *)GetComponent(T::___componentID); }
+	template <ComponentDerived T> T &GetComponent();
 
 	/// @brief Gets a reference to a component from entity.
 	/// @tparam T type of component
 	/// @return reference to the component
-	template <ComponentDerived T> const T &GetComponent() const { return *(T *)GetComponent(T::___componentID); }
-
-  private:
-	bool HasComponent(int componentID) const;
-	void *GetComponent(int componentID);
-	const void *GetComponent(int componentID) const;
-
-	friend class Archetype;
+	template <ComponentDerived T> const T &GetComponent() const;
 };
 
 template <ComponentDerived... T> struct Exclude
@@ -144,73 +633,260 @@ template <ComponentDerived... T> struct Exclude
 template <typename T>
 concept Excludion = requires { []<ComponentDerived... U>(Exclude<U...>) {}(std::declval<T>()); };
 
+/// @brief Checks whether an Exclude<...> lists a sparse component, which can't be excluded by archetype masks.
+template <Excludion E> constexpr bool excludesSparse = false;
+template <ComponentDerived... U> constexpr bool excludesSparse<Exclude<U...>> = (SparseComponent<U> || ...);
+
+/// @brief Query filter passing chunks whose column of T was written since the query's previous run, either through
+/// GetComponents/GetComponentsArrays, World::GetComponent, a Write<T> system of a Scheduler, or by entities moved into
+/// the chunk. Read<T> systems and const World::GetComponent/Entity::GetComponent don't count as writes. Filters work
+/// on whole chunks, so some entities of a passing chunk may be unchanged.
+template <ComponentDerived T> struct Changed
+{
+};
+
+/// @brief Query filter passing chunks that got entities with a new T since the query's previous run.
+template <ComponentDerived T> struct Added
+{
+};
+
+template <typename T> constexpr bool isChangeFilter = false;
+template <ComponentDerived T> constexpr bool isChangeFilter<Changed<T>> = true;
+template <ComponentDerived T> constexpr bool isChangeFilter<Added<T>> = true;
+
+/// @brief Change filters of a query run, tested on ticks stored with every chunk without touching components.
+struct ChangeFilter
+{
+	/// @brief IDs of components that have to be changed or added.
+	std::vector<int> changed;
+	std::vector<int> added;
+
+	/// @brief Tick of the previous run, columns pass if they were stamped after it.
+	uint64_t since = 0;
+
+	/// @brief Tick of the current run, stamped on columns written through it so the query doesn't see it's own writes.
+	uint64_t tick = 0;
+
+	template <ComponentDerived T> void Add(Changed<T> *)
+	{
+		static_assert(!TagComponent<T> && !SparseComponent<T>, "Only components stored in columns track changes");
+		changed.push_back(T::___componentID);
+	}
+	template <ComponentDerived T> void Add(Added<T> *)
+	{
+		static_assert(!TagComponent<T> && !SparseComponent<T>, "Only components stored in columns track changes");
+		added.push_back(T::___componentID);
+	}
+
+	/// @brief Checks whether a chunk passes all filters.
+	/// @param archetype archetype storing all filtered components
+	/// @param chunk index of the chunk
+	bool Matches(const Archetype &archetype, int chunk) const;
+};
+
+/// @brief Iterates over chunks of all archetypes storing T and none of the excluded components.
+/// Either checks every archetype of the world, or walks a list of matching archetypes cached by a Query.
+/// Sparse components are ignored when matching archetypes, they are tested per entity by EntityIterator.
 template <Excludion E, ComponentDerived... T> struct EntityRangeIterator
 {
+	static_assert(sizeof...(T) == 0 || (!SparseComponent<T> || ...),
+				  "Queries need at least one component stored in archetypes, use SparseSet::GetEntities instead");
+
+	/// @brief Whether entities have to be tested for membership in sparse sets.
+	static constexpr bool testsSparse = (SparseComponent<T> || ...) || excludesSparse<E>;
+
+	World *world;
+
+	/// @brief IDs of archetypes matching the query, nullptr to check every archetype of the world.
+	const std::vector<int> *archetypeIDs;
+
+	/// @brief Change filters chunks have to pass, nullptr if the query has none.
+	const ChangeFilter *filter;
+
+	/// @brief Position in archetypeIDs, or ID of the current archetype if there is no list.
 	size_t archetypeID;
-	EntityRangeIterator(size_t archetypeID);
+	size_t chunkID;
+	EntityRangeIterator(World *world, const std::vector<int> *archetypeIDs, size_t archetypeID,
+						const ChangeFilter *filter = nullptr);
 
-	std::tuple<std::span<Entity *>, std::span<T>...> operator*() const;
+	/// @brief Gets the entities and columns of the current chunk, stamping all of T as written.
+	std::tuple<std::span<EntityHandle>, ColumnView<T>...> operator*() const;
+
+	/// @brief Gets the entities and columns of the current chunk without stamping them, for callers that know which
+	/// components they write and stamp only those with MarkChanged.
+	std::tuple<std::span<EntityHandle>, ColumnView<T>...> GetColumns() const;
 
 	EntityRangeIterator &operator++();
 	bool operator!=(const EntityRangeIterator &rhs) const;
 
+	/// @brief Checks whether the iterator went past the last matching chunk.
+	bool IsEnd() const;
+
+	/// @brief Gets the archetype of the current chunk.
+	Archetype &GetArchetype() const;
+
+	/// @brief Stamps columns of U in the current chunk as written.
+	template <ComponentDerived... U> void MarkChanged() const;
+
+	/// @brief Checks whether an entity is in sets of all sparse components and of none of the excluded ones.
+	/// @param entity handle to a living entity
+	bool MatchesSparse(EntityHandle entity) const;
+
   private:
 	bool IsCurrentArchetypeOk() const;
+
+	/// @brief Moves to the first chunk at or after the current one that holds matching entities.
+	void SkipUnmatched();
 };
 
 template <Excludion E, ComponentDerived... T> struct EntityRangeView
 {
+	World *world;
+	const std::vector<int> *archetypeIDs = nullptr;
+	const ChangeFilter *filter = nullptr;
+
 	EntityRangeIterator<E, T...> begin();
 	EntityRangeIterator<E, T...> end();
+
+	/// @brief Calls func(entity, components...) for every entity, the inner loop runs over plain pointers of a chunk
+	/// so it can be vectorized. No structural changes are allowed in func.
+	/// @param func function taking EntityHandle and T&...
+	template <typename F> void ForEach(F &&func);
 };
 
+/// @brief Iterates over entities, keeping pointers to the columns of the current chunk, so advancing and
+/// dereferencing only touch plain pointers until the chunk ends. Entities failing sparse membership tests are skipped.
 template <Excludion E, ComponentDerived... T> struct EntityIterator
 {
+	static_assert(!(SplitComponent<T> || ...), "Split components can only be iterated by chunks");
+
 	EntityRangeIterator<E, T...> entityRange;
+	EntityHandle *entities;
+	std::tuple<T *...> components;
 	size_t entityID;
-	EntityIterator(EntityRangeIterator<E, T...> entityRange, size_t entityID);
+	size_t entityCount;
+	EntityIterator(EntityRangeIterator<E, T...> entityRange);
+
+	std::tuple<EntityHandle, T &...> operator*() const { return {entities[entityID], GetComponent<T>()...}; }
 
-	std::tuple<Entity &, T &...> operator*() const;
+	EntityIterator &operator++()
+	{
+		if (++entityID >= entityCount)
+		{
+			++entityRange;
+			LoadChunk();
+		}
+		if constexpr (EntityRangeIterator<E, T...>::testsSparse) SkipUnmatched();
+		return *this;
+	}
+
+	bool operator!=(const EntityIterator &rhs) const
+	{
+		return entityID != rhs.entityID || entityRange != rhs.entityRange;
+	}
+
+  private:
+	void LoadChunk();
+	void SkipUnmatched();
 
-	EntityIterator &operator++();
-	bool operator!=(const EntityIterator &rhs) const;
+	template <ComponentDerived U> U &GetComponent() const;
+	template <ComponentDerived U> static U *GetColumn(Archetype &archetype, size_t chunk);
 };
 
 template <Excludion E, ComponentDerived... T> struct EntityView
 {
+	World *world;
+	const std::vector<int> *archetypeIDs = nullptr;
+	const ChangeFilter *filter = nullptr;
+
 	EntityIterator<E, T...> begin();
 	EntityIterator<E, T...> end();
+
+	/// @brief Calls func(entity, components...) for every entity, see EntityRangeView::ForEach.
+	/// @param func function taking EntityHandle and T&...
+	template <typename F> void ForEach(F &&func)
+	{
+		EntityRangeView<E, T...>{world, archetypeIDs, filter}.ForEach(func);
+	}
 };
 
-template <ComponentDerived... T> static EntityRangeView<Exclude<>, T...> GetComponentsArrays()
-{
-	return EntityRangeView<Exclude<>, T...>();
-}
-template <Excludion E, ComponentDerived... T> static EntityRangeView<E, T...> GetComponentsArrays()
-{
-	return EntityRangeView<E, T...>();
-}
-template <Excludion E, ComponentDerived... T> static EntityView<E, T...> GetComponents()
+/// @brief Pool recycling memory blocks of freed chunks, so chunked archetypes don't go through the heap on every
+/// growth.
+class ChunkPool
 {
-	return EntityView<E, T...>();
-}
-template <ComponentDerived... T> static EntityView<Exclude<>, T...> GetComponents()
+	Allocator *allocator;
+	std::map<std::pair<size_t, int>, std::vector<void *>> freeBlocks;
+
+  public:
+	/// @param allocator allocator of the blocks
+	ChunkPool(Allocator &allocator) : allocator(&allocator) {}
+	ChunkPool(const ChunkPool &) = delete;
+	ChunkPool &operator=(const ChunkPool &) = delete;
+	~ChunkPool();
+
+	/// @brief Gets a block of byteSize bytes, reusing a released one if possible.
+	/// @param byteSize size of the block
+	/// @param alignment alignment of the block
+	/// @return block allocated by the pool's allocator
+	void *Acquire(size_t byteSize, int alignment);
+
+	/// @brief Returns a block to the pool.
+	/// @param block block returned by Acquire
+	/// @param byteSize size the block was acquired with
+	/// @param alignment alignment the block was acquired with
+	void Release(void *block, size_t byteSize, int alignment);
+
+	/// @brief Frees all pooled blocks.
+	void Clear();
+
+	/// @brief Gets the number of bytes held by pooled blocks.
+	size_t GetByteSize() const;
+};
+
+/// @brief Part of archetype's storage, holding components of a range of entities.
+/// Columns are in the order of archetype's denseComponentMap, and are found by component ID with it's columnIndex.
+struct Chunk
 {
-	return EntityView<Exclude<>, T...>();
-}
+	std::vector<PopbackArray> columns;
+	PopbackArray entityReferences;
+
+	/// @brief World's change tick of the last write to every column and of the last entity added with it's component.
+	std::vector<uint64_t> changedTicks;
+	std::vector<uint64_t> addedTicks;
+};
 
 /// @brief Class holding entities with same component types.
+/// Entities are stored either in one chunk which grows as needed, or in a list of fixed size chunks, each holding
+/// chunkCapacity entities. Entity at index i lives in chunk i / chunkCapacity, so only the last chunk is partially
+/// filled.
 struct Archetype
 {
-	PopbackArray *sparseComponentArray;
-	PopbackArray entityReferences;
-	std::set<int> denseComponentMap;
+	World *world;
+	int archetypeID;
+	std::vector<Chunk> chunks;
+	ComponentMask mask;
+
+	/// @brief IDs of components stored in columns, tags are only in the mask.
+	std::vector<int> denseComponentMap;
 	int entityCount;
 	int entityCapacity;
 
+	/// @brief Number of entities in each chunk, 0 if archetype stores all entities in a single growing chunk.
+	int chunkCapacity;
+
+	/// @brief Component ID -> position of it's column in chunks.
+	ColumnIndex columnIndex;
+
+	/// @brief Cached transitions, component ID -> ID of the archetype with that component added or removed.
+	std::unordered_map<int, int> addEdges;
+	std::unordered_map<int, int> removeEdges;
+
 	/// @brief Creates a new Archetype with a cpecified mask.
 	/// @param componentMask mask of components present in all entities.
-	Archetype(const std::set<int> &componentIDs);
+	/// @param world world owning the archetype
+	/// @param archetypeID index of the archetype in world's archetype pool
+	/// @param chunkByteSize approximate byte size of a chunk, 0 to store entities in a single growing chunk
+	Archetype(const ComponentMask &componentMask, World *world, int archetypeID, int chunkByteSize = 0);
 
 	Archetype();
 	Archetype(Archetype &&rhs);
@@ -221,9 +897,9 @@ struct Archetype
 
 	/// @brief Adds entity to the archetype's list, and sets it's data.
 	/// @tparam ...TComponents Types of components that entity has
-	/// @param entity entity pointer
+	/// @param entity handle of the entity
 	/// @param ...components components present on entity
-	template <ComponentDerived... TComponents> void Push(Entity *entity, TComponents &&...components);
+	template <ComponentDerived... TComponents> void Push(EntityHandle entity, TComponents &&...components);
 
 	/// @brief Moves entity to a new archetype, all components not present in new archetype are destroyed.
 	/// @param index position of entity to be moved
@@ -234,250 +910,1145 @@ struct Archetype
 	/// @param index position of entity to be removed
 	void RemoveEntity(int index);
 
+	/// @brief Moves or removes many entities at once, one column at a time. Every destination is reserved once, and
+	/// moved entities are appended to it in the order of indices. Removed entities get archetypeID -1 in their slot.
+	/// @param indices positions of the entities, sorted in descending order
+	/// @param destinations archetype every entity is moved to, nullptr to remove the entity
+	void MoveEntities(std::span<const int> indices, std::span<Archetype *const> destinations);
+
+	/// @brief Removes many entities at once, destroying their components one column at a time and filling the holes
+	/// with entities from the end. Removed entities get archetypeID -1 in their slot.
+	/// @param indices positions of the entities, sorted in descending order
+	void RemoveEntities(std::span<const int> indices);
+
+	/// @brief Moves or removes all entities at once. If destination is empty and has the same chunk capacity, columns
+	/// are handed over without copying, otherwise destination is reserved once and columns are copied in runs.
+	/// Components of the destination that this archetype doesn't store are not constructed, which the caller has to do
+	/// before the archetype is used again.
+	/// @param destination archetype the entities are moved to, nullptr to remove the entities
+	/// @return position of the first moved entity in destination
+	int MoveAllEntities(Archetype *destination);
+
+	/// @brief Appends entities without constructing their components, which the caller has to construct before the
+	/// archetype is used again.
+	/// @param entities handles of the entities
+	/// @return position of the first appended entity
+	int AllocateEntities(std::span<const EntityHandle> entities);
+
 	/// @brief Reserves space for the entities and their components.
+	/// With fixed size chunks, only allocates the missing chunks and never moves existing components.
 	/// @param newCapacity new capacity
 	void Reserve(int newCapacity);
 
+	/// @brief Makes space for at least count entities, growing geometrically.
+	/// @param count number of entities the archetype has to fit
+	void EnsureCapacity(int count);
+
+	/// @brief Shrinks storage to the entities it holds. A single growing chunk is reallocated to exactly entityCount
+	/// entities, fixed size chunks past the last used one are released to the world's ChunkPool. Storage of an empty
+	/// archetype is freed entirely.
+	void ShrinkToFit();
+
+	/// @brief Gets the number of bytes allocated for columns and entity handles.
+	size_t GetByteSize() const;
+
+	/// @brief Gets the number of chunks holding at least one entity.
+	int GetChunkCount() const
+	{
+		if (chunkCapacity == 0) return entityCount != 0;
+		return (entityCount + chunkCapacity - 1) / chunkCapacity;
+	}
+
+	/// @brief Gets the number of entities stored in a chunk.
+	/// @param chunk index of the chunk
+	int GetChunkSize(int chunk) const
+	{
+		if (chunkCapacity == 0) return entityCount;
+		return std::min(entityCount - chunk * chunkCapacity, chunkCapacity);
+	}
+
 	/// @brief Gets a span to specified components.
+	/// @tparam T component type, not split
+	/// @param chunk index of the chunk
+	/// @return span of components of type T, of all entities in the chunk.
+	template <ComponentDerived T> std::span<T> GetComponents(int chunk);
+
+	/// @brief Gets a view of a column in a chunk.
 	/// @tparam T component type
-	/// @return span of components of type T, of all entities in archetype.
-	template <ComponentDerived T> std::span<T> GetComponents();
+	/// @param chunk index of the chunk
+	/// @return std::span<T>, or SplitSpan<T> for split components
+	template <ComponentDerived T> ColumnView<T> GetColumn(int chunk);
 
 	/// @brief Checks whether Archetype stores a component.
 	/// @tparam T component type
 	/// @return True if stores the component false otherwise.
 	template <ComponentDerived T> bool StoresComponent();
 
-	/// @brief Gets a span of entity pointers connected with the archetype
-	/// @return span of entity pointers.
-	std::span<Entity *> GetEntities();
+	/// @brief Gets a span of handles of entities stored in the archetype
+	/// @param chunk index of the chunk
+	/// @return span of handles of all entities in the chunk.
+	std::span<EntityHandle> GetEntities(int chunk)
+	{
+		EntityHandle *begin = (EntityHandle *)chunks[chunk].entityReferences.data();
+		return std::span<EntityHandle>(begin, begin + GetChunkSize(chunk));
+	}
+
+	/// @brief Gets a component of an entity.
+	/// @param componentID ID of component, not split
+	/// @param index position of the entity
+	/// @return pointer to the component
+	void *GetComponent(int componentID, int index);
+	const void *GetComponent(int componentID, int index) const;
+
+	/// @brief Gets a field of a split component of an entity.
+	/// @param componentID ID of split component
+	/// @param index position of the entity
+	/// @param field index of the field
+	/// @return pointer to the field
+	void *GetField(int componentID, int index, int field);
+
+	/// @brief Gets the number of entities in a block of a split component's column.
+	/// @param componentID ID of split component
+	int GetSplitBlockSize(int componentID) const;
+
+	/// @brief Move constructs a component of an entity from a component of an entity of another archetype.
+	/// @param componentID ID of component
+	/// @param index position of the entity, it's component must not be constructed
+	/// @param source archetype of the moved component, can be this archetype
+	/// @param sourceIndex position of the moved component in source
+	void MoveComponent(int componentID, int index, Archetype &source, int sourceIndex);
+
+	/// @brief Move constructs a component of an entity, scattering it's fields if component is split.
+	/// @param componentID ID of component
+	/// @param index position of the entity, it's component must not be constructed
+	/// @param component component to be moved from
+	void ConstructComponent(int componentID, int index, void *component);
+
+	/// @brief Destroys a component of an entity.
+	/// @param componentID ID of component
+	/// @param index position of the entity
+	void DestroyComponent(int componentID, int index);
+
+	/// @brief Gets a reference to the handle of entity at a position.
+	/// @param index position of the entity
+	/// @return reference to the entity handle
+	EntityHandle &GetEntity(int index);
+	const EntityHandle &GetEntity(int index) const;
+
+	/// @brief Stamps a column of a chunk as written.
+	/// @param componentID ID of component, tags and components the archetype doesn't store are ignored
+	/// @param chunk index of the chunk
+	/// @param tick change tick of the write
+	void MarkChanged(int componentID, int chunk, uint64_t tick)
+	{
+		if (columnIndex.Contains(componentID)) chunks[chunk].changedTicks[columnIndex[componentID]] = tick;
+	}
+	template <ComponentDerived T> void MarkChanged(int chunk, uint64_t tick)
+	{
+		if constexpr (!TagComponent<T> && !SparseComponent<T>) MarkChanged(T::___componentID, chunk, tick);
+	}
+
+	/// @brief Stamps all columns of chunks holding a range of entities as written with the world's current tick, done
+	/// whenever entities are moved into the range.
+	/// @param first position of the first entity
+	/// @param count number of entities
+	void MarkEntitiesChanged(int first, int count);
+
+	/// @brief Stamps chunks holding a range of newly added entities as written, and columns of components that the
+	/// entities didn't have before as added.
+	/// @param first position of the first entity
+	/// @param count number of entities
+	/// @param previousMask components the entities had before, empty for new entities
+	void MarkEntitiesAdded(int first, int count, const ComponentMask &previousMask);
+
+  private:
+	void AddGrowingChunk();
+	void AddChunk();
+	void ReleaseChunk();
+	PopbackArray AllocateColumn(int componentID, int capacity);
+	void ReleaseColumn(int componentID, PopbackArray &column, int capacity);
+	static int GetSplitBlockSize(int componentID, int capacity);
+	static int GetColumnCapacity(int componentID, int capacity);
 };
 
 /// @brief Class holding an array of archetypes with unique component masks.
 class ArchetypePool
 {
-	static std::vector<Archetype> archetypes;
+	World *world;
+	std::vector<Archetype> archetypes;
+	std::unordered_map<ComponentMask, int, ComponentMask::Hasher> archetypeIndex;
+	int chunkByteSize;
+
+	/// @brief Number of calls to RemoveEmptyArchetypes that removed anything, lets queries detect renumbering.
+	size_t removalCount;
 
   public:
-	/// @brief Adds a new archetype, it's component mask has to be unique.
-	/// @param archetype archetype to be added
+	ArchetypePool(World *world);
+	ArchetypePool(const ArchetypePool &) = delete;
+	ArchetypePool &operator=(const ArchetypePool &) = delete;
+
+	/// @brief Adds a new archetype, using the current chunk byte size, it's component mask has to be unique.
+	/// @param componentMask mask of the archetype
 	/// @return pointer to the new archetype
-	static Archetype *AddArchetype(Archetype &&archetype);
+	Archetype *AddArchetype(const ComponentMask &componentMask);
+
+	/// @brief Sets the approximate byte size of chunks of archetypes created from now on.
+	/// @param byteSize byte size of a chunk, 0 to store each archetype in a single growing chunk
+	void SetChunkByteSize(int byteSize) { chunkByteSize = byteSize; }
+	int GetChunkByteSize() const { return chunkByteSize; }
 
-	static std::span<Archetype> GetArchetypes() { return archetypes; }
+	std::span<Archetype> GetArchetypes() { return archetypes; }
+	std::span<const Archetype> GetArchetypes() const { return archetypes; }
+
+	/// @brief Removes all archetypes without entities, so iteration doesn't visit them. Remaining archetypes are
+	/// renumbered, entity slots and cached transitions are updated to the new IDs. Must not be called while the world is
+	/// iterated.
+	/// @return number of removed archetypes
+	int RemoveEmptyArchetypes();
+
+	/// @brief Gets the number of times archetypes were removed and renumbered, IDs of archetypes stay valid while it
+	/// doesn't change.
+	size_t GetRemovalCount() const { return removalCount; }
 
 	/// @brief Gets archetype by it's mask.
 	/// @T param components
 	/// @return archetype
-	template <ComponentDerived... T> static Archetype *GetArchetype();
+	template <ComponentDerived... T> Archetype *GetArchetype();
 
 	/// @brief Get archetype by it's mask.
-	/// @param componentsID mask
-	/// @return archetype containing all components specified in mask
-	static Archetype *GetArchetype(const std::set<int> &componentsID);
-
-	friend Archetype;
-	template <Excludion E, ComponentDerived... T> friend struct EntityRangeIterator;
-	template <Excludion E, ComponentDerived... T> friend struct EntityRangeView;
-	template <Excludion E, ComponentDerived... T> friend struct EntityView;
+	/// @param componentMask mask
+	/// @return archetype containing all components specified in mask, nullptr if there is none
+	Archetype *GetArchetype(const ComponentMask &componentMask);
+
+	/// @brief Gets archetype with a component added to the mask of another archetype, creating it if needed.
+	/// The transition is cached in archetype's edges, so repeated calls are a single lookup.
+	/// @param archetypeID ID of the source archetype
+	/// @param componentID ID of the added component
+	/// @return archetype with mask of source archetype and componentID
+	Archetype *GetArchetypeWith(int archetypeID, int componentID);
+
+	/// @brief Gets archetype with a component removed from the mask of another archetype, creating it if needed.
+	/// The transition is cached in archetype's edges, so repeated calls are a single lookup.
+	/// @param archetypeID ID of the source archetype
+	/// @param componentID ID of the removed component, mask without it must not be empty
+	/// @return archetype with mask of source archetype without componentID
+	Archetype *GetArchetypeWithout(int archetypeID, int componentID);
 };
 
-} // namespace ECS
+/// @brief Options of World::Trim.
+struct TrimPolicy
+{
+	/// @brief Archetypes holding fewer entities than this fraction of their capacity are shrunk to fit, 1 shrinks all.
+	float minOccupancy = 0.5f;
+
+	/// @brief Whether archetypes without entities are removed, see ArchetypePool::RemoveEmptyArchetypes.
+	bool removeEmptyArchetypes = true;
+
+	/// @brief Whether blocks pooled by the world's ChunkPool are freed.
+	bool releasePooledChunks = true;
+};
+
+/// @brief Independent collection of archetypes and entities.
+/// Worlds share no mutable state, so different worlds can be used concurrently from different threads, a single world
+/// is not thread safe. Component registration is the only global state, it happens during static initialization.
+class World
+{
+	Allocator *allocator;
+	ChunkPool chunkPool;
+	EntityRegistry registry;
+	ArchetypePool archetypePool;
+	ThreadPool *threadPool;
+
+	/// @brief Sets of sparse components indexed by component ID, created when first used.
+	std::vector<std::unique_ptr<SparseSet>> sparseSets;
+
+	/// @brief Tick stamped on written columns, advanced by every run of a query with change filters.
+	uint64_t changeTick;
+
+  public:
+	/// @brief Creates an empty world.
+	/// @param allocator allocator of all component storage, has to outlive the world
+	World(Allocator &allocator = Allocator::GetDefault());
+	World(const World &) = delete;
+	World &operator=(const World &) = delete;
+
+	/// @brief Gets the world used by Entity constructors and query functions that don't take a world.
+	static World &GetDefault();
+
+	Allocator &GetAllocator() { return *allocator; }
+	ChunkPool &GetChunkPool() { return chunkPool; }
+	EntityRegistry &GetRegistry() { return registry; }
+	ArchetypePool &GetArchetypePool() { return archetypePool; }
+
+	/// @brief Gets the set storing a sparse component, creating it if needed.
+	/// @param componentID ID of sparse component
+	SparseSet &GetSparseSet(int componentID);
+	template <SparseComponent T> SparseSet &GetSparseSet() { return GetSparseSet(T::___componentID); }
+
+	/// @brief Gets the set storing a sparse component without creating it.
+	/// @param componentID ID of sparse component
+	/// @return the set, nullptr if no entity had the component yet
+	SparseSet *FindSparseSet(int componentID)
+	{
+		return size_t(componentID) < sparseSets.size() ? sparseSets[componentID].get() : nullptr;
+	}
+
+	/// @brief Removes an entity from all sparse sets, done by every way of destroying an entity.
+	/// @param entity handle to a living entity
+	void RemoveSparseComponents(EntityHandle entity);
+
+	/// @brief Gets the tick stamped on columns written from now on.
+	uint64_t GetChangeTick() const { return changeTick; }
+
+	/// @brief Starts a new change tick.
+	/// @return the tick that ended
+	uint64_t AdvanceChangeTick() { return changeTick++; }
+
+	/// @brief Gets thread pool used by parallel queries, ThreadPool::GetDefault() unless set otherwise.
+	ThreadPool &GetThreadPool() { return threadPool ? *threadPool : ThreadPool::GetDefault(); }
+	void SetThreadPool(ThreadPool *pool) { threadPool = pool; }
+
+	/// @brief Creates an entity without components.
+	/// @return handle to the new entity
+	EntityHandle Create();
+
+	/// @brief Creates an entity with components.
+	/// @tparam ...TComponents List of component types that will be added to the entity
+	/// @param ...components List of components that will be added to the entity
+	/// @return handle to the new entity
+	template <ComponentDerived... TComponents> EntityHandle Create(TComponents &&...components);
+
+	/// @brief Destroys an entity and all it's components, invalidating all handles to it.
+	/// @param entity handle to a living entity
+	void Destroy(EntityHandle entity);
+
+	/// @brief Creates many entities with the same components. Their archetype is reserved once, and components are
+	/// constructed chunk by chunk straight into the columns.
+	/// @tparam ...TComponents List of component types of the entities
+	/// @param count number of created entities
+	/// @param generator function called with the index of every entity in the batch, returning
+	/// std::tuple<TComponents...>, or the component itself if there is only one
+	/// @return handles to the new entities
+	template <ComponentDerived... TComponents, typename F>
+	std::vector<EntityHandle> SpawnBatch(int count, F &&generator);
+
+	/// @brief Destroys many entities at once, every archetype is compacted in a single pass.
+	/// @param entities handles to distinct living entities
+	void DestroyBatch(std::span<const EntityHandle> entities);
+
+	/// @brief Checks whether handle references an entity that was not destroyed.
+	/// @param entity handle
+	/// @return true if entity is alive, false if handle is stale or null
+	bool IsAlive(EntityHandle entity) const { return registry.IsAlive(entity); }
+
+	/// @brief Gives memory left over by removed entities back to the world's allocator, meant to be called during quiet
+	/// ticks. Handles stay valid, but no iteration may be in progress. Queries pick up renumbered archetypes on their
+	/// own. Whether the memory reaches the OS depends on the allocator: the heap and pool may keep it cached, an arena
+	/// only reclaims anything when it is reset.
+	/// @param policy which archetypes are shrunk and what else is released
+	/// @return number of bytes of component storage and pooled chunks released to the world's allocator, not to the OS
+	size_t Trim(const TrimPolicy &policy = TrimPolicy());
+
+	/// @brief Shrinks every archetype to fit, removes empty ones and frees pooled chunks.
+	/// @return number of bytes released to the world's allocator, see Trim
+	size_t Compact() { return Trim(TrimPolicy{1.0f, true, true}); }
+
+	/// @brief Adds a copy of a component to every entity storing Q and none of the excluded components. Entities
+	/// that already store T are skipped. Whole archetypes are moved at once, see Archetype::MoveAllEntities.
+	/// @tparam E excluded components
+	/// @tparam ...Q components of the matched entities
+	/// @tparam T type of new component
+	/// @param component component copied to every entity
+	template <Excludion E, ComponentDerived... Q, ComponentDerived T> void AddComponentToAll(const T &component);
+	template <ComponentDerived... Q, ComponentDerived T> void AddComponentToAll(const T &component)
+	{
+		AddComponentToAll<Exclude<>, Q...>(component);
+	}
+
+	/// @brief Removes a component from every entity storing it, Q and none of the excluded components, entities stay
+	/// alive even without components. Whole archetypes are moved at once, see Archetype::MoveAllEntities.
+	/// @tparam T Type of removed component
+	/// @tparam E excluded components
+	/// @tparam ...Q components of the matched entities
+	template <ComponentDerived T, Excludion E, ComponentDerived... Q> void RemoveComponentFromAll();
+	template <ComponentDerived T, ComponentDerived... Q> void RemoveComponentFromAll()
+	{
+		RemoveComponentFromAll<T, Exclude<>, Q...>();
+	}
+
+	/// @brief Adds a component to an entity.
+	/// @tparam T type of new component
+	/// @param entity handle to a living entity
+	/// @param component new component
+	template <ComponentDerived T> void AddComponent(EntityHandle entity, T &&component);
+
+	/// @brief Removes a component from an entity, entity stays alive even without components.
+	/// @tparam T Type of removed component
+	/// @param entity handle to a living entity
+	template <ComponentDerived T> void RemoveComponent(EntityHandle entity);
+
+	/// @brief Checks if entity has a component.
+	/// @tparam T type of checked component
+	/// @param entity handle to a living entity
+	/// @return true if component is present, false otherwise
+	template <ComponentDerived T> bool HasComponent(EntityHandle entity) const
+	{
+		return HasComponent(entity, T::___componentID);
+	}
+
+	/// @brief Gets a reference to a component of an entity, marking it's column as changed.
+	/// @tparam T type of component
+	/// @param entity handle to a living entity
+	/// @return reference to the component
+	template <ComponentDerived T> T &GetComponent(EntityHandle entity)
+	{
+		static_assert(!SplitComponent<T>, "Split components can't be referenced, they are accessed with SplitSpan");
+		return *(T *)GetComponent(entity, T::___componentID);
+	}
+
+	/// @brief Gets a read only reference to a component of an entity, without marking it as changed.
+	/// @tparam T type of component
+	/// @param entity handle to a living entity
+	/// @return reference to the component
+	template <ComponentDerived T> const T &GetComponent(EntityHandle entity) const
+	{
+		static_assert(!SplitComponent<T>, "Split components can't be referenced, they are accessed with SplitSpan");
+		return *(const T *)GetComponent(entity, T::___componentID);
+	}
+
+	template <ComponentDerived... T> EntityRangeView<Exclude<>, T...> GetComponentsArrays()
+	{
+		return EntityRangeView<Exclude<>, T...>{this};
+	}
+	template <Excludion E, ComponentDerived... T> EntityRangeView<E, T...> GetComponentsArrays()
+	{
+		return EntityRangeView<E, T...>{this};
+	}
+	template <Excludion E, ComponentDerived... T> EntityView<E, T...> GetComponents()
+	{
+		return EntityView<E, T...>{this};
+	}
+	template <ComponentDerived... T> EntityView<Exclude<>, T...> GetComponents()
+	{
+		return EntityView<Exclude<>, T...>{this};
+	}
+
+	/// @brief Calls func(entity, components...) for every entity storing T and none of the excluded components, over
+	/// plain pointers of every chunk so the loop can be vectorized. No structural changes are allowed in func.
+	/// @tparam E excluded components
+	/// @tparam ...T component types
+	/// @param func function taking EntityHandle and T&...
+	template <Excludion E, ComponentDerived... T, typename F> void ForEach(F &&func)
+	{
+		GetComponentsArrays<E, T...>().ForEach(func);
+	}
+	template <ComponentDerived... T, typename F> void ForEach(F &&func) { GetComponentsArrays<T...>().ForEach(func); }
+
+	/// @brief Calls func(entity, components...) for every entity storing T and none of the excluded components, in
+	/// parallel on the world's thread pool. Chunks are split into batches of a multiple of cacheLineSize entities, so
+	/// batches of different threads don't share cache lines of a column. No structural changes are allowed in func.
+	/// @tparam E excluded components
+	/// @tparam ...T component types
+	/// @param func function taking EntityHandle and T&...
+	template <Excludion E, ComponentDerived... T, typename F> void ParallelForEach(F &&func);
+	template <ComponentDerived... T, typename F> void ParallelForEach(F &&func)
+	{
+		ParallelForEach<Exclude<>, T...>(std::forward<F>(func));
+	}
+
+  private:
+	bool HasComponent(EntityHandle entity, int componentID) const;
+	void *GetComponent(EntityHandle entity, int componentID);
+	const void *GetComponent(EntityHandle entity, int componentID) const;
+};
+
+template <ComponentDerived... T> static EntityRangeView<Exclude<>, T...> GetComponentsArrays()
+{
+	return World::GetDefault().GetComponentsArrays<T...>();
+}
+template <Excludion E, ComponentDerived... T> static EntityRangeView<E, T...> GetComponentsArrays()
+{
+	return World::GetDefault().GetComponentsArrays<E, T...>();
+}
+template <Excludion E, ComponentDerived... T> static EntityView<E, T...> GetComponents()
+{
+	return World::GetDefault().GetComponents<E, T...>();
+}
+template <ComponentDerived... T> static EntityView<Exclude<>, T...> GetComponents()
+{
+	return World::GetDefault().GetComponents<T...>();
+}
+template <Excludion E, ComponentDerived... T, typename F> static void ForEach(F &&func)
+{
+	World::GetDefault().ForEach<E, T...>(std::forward<F>(func));
+}
+template <ComponentDerived... T, typename F> static void ForEach(F &&func)
+{
+	World::GetDefault().ForEach<T...>(std::forward<F>(func));
+}
+template <Excludion E, ComponentDerived... T, typename F> static void ParallelForEach(F &&func)
+{
+	World::GetDefault().ParallelForEach<E, T...>(std::forward<F>(func));
+}
+template <ComponentDerived... T, typename F> static void ParallelForEach(F &&func)
+{
+	World::GetDefault().ParallelForEach<T...>(std::forward<F>(func));
+}
+template <Excludion E, ComponentDerived... Q, ComponentDerived T> static void AddComponentToAll(const T &component)
+{
+	World::GetDefault().AddComponentToAll<E, Q...>(component);
+}
+template <ComponentDerived... Q, ComponentDerived T> static void AddComponentToAll(const T &component)
+{
+	World::GetDefault().AddComponentToAll<Q...>(component);
+}
+template <ComponentDerived T, Excludion E, ComponentDerived... Q> static void RemoveComponentFromAll()
+{
+	World::GetDefault().RemoveComponentFromAll<T, E, Q...>();
+}
+template <ComponentDerived T, ComponentDerived... Q> static void RemoveComponentFromAll()
+{
+	World::GetDefault().RemoveComponentFromAll<T, Q...>();
+}
+
+template <typename... T> class Query;
+
+/// @brief Splits terms of a query into components and change filters.
+template <typename Components, typename Filters, typename... Terms> struct QueryTerms;
+template <ComponentDerived... C, typename... F> struct QueryTerms<std::tuple<C...>, std::tuple<F...>>
+{
+	template <Excludion E> using RangeView = EntityRangeView<E, C...>;
+	template <Excludion E> using View = EntityView<E, C...>;
+	template <Excludion E> using Iterator = EntityIterator<E, C...>;
+
+	static constexpr bool hasFilters = sizeof...(F) != 0;
+	static ComponentMask GetIncludeMask() { return ComponentMask::OfStored<C...>(); }
+	static void AddFilters(ChangeFilter &filter) { (filter.Add((F *)nullptr), ...); }
+};
+template <typename... C, typename... F, typename T, typename... R>
+struct QueryTerms<std::tuple<C...>, std::tuple<F...>, T, R...>
+	: std::conditional_t<isChangeFilter<T>, QueryTerms<std::tuple<C...>, std::tuple<F..., T>, R...>,
+						 QueryTerms<std::tuple<C..., T>, std::tuple<F...>, R...>>
+{
+};
+
+/// @brief Persistent query, caching IDs of archetypes storing T and none of the excluded components.
+/// The cache is updated by only checking archetypes created since the last iteration, and iterating costs nothing extra
+/// while archetypes don't change. It's rebuilt when the pool removes archetypes, which renumbers them.
+/// Terms can include Changed<U> and Added<U> filters, which skip chunks that didn't change since the previous iteration
+/// through this query. Every call to GetComponents, GetComponentsArrays, ForEach or begin starts a new run.
+template <ComponentDerived... E, typename... T> class Query<Exclude<E...>, T...>
+{
+	typedef QueryTerms<std::tuple<>, std::tuple<>, T...> Terms;
+
+	World *world;
+	ComponentMask includeMask;
+	ComponentMask excludeMask;
+	std::vector<int> archetypeIDs;
+	size_t checkedArchetypes;
+	size_t seenRemovals;
+	ChangeFilter filter;
+
+  public:
+	/// @brief Creates a query of a world.
+	/// @param world world the query iterates
+	Query(World &world = World::GetDefault())
+		: world(&world), includeMask(Terms::GetIncludeMask()), excludeMask(ComponentMask::Of<E...>()),
+		  checkedArchetypes(0), seenRemovals(world.GetArchetypePool().GetRemovalCount())
+	{
+		Terms::AddFilters(filter);
+		for (int id : filter.changed) includeMask.Set(id);
+		for (int id : filter.added) includeMask.Set(id);
+	}
+
+	World &GetWorld() const { return *world; }
+
+	/// @brief Adds archetypes created since the last update to the cache, called by every iteration function.
+	void Update();
+
+	/// @brief Gets IDs of all matching archetypes, including empty ones.
+	std::span<const int> GetArchetypeIDs()
+	{
+		Update();
+		return archetypeIDs;
+	}
+
+	typename Terms::template RangeView<Exclude<E...>> GetComponentsArrays()
+	{
+		Update();
+		return {world, &archetypeIDs, BeginRun()};
+	}
+	typename Terms::template View<Exclude<E...>> GetComponents()
+	{
+		Update();
+		return {world, &archetypeIDs, BeginRun()};
+	}
+
+	/// @brief Calls func(entity, components...) for every matching entity, see EntityRangeView::ForEach.
+	/// @param func function taking EntityHandle and T&...
+	template <typename F> void ForEach(F &&func) { GetComponentsArrays().ForEach(func); }
+
+	typename Terms::template Iterator<Exclude<E...>> begin() { return GetComponents().begin(); }
+	typename Terms::template Iterator<Exclude<E...>> end()
+	{
+		return typename Terms::template View<Exclude<E...>>{world, &archetypeIDs, GetFilter()}.end();
+	}
+
+  private:
+	const ChangeFilter *GetFilter() const { return Terms::hasFilters ? &filter : nullptr; }
+
+	/// @brief Moves the filter to a new run, starting a new change tick, so writes made after this point are seen by
+	/// the next run, but writes made through this run are not.
+	const ChangeFilter *BeginRun()
+	{
+		if constexpr (Terms::hasFilters)
+		{
+			filter.since = filter.tick;
+			filter.tick = world->AdvanceChangeTick();
+		}
+		return GetFilter();
+	}
+};
+
+/// @brief Query without excluded components.
+template <typename... T> class Query : public Query<Exclude<>, T...>
+{
+  public:
+	Query(World &world = World::GetDefault()) : Query<Exclude<>, T...>(world) {}
+};
+
+} // namespace ECS
 
 namespace ECS
 {
-template <ComponentDerived... TComponents> Entity::Entity(TComponents &&...components) : Entity()
+template <ComponentDerived... TComponents>
+Entity::Entity(TComponents &&...components) : Entity(World::GetDefault(), std::move(components)...)
 {
-	std::set<int> componentsID;
-	auto setComponentsAndAssertUnique = [&componentsID](int id) {
-		assert(!componentsID.contains(id) && "Trying to add multiple components of same type to an entity");
-		componentsID.insert(id);
+}
+
+template <ComponentDerived... TComponents>
+Entity::Entity(World &world, TComponents &&...components)
+	: world(&world), handle(world.Create(std::move(components)...))
+{
+}
+
+template <ComponentDerived T> void Entity::AddComponent(T &&component)
+{
+	if (!world->IsAlive(handle)) handle = world->Create();
+	world->AddComponent(handle, std::move(component));
+}
+
+template <ComponentDerived T> void Entity::RemoveComponent() { world->RemoveComponent<T>(handle); }
+
+template <ComponentDerived T> bool Entity::HasComponent() const
+{
+	return world->IsAlive(handle) && world->HasComponent<T>(handle);
+}
+
+template <ComponentDerived T> T &Entity::GetComponent() { return world->GetComponent<T>(handle); }
+
+template <ComponentDerived T> const T &Entity::GetComponent() const
+{
+	return std::as_const(*world).GetComponent<T>(handle);
+}
+
+template <ComponentDerived... TComponents> EntityHandle World::Create(TComponents &&...components)
+{
+	if constexpr ((SparseComponent<TComponents> || ...))
+	{
+		// Rare enough to not split the pack, components are added one by one.
+		EntityHandle entity = registry.Create();
+		(AddComponent(entity, std::move(components)), ...);
+		return entity;
+	}
+
+	ComponentMask componentMask;
+	auto setComponentsAndAssertUnique = [&componentMask](int id) {
+		assert(!componentMask.Test(id) && "Trying to add multiple components of same type to an entity");
+		componentMask.Set(id);
 	};
 	((setComponentsAndAssertUnique(TComponents::___componentID)), ...);
 
 	Archetype *archetype = nullptr;
-	if (!(archetype = ArchetypePool::GetArchetype(componentsID))) archetype = ArchetypePool::AddArchetype(componentsID);
+	if (!(archetype = archetypePool.GetArchetype(componentMask))) archetype = archetypePool.AddArchetype(componentMask);
 
-	archetype->Push(this, std::move(components)...);
+	EntityHandle entity = registry.Create();
+	archetype->Push(entity, std::move(components)...);
+	return entity;
 }
 
-template <ComponentDerived T> void Entity::AddComponent(T &&component)
+template <ComponentDerived... TComponents, typename F>
+std::vector<EntityHandle> World::SpawnBatch(int count, F &&generator)
 {
-	assert(!HasComponent<T>() && "Trying to add multiple components of same type to an entity");
-	if (archetypeID == -1)
+	static_assert(!(SparseComponent<TComponents> || ...), "Sparse components are added with AddComponent");
+	ComponentMask componentMask;
+	auto setComponentsAndAssertUnique = [&componentMask](int id) {
+		assert(!componentMask.Test(id) && "Trying to add multiple components of same type to an entity");
+		componentMask.Set(id);
+	};
+	((setComponentsAndAssertUnique(TComponents::___componentID)), ...);
+
+	Archetype *archetype = nullptr;
+	if (!(archetype = archetypePool.GetArchetype(componentMask))) archetype = archetypePool.AddArchetype(componentMask);
+
+	std::vector<EntityHandle> entities(count);
+	for (auto &entity : entities) entity = registry.Create();
+	int first = archetype->AllocateEntities(entities);
+
+	for (int index = first; index < first + count;)
+	{
+		int chunk = archetype->chunkCapacity == 0 ? 0 : index / archetype->chunkCapacity;
+		int begin = index - chunk * archetype->chunkCapacity;
+		int end = std::min(archetype->GetChunkSize(chunk), begin + first + count - index);
+		std::tuple<ColumnView<TComponents>...> columns(archetype->GetColumn<TComponents>(chunk)...);
+
+		for (int i = begin; i < end; i++, index++)
+		{
+			auto components = [&]() {
+				if constexpr (std::is_same_v<std::invoke_result_t<F &, int>, std::tuple<TComponents...>>)
+					return generator(index - first);
+				else
+					return std::tuple<TComponents...>(generator(index - first));
+			}();
+			auto construct = [&]<ComponentDerived T>(ColumnView<T> column) {
+				if constexpr (TagComponent<T>)
+					return;
+				else if constexpr (SplitComponent<T>)
+					column.Store(i, std::get<T>(components));
+				else
+					new (&column[i]) T(std::move(std::get<T>(components)));
+			};
+			(construct.template operator()<TComponents>(std::get<ColumnView<TComponents>>(columns)), ...);
+		}
+	}
+	return entities;
+}
+
+template <ComponentDerived T> void World::AddComponent(EntityHandle entity, T &&component)
+{
+	assert(IsAlive(entity) && "Trying to add component to a destroyed entity");
+	assert(!HasComponent<T>(entity) && "Trying to add multiple components of same type to an entity");
+	if constexpr (SparseComponent<T>)
 	{
-		std::set<int> newComponentIDs;
-		newComponentIDs.insert(T::___componentID);
+		new (GetSparseSet(T::___componentID).Add(entity)) T(std::move(component));
+		return;
+	}
 
+	int archetypeID = registry.GetSlot(entity).archetypeID;
+	if (archetypeID == -1)
+	{
 		Archetype *newArchetype = nullptr;
-		if (!(newArchetype = ArchetypePool::GetArchetype(newComponentIDs)))
-			newArchetype = ArchetypePool::AddArchetype(Archetype(newComponentIDs));
-		newArchetype->Push(this, std::move(component));
+		if (!(newArchetype = archetypePool.GetArchetype<T>()))
+			newArchetype = archetypePool.AddArchetype(ComponentMask::Of<T>());
+		newArchetype->Push(entity, std::move(component));
 	}
 	else
 	{
-		Archetype *archetype = &ArchetypePool::GetArchetypes()[archetypeID];
+		Archetype *newArchetype = archetypePool.GetArchetypeWith(archetypeID, T::___componentID);
+		Archetype *archetype = &archetypePool.GetArchetypes()[archetypeID];
+
+		archetype->MoveEntity(registry.GetSlot(entity).index, newArchetype);
+		int index = registry.GetSlot(entity).index;
+		if constexpr (TagComponent<T>)
+			return;
+		else if constexpr (SplitComponent<T>)
+			newArchetype->ConstructComponent(T::___componentID, index, &component);
+		else
+			new (newArchetype->GetComponent(T::___componentID, index)) T(std::move(component));
+	}
+}
 
-		std::set<int> newComponentIDs = archetype->denseComponentMap;
-		newComponentIDs.insert(T::___componentID);
+template <ComponentDerived T> void World::RemoveComponent(EntityHandle entity)
+{
+	assert(IsAlive(entity) && HasComponent<T>(entity) && "Trying to remove component that is not on an entity");
+	if constexpr (SparseComponent<T>)
+	{
+		GetSparseSet(T::___componentID).Remove(entity);
+		return;
+	}
 
-		Archetype *newArchetype = nullptr;
-		if (!(newArchetype = ArchetypePool::GetArchetype(newComponentIDs)))
+	EntityRegistry::Slot &slot = registry.GetSlot(entity);
+	Archetype *archetype = &archetypePool.GetArchetypes()[slot.archetypeID];
+	ComponentMask remainingMask = archetype->mask;
+	remainingMask.Reset(T::___componentID);
+	if (remainingMask.Empty())
+	{
+		archetype->RemoveEntity(slot.index);
+		slot.index = 0;
+		slot.archetypeID = -1;
+		return;
+	}
+
+	Archetype *newArchetype = archetypePool.GetArchetypeWithout(slot.archetypeID, T::___componentID);
+	archetype = &archetypePool.GetArchetypes()[slot.archetypeID];
+
+	archetype->MoveEntity(slot.index, newArchetype);
+}
+
+template <Excludion E, ComponentDerived... Q, ComponentDerived T> void World::AddComponentToAll(const T &component)
+{
+	static_assert(!SparseComponent<T> && !(SparseComponent<Q> || ...) && !excludesSparse<E>,
+				  "Bulk migration only moves archetype components");
+	// Collect matching archetypes first, creating destinations adds archetypes to the pool.
+	Query<E, Q...> query(*this);
+	std::vector<int> archetypeIDs;
+	for (int archetypeID : query.GetArchetypeIDs())
+	{
+		Archetype &archetype = archetypePool.GetArchetypes()[archetypeID];
+		if (archetype.entityCount != 0 && !archetype.mask.Test(T::___componentID)) archetypeIDs.push_back(archetypeID);
+	}
+
+	for (int archetypeID : archetypeIDs)
+	{
+		Archetype *destination = archetypePool.GetArchetypeWith(archetypeID, T::___componentID);
+		Archetype &source = archetypePool.GetArchetypes()[archetypeID];
+		int count = source.entityCount;
+		int first = source.MoveAllEntities(destination);
+		if constexpr (TagComponent<T>) continue;
+
+		for (int index = first; index < first + count;)
 		{
-			newArchetype = ArchetypePool::AddArchetype(Archetype(newComponentIDs));
-			archetype = &ArchetypePool::GetArchetypes()[archetypeID];
+			int chunk = destination->chunkCapacity == 0 ? 0 : index / destination->chunkCapacity;
+			int begin = index - chunk * destination->chunkCapacity;
+			int end = std::min(destination->GetChunkSize(chunk), begin + first + count - index);
+			ColumnView<T> column = destination->GetColumn<T>(chunk);
+			for (int i = begin; i < end; i++, index++)
+			{
+				if constexpr (SplitComponent<T>)
+					column.Store(i, component);
+				else
+					new (&column[i]) T(component);
+			}
 		}
+	}
+}
 
-		archetype->MoveEntity(id, newArchetype);
-		newArchetype->sparseComponentArray[T::___componentID].emplace_back(component, newArchetype->entityCount);
+template <ComponentDerived T, Excludion E, ComponentDerived... Q> void World::RemoveComponentFromAll()
+{
+	static_assert(!SparseComponent<T> && !(SparseComponent<Q> || ...) && !excludesSparse<E>,
+				  "Bulk migration only moves archetype components");
+	Query<E, T, Q...> query(*this);
+	std::vector<int> archetypeIDs;
+	for (int archetypeID : query.GetArchetypeIDs())
+		if (archetypePool.GetArchetypes()[archetypeID].entityCount != 0) archetypeIDs.push_back(archetypeID);
+
+	for (int archetypeID : archetypeIDs)
+	{
+		ComponentMask remainingMask = archetypePool.GetArchetypes()[archetypeID].mask;
+		remainingMask.Reset(T::___componentID);
+		Archetype *destination = nullptr;
+		if (!remainingMask.Empty()) destination = archetypePool.GetArchetypeWithout(archetypeID, T::___componentID);
+		archetypePool.GetArchetypes()[archetypeID].MoveAllEntities(destination);
 	}
 }
 
-template <ComponentDerived T> void Entity::RemoveComponent()
+template <Excludion E, ComponentDerived... T, typename F> void World::ParallelForEach(F &&func)
 {
-	assert(HasComponent<T>() && "Trying to remove component that is not on an entity");
-	Archetype *archetype = &ArchetypePool::GetArchetypes()[archetypeID];
-	std::set<int> newComponentIDs = archetype->denseComponentMap;
-	newComponentIDs.erase(T::___componentID);
+	static_assert(!(SplitComponent<T> || ...), "Split components can only be iterated by chunks");
+	typedef std::tuple<std::span<EntityHandle>, std::span<T>...> Range;
 
-	if (newComponentIDs.empty())
+	std::vector<Range> ranges;
+	size_t entityCount = 0;
+	for (auto range : GetComponentsArrays<E, T...>())
 	{
-		archetype->RemoveEntity(id);
-		id = 0;
-		archetypeID = -1;
-		return;
+		ranges.push_back(range);
+		entityCount += std::get<0>(range).size();
 	}
 
-	Archetype *newArchetype = nullptr;
-	if (!(newArchetype = ArchetypePool::GetArchetype(newComponentIDs)))
+	ThreadPool &pool = GetThreadPool();
+	size_t batchCount = pool.GetThreadCount() * 4;
+	size_t batchSize = (entityCount + batchCount - 1) / batchCount;
+	batchSize = std::max<size_t>((batchSize + cacheLineSize - 1) / cacheLineSize * cacheLineSize, cacheLineSize);
+
+	std::vector<Range> batches;
+	for (auto &range : ranges)
 	{
-		newArchetype = ArchetypePool::AddArchetype(Archetype(newComponentIDs));
-		archetype = &ArchetypePool::GetArchetypes()[archetypeID];
+		size_t size = std::get<0>(range).size();
+		for (size_t begin = 0; begin < size; begin += batchSize)
+		{
+			size_t count = std::min(batchSize, size - begin);
+			batches.push_back(std::apply([=](auto... spans) { return Range(spans.subspan(begin, count)...); }, range));
+		}
 	}
 
-	archetype->MoveEntity(id, newArchetype);
+	pool.ParallelFor(batches.size(), [&](int batch) {
+		std::apply(
+			[&](std::span<EntityHandle> entities, std::span<T>... components) {
+				for (size_t i = 0; i < entities.size(); i++) func(entities[i], components[i]...);
+			},
+			batches[batch]);
+	});
 }
 
-template <ComponentDerived... TComponents> void Archetype::Push(Entity *entity, TComponents &&...components)
+template <ComponentDerived... TComponents> void Archetype::Push(EntityHandle entity, TComponents &&...components)
 {
-	std::set<int> newComponentIDs;
-	((newComponentIDs.insert(TComponents::___componentID)), ...);
-	assert(newComponentIDs == denseComponentMap && "Archetype component mask does not match provided components");
+	assert(ComponentMask::Of<TComponents...>() == mask && "Archetype component mask does not match provided components");
 
-	if (entityCount + 1 >= entityCapacity) Reserve((entityCapacity + 1) * 1.7);
+	EnsureCapacity(entityCount + 1);
 
-	((sparseComponentArray[TComponents::___componentID].emplace_back(std::move(components), entityCount)), ...);
+	auto construct = [this]<ComponentDerived T>(T &component) {
+		if constexpr (TagComponent<T>)
+			return;
+		else if constexpr (SplitComponent<T>)
+			ConstructComponent(T::___componentID, entityCount, &component);
+		else
+			new (GetComponent(T::___componentID, entityCount)) T(std::move(component));
+	};
+	(construct(components), ...);
 
-	entity->id = entityCount;
-	entity->archetypeID = this - &ArchetypePool::archetypes[0];
-	entityReferences.append(entity, entityCount);
+	EntityRegistry::Slot &slot = world->GetRegistry().GetSlot(entity);
+	slot.archetypeID = archetypeID;
+	slot.index = entityCount;
+	GetEntity(entityCount) = entity;
+	MarkEntitiesAdded(entityCount, 1, ComponentMask());
 	entityCount++;
 }
 
-template <ComponentDerived T> std::span<T> Archetype::GetComponents()
+template <ComponentDerived T> std::span<T> Archetype::GetComponents(int chunk)
 {
-	T *begin = (T *)sparseComponentArray[T::___componentID].data();
-	T *end = begin + entityCount;
+	static_assert(!SplitComponent<T>, "Split components are accessed with GetColumn");
+	// Tags have no column, their spans point to the entity column, which is large enough and never written through.
+	T *begin = TagComponent<T> ? (T *)chunks[chunk].entityReferences.data()
+							   : (T *)chunks[chunk].columns[columnIndex[T::___componentID]].data();
+	T *end = begin + GetChunkSize(chunk);
 
 	return std::span<T>(begin, end);
 }
 
+template <ComponentDerived T> ColumnView<T> Archetype::GetColumn(int chunk)
+{
+	if constexpr (SplitComponent<T>)
+		return SplitSpan<T>{(typename T::SplitField *)chunks[chunk].columns[columnIndex[T::___componentID]].data(),
+							(size_t)GetChunkSize(chunk), (size_t)GetSplitBlockSize(T::___componentID)};
+	else
+		return GetComponents<T>(chunk);
+}
+
 template <ComponentDerived T> bool Archetype::StoresComponent()
 {
-	return denseComponentMap.contains(T::___componentID);
+	return mask.Test(T::___componentID);
 }
 
 template <Excludion E, ComponentDerived... T>
-EntityRangeIterator<E, T...>::EntityRangeIterator(size_t archetypeID) : archetypeID(archetypeID)
+EntityRangeIterator<E, T...>::EntityRangeIterator(World *world, const std::vector<int> *archetypeIDs,
+												  size_t archetypeID, const ChangeFilter *filter)
+	: world(world), archetypeIDs(archetypeIDs), filter(filter), archetypeID(archetypeID), chunkID(0)
 {
-	if (this->archetypeID < ArchetypePool::archetypes.size())
-		while (this->archetypeID < ArchetypePool::archetypes.size() && !IsCurrentArchetypeOk()) ++this->archetypeID;
+	SkipUnmatched();
 }
 
 template <Excludion E, ComponentDerived... T>
-std::tuple<std::span<Entity *>, std::span<T>...> EntityRangeIterator<E, T...>::operator*() const
+std::tuple<std::span<EntityHandle>, ColumnView<T>...> EntityRangeIterator<E, T...>::operator*() const
 {
+	MarkChanged<T...>();
+	return GetColumns();
+}
+
+template <Excludion E, ComponentDerived... T>
+std::tuple<std::span<EntityHandle>, ColumnView<T>...> EntityRangeIterator<E, T...>::GetColumns() const
+{
+	static_assert(!testsSparse, "Sparse components are not stored in chunks, use GetComponents or ForEach");
+	Archetype &archetype = GetArchetype();
 	return {
-		ArchetypePool::archetypes[archetypeID].GetEntities(),
-		(ArchetypePool::archetypes[archetypeID].GetComponents<T>())...,
+		archetype.GetEntities(chunkID),
+		(archetype.GetColumn<T>(chunkID))...,
 	};
 }
 
 template <Excludion E, ComponentDerived... T> EntityRangeIterator<E, T...> &EntityRangeIterator<E, T...>::operator++()
 {
-	while (++archetypeID < ArchetypePool::archetypes.size() && !IsCurrentArchetypeOk())
-		;
+	if (++chunkID < (size_t)GetArchetype().GetChunkCount() && !filter) return *this;
+
+	SkipUnmatched();
 	return *this;
 }
 
+template <Excludion E, ComponentDerived... T> void EntityRangeIterator<E, T...>::SkipUnmatched()
+{
+	size_t archetypeCount = archetypeIDs ? archetypeIDs->size() : world->GetArchetypePool().GetArchetypes().size();
+	for (; archetypeID < archetypeCount; archetypeID++, chunkID = 0)
+	{
+		if (!IsCurrentArchetypeOk()) continue;
+
+		Archetype &archetype = GetArchetype();
+		for (; chunkID < (size_t)archetype.GetChunkCount(); chunkID++)
+			if (!filter || filter->Matches(archetype, chunkID)) return;
+	}
+	chunkID = 0;
+}
+
+template <Excludion E, ComponentDerived... T>
+template <ComponentDerived... U>
+void EntityRangeIterator<E, T...>::MarkChanged() const
+{
+	uint64_t tick = filter ? filter->tick : world->GetChangeTick();
+	(GetArchetype().template MarkChanged<U>(chunkID, tick), ...);
+}
+
 template <Excludion E, ComponentDerived... T>
 bool EntityRangeIterator<E, T...>::operator!=(const EntityRangeIterator &rhs) const
 {
-	return archetypeID != rhs.archetypeID;
+	return archetypeID != rhs.archetypeID || chunkID != rhs.chunkID;
+}
+
+template <Excludion E, ComponentDerived... T> bool EntityRangeIterator<E, T...>::IsEnd() const
+{
+	return archetypeID >= (archetypeIDs ? archetypeIDs->size() : world->GetArchetypePool().GetArchetypes().size());
+}
+
+template <Excludion E, ComponentDerived... T> Archetype &EntityRangeIterator<E, T...>::GetArchetype() const
+{
+	return world->GetArchetypePool().GetArchetypes()[archetypeIDs ? (*archetypeIDs)[archetypeID] : archetypeID];
 }
 
 template <Excludion E, ComponentDerived... T> bool EntityRangeIterator<E, T...>::IsCurrentArchetypeOk() const
 {
+	Archetype &archetype = GetArchetype();
+	if (archetypeIDs) return archetype.entityCount != 0;
 
-	auto handleExcludion = []<ComponentDerived... U>(size_t archetypeID, Exclude<U...> *e) {
-		return (!ArchetypePool::archetypes[archetypeID].template StoresComponent<U>() && ...);
+	auto handleExcludion = []<ComponentDerived... U>(Archetype &archetype, Exclude<U...> *e) {
+		return (!archetype.template StoresComponent<U>() && ...);
 	};
-	return ArchetypePool::archetypes[archetypeID].entityCount != 0 && handleExcludion(archetypeID, (E *)0) &&
-		   (ArchetypePool::archetypes[archetypeID].StoresComponent<T>() && ...);
+	return archetype.entityCount != 0 && handleExcludion(archetype, (E *)0) &&
+		   ((SparseComponent<T> || archetype.StoresComponent<T>()) && ...);
+}
+
+template <Excludion E, ComponentDerived... T>
+bool EntityRangeIterator<E, T...>::MatchesSparse(EntityHandle entity) const
+{
+	auto contains = [&]<ComponentDerived U>() {
+		if constexpr (SparseComponent<U>)
+			return world->template GetSparseSet<U>().Contains(entity);
+		else
+			return true;
+	};
+	auto handleExcludion = [&]<ComponentDerived... U>(Exclude<U...> *e) {
+		return ((!SparseComponent<U> || !contains.template operator()<U>()) && ...);
+	};
+	return (contains.template operator()<T>() && ...) && handleExcludion((E *)0);
 }
 
 template <Excludion E, ComponentDerived... T> EntityRangeIterator<E, T...> EntityRangeView<E, T...>::begin()
 {
-	return EntityRangeIterator<E, T...>(0);
+	return EntityRangeIterator<E, T...>(world, archetypeIDs, 0, filter);
 }
 template <Excludion E, ComponentDerived... T> EntityRangeIterator<E, T...> EntityRangeView<E, T...>::end()
 {
-	return EntityRangeIterator<E, T...>(ArchetypePool::archetypes.size());
+	size_t archetypeCount = archetypeIDs ? archetypeIDs->size() : world->GetArchetypePool().GetArchetypes().size();
+	return EntityRangeIterator<E, T...>(world, archetypeIDs, archetypeCount, filter);
+}
+
+template <Excludion E, ComponentDerived... T>
+template <typename F>
+void EntityRangeView<E, T...>::ForEach(F &&func)
+{
+	static_assert(!(SplitComponent<T> || ...), "Split components can only be iterated by chunks");
+	if constexpr (EntityRangeIterator<E, T...>::testsSparse)
+	{
+		// Membership has to be tested per entity, so the loop can't run over plain pointers.
+		for (auto components : EntityView<E, T...>{world, archetypeIDs, filter}) std::apply(func, components);
+	}
+	else
+	{
+		for (auto range : *this)
+		{
+			std::apply(
+				[&](std::span<EntityHandle> entities, std::span<T>... components) {
+					EntityHandle *entityPointer = entities.data();
+					size_t count = entities.size();
+					[&](T *...componentPointers) {
+						for (size_t i = 0; i < count; i++) func(entityPointer[i], componentPointers[i]...);
+					}(components.data()...);
+				},
+				range);
+		}
+	}
 }
 
 template <Excludion E, ComponentDerived... T>
-EntityIterator<E, T...>::EntityIterator(EntityRangeIterator<E, T...> entityRange, size_t entityID)
-	: entityRange(entityRange), entityID(entityID)
+EntityIterator<E, T...>::EntityIterator(EntityRangeIterator<E, T...> entityRange) : entityRange(entityRange)
 {
+	LoadChunk();
+	if constexpr (EntityRangeIterator<E, T...>::testsSparse) SkipUnmatched();
 }
 
-template <Excludion E, ComponentDerived... T> std::tuple<Entity &, T &...> EntityIterator<E, T...>::operator*() const
+template <Excludion E, ComponentDerived... T> void EntityIterator<E, T...>::LoadChunk()
 {
-	return {
-		*std::get<0>(*entityRange)[entityID],
-		(std::get<std::span<T>>(*entityRange)[entityID])...,
-	};
+	entityID = 0;
+	if (entityRange.IsEnd())
+	{
+		entities = nullptr;
+		entityCount = 0;
+		return;
+	}
+
+	Archetype &archetype = entityRange.GetArchetype();
+	entityRange.template MarkChanged<T...>();
+	entities = archetype.GetEntities(entityRange.chunkID).data();
+	components = {GetColumn<T>(archetype, entityRange.chunkID)...};
+	entityCount = archetype.GetChunkSize(entityRange.chunkID);
 }
 
-template <Excludion E, ComponentDerived... T> EntityIterator<E, T...> &EntityIterator<E, T...>::operator++()
+template <Excludion E, ComponentDerived... T> void EntityIterator<E, T...>::SkipUnmatched()
 {
-	++entityID;
-	if (entityID < std::get<0>(*entityRange).size()) return *this;
+	while (entityCount != 0 && !entityRange.MatchesSparse(entities[entityID]))
+	{
+		if (++entityID < entityCount) continue;
+		++entityRange;
+		LoadChunk();
+	}
+}
 
-	entityID = 0;
-	++entityRange;
-	return *this;
+template <Excludion E, ComponentDerived... T>
+template <ComponentDerived U>
+U &EntityIterator<E, T...>::GetComponent() const
+{
+	if constexpr (SparseComponent<U>)
+		return *(U *)entityRange.world->template GetSparseSet<U>().Get(entities[entityID]);
+	else
+		return std::get<U *>(components)[entityID];
 }
 
-template <Excludion E, ComponentDerived... T> bool EntityIterator<E, T...>::operator!=(const EntityIterator &rhs) const
+template <Excludion E, ComponentDerived... T>
+template <ComponentDerived U>
+U *EntityIterator<E, T...>::GetColumn(Archetype &archetype, size_t chunk)
 {
-	return entityRange != rhs.entityRange || entityID != rhs.entityID;
+	if constexpr (SparseComponent<U>)
+		return nullptr;
+	else
+		return archetype.GetComponents<U>(chunk).data();
 }
 
 template <Excludion E, ComponentDerived... T> EntityIterator<E, T...> EntityView<E, T...>::begin()
 {
-	return EntityIterator<E, T...>(EntityRangeView<E, T...>().begin(), 0);
+	return EntityIterator<E, T...>(EntityRangeView<E, T...>{world, archetypeIDs, filter}.begin());
 }
 template <Excludion E, ComponentDerived... T> EntityIterator<E, T...> EntityView<E, T...>::end()
 {
-	return EntityIterator<E, T...>(EntityRangeView<E, T...>().end(), 0);
+	return EntityIterator<E, T...>(EntityRangeView<E, T...>{world, archetypeIDs, filter}.end());
 }
 
-template <ComponentDerived... T> Archetype *ArchetypePool::GetArchetype()
+template <ComponentDerived... E, typename... T> void Query<Exclude<E...>, T...>::Update()
 {
-	std::set<int> ids;
-	((ids.insert(T::___componentID)), ...);
+	ArchetypePool &archetypePool = world->GetArchetypePool();
+	if (seenRemovals != archetypePool.GetRemovalCount())
+	{
+		archetypeIDs.clear();
+		checkedArchetypes = 0;
+		seenRemovals = archetypePool.GetRemovalCount();
+	}
+
+	std::span<Archetype> archetypes = archetypePool.GetArchetypes();
+	for (; checkedArchetypes < archetypes.size(); checkedArchetypes++)
+	{
+		const ComponentMask &mask = archetypes[checkedArchetypes].mask;
+		if (mask.Contains(includeMask) && !mask.Intersects(excludeMask)) archetypeIDs.push_back(checkedArchetypes);
+	}
+}
 
-	return GetArchetype(ids);
+template <ComponentDerived... T> Archetype *ArchetypePool::GetArchetype()
+{
+	static const ComponentMask componentMask = ComponentMask::Of<T...>();
+	return GetArchetype(componentMask);
 }
 } // namespace ECS
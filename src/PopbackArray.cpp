@@ -1,16 +1,34 @@
 #include "PopbackArray.h"
 #include <assert.h>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <new>
 #include <utility>
 
-PopbackArray::PopbackArray() : m_data(nullptr) {}
+PopbackArray::PopbackArray() : PopbackArray(ECS::Allocator::GetDefault()) {}
 
-PopbackArray::PopbackArray(PopbackArray&& rhs) : PopbackArray() { std::swap(m_data, rhs.m_data); }
+PopbackArray::PopbackArray(ECS::Allocator& allocator)
+	: m_data(nullptr), m_allocator(&allocator), m_byteSize(0), m_alignment(alignof(std::max_align_t))
+{
+}
+
+PopbackArray::PopbackArray(PopbackArray&& rhs) : PopbackArray(*rhs.m_allocator)
+{
+	std::swap(m_data, rhs.m_data);
+	std::swap(m_byteSize, rhs.m_byteSize);
+	std::swap(m_alignment, rhs.m_alignment);
+}
 
 PopbackArray& PopbackArray::operator=(PopbackArray&& rhs)
 {
-	if (this != &rhs) std::swap(m_data, rhs.m_data);
+	if (this != &rhs)
+	{
+		std::swap(m_data, rhs.m_data);
+		std::swap(m_allocator, rhs.m_allocator);
+		std::swap(m_byteSize, rhs.m_byteSize);
+		std::swap(m_alignment, rhs.m_alignment);
+	}
 
 	return *this;
 }
@@ -19,7 +37,7 @@ PopbackArray::~PopbackArray()
 {
 	if (m_data)
 	{
-		free(m_data);
+		m_allocator->Deallocate(m_data, m_byteSize, m_alignment);
 		m_data = nullptr;
 	}
 }
@@ -50,30 +68,34 @@ void PopbackArray::pop(int index, int size, int byteSize, void (*moveConstructor
 	moveConstructor(at(index, byteSize), at(size - 1, byteSize));
 }
 
-void PopbackArray::reserve(int oldCapacity, int newCapacity, int byteSize)
+void PopbackArray::reserve(int oldCapacity, int newCapacity, int byteSize, int alignment)
 {
-	void* newComponents = realloc(m_data, newCapacity * byteSize);
-
-	if (!newComponents)
+	size_t newByteSize = (size_t) newCapacity * byteSize;
+	void* newComponents = m_allocator->Allocate(newByteSize, alignment);
+	if (m_data)
 	{
-		newComponents = malloc(newCapacity * byteSize);
 		memcpy(newComponents, m_data, (oldCapacity < newCapacity ? oldCapacity : newCapacity) * byteSize);
-
-		if (m_data) free(m_data);
+		m_allocator->Deallocate(m_data, m_byteSize, m_alignment);
 	}
 
 	m_data = newComponents;
+	m_byteSize = newByteSize;
+	m_alignment = alignment;
 }
 
-void PopbackArray::reserve(int oldCapacity, int newCapacity, int byteSize, void (*moveConstructor)(void*, void*))
+void PopbackArray::reserve(int oldCapacity, int newCapacity, int byteSize, int alignment,
+						   void (*moveConstructor)(void*, void*))
 {
-	void* newComponents = malloc(newCapacity * byteSize);
+	size_t newByteSize = (size_t) newCapacity * byteSize;
+	void* newComponents = m_allocator->Allocate(newByteSize, alignment);
 	for (int i = 0; i < (oldCapacity < newCapacity ? oldCapacity : newCapacity); i++)
 		moveConstructor((char*) newComponents + i * byteSize, (char*) m_data + i * byteSize);
 
-	if (m_data) free(m_data);
+	if (m_data) m_allocator->Deallocate(m_data, m_byteSize, m_alignment);
 
 	m_data = newComponents;
+	m_byteSize = newByteSize;
+	m_alignment = alignment;
 }
 
 const void* PopbackArray::at(int index, int byteSize) const { return (char*) m_data + index * byteSize; }
@@ -83,4 +105,20 @@ void* PopbackArray::at(int index, int byteSize) { return (char*) m_data + index
 const void* PopbackArray::data() const { return m_data; }
 
 void* PopbackArray::data() { return m_data; }
+
+void PopbackArray::assign(void* data, size_t byteSize, int alignment)
+{
+	if (m_data) m_allocator->Deallocate(m_data, m_byteSize, m_alignment);
+	m_data = data;
+	m_byteSize = byteSize;
+	m_alignment = alignment;
+}
+
+void* PopbackArray::release()
+{
+	void* data = m_data;
+	m_data = nullptr;
+	m_byteSize = 0;
+	return data;
+}
 PopbackArray::operator bool() { return m_data != nullptr; }
@@ -1,11 +1,16 @@
+#include "Allocator.h"
 #include <utility>
 
 class PopbackArray
 {
 	void *m_data;
+	ECS::Allocator *m_allocator;
+	size_t m_byteSize;
+	int m_alignment;
 
   public:
 	PopbackArray();
+	explicit PopbackArray(ECS::Allocator &allocator);
 	PopbackArray(PopbackArray &&rhs);
 	PopbackArray &operator=(PopbackArray &&rhs);
 	~PopbackArray();
@@ -18,13 +23,17 @@ class PopbackArray
 	void pop(int index, int size, int byteSize);
 	void pop(int index, int size, int byteSize, void (*moveConstructor)(void *, void *));
 
-	void reserve(int oldCapacity, int newCapacity, int byteSize);
-	void reserve(int oldCapacity, int newCapacity, int byteSize, void (*moveConstructor)(void *, void *));
+	void reserve(int oldCapacity, int newCapacity, int byteSize, int alignment);
+	void reserve(int oldCapacity, int newCapacity, int byteSize, int alignment,
+				 void (*moveConstructor)(void *, void *));
 	void *at(int index, int byteSize);
 	const void *at(int index, int byteSize) const;
 	void *data();
 	const void *data() const;
 
+	void assign(void *data, size_t byteSize, int alignment);
+	void *release();
+
 	template <typename T> void append(const T &element, int size) { append(&element, size, sizeof(T)); }
 	template <typename T> void pop(int index, int size) { pop(index, size, sizeof(T)); }
 	template <typename T> void pop(int index, int size, void (*moveConstructor)(void *, void *))
@@ -0,0 +1,468 @@
+#include "Replication.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ECS
+{
+// Packet layout, all integers are varints:
+//   sequence, baseline sequence + 1 or 0 if there is none, number of the sender's entity slots, followed by the schema
+//   key as 8 raw bytes if there is no baseline
+//   records sorted by slot index, each starting with the gap to the previous record's index + 1, terminated by 0
+//   record header, bits of the entity's replicated components << 1 | 1 if the entity is new:
+//     new entity: generation, then every component as all of it's words
+//     bits 0: entity is no longer mirrored
+//     otherwise: bits of components written since the baseline, every one of them as groups of 64 words, each a mask of
+//     changed words followed by their XOR with the baseline, then components added since the baseline as all words
+
+static uint64_t GetSchemaKey(std::span<const int> componentIDs)
+{
+	uint64_t key = ComponentInfo::HashName("Replication");
+	for (int componentID : componentIDs)
+		key = (key ^ ComponentInfo::GetKey(componentID) ^ ComponentInfo::GetByteSize(componentID)) * 1099511628211ull;
+	return key;
+}
+
+ReplicationSchema::ReplicationSchema(const ComponentMask &components) : mask(components)
+{
+	components.ForEach([&](int componentID) {
+		assert(!ComponentInfo::IsSparse(componentID) && "Only components stored in archetypes can be replicated");
+		assert(ComponentInfo::IsTriviallyCopyable(componentID) && "Replicated components have to be trivially copyable");
+		componentIDs.push_back(componentID);
+	});
+	assert(componentIDs.size() <= 64 && "At most 64 components can be replicated");
+	std::sort(componentIDs.begin(), componentIDs.end(),
+			  [](int lhs, int rhs) { return ComponentInfo::GetKey(lhs) < ComponentInfo::GetKey(rhs); });
+
+	wordOffsets.push_back(0);
+	for (int componentID : componentIDs)
+		wordOffsets.push_back(wordOffsets.back() + (ComponentInfo::GetByteSize(componentID) + 3) / 4);
+	stride = wordOffsets.back();
+	key = GetSchemaKey(componentIDs);
+}
+
+uint64_t ReplicationSchema::GetBits(const ComponentMask &components) const
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < componentIDs.size(); i++)
+		if (components.Test(componentIDs[i])) bits |= uint64_t(1) << i;
+	return bits;
+}
+
+/// @brief Copies components of a chunk's entities out of a column into the slots of the entities, fields of split
+/// components are gathered.
+static void CopyColumn(Archetype &archetype, int componentID, int chunk, std::span<const EntityHandle> entities,
+					   uint32_t *words, int stride)
+{
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	int begin = archetype.chunkCapacity * chunk;
+	if (!ComponentInfo::IsSplit(componentID))
+	{
+		const char *column = (const char *)archetype.GetComponent(componentID, begin);
+		for (int i = 0; i < entities.size(); i++)
+			memcpy(words + (size_t)entities[i].index * stride, column + (size_t)i * byteSize, byteSize);
+		return;
+	}
+
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	for (int i = 0; i < entities.size(); i++)
+		for (int field = 0; field < byteSize / fieldSize; field++)
+			memcpy((char *)(words + (size_t)entities[i].index * stride) + field * fieldSize,
+				   archetype.GetField(componentID, begin + i, field), fieldSize);
+}
+
+/// @brief Writes a component of an entity into it's column, fields of split components are scattered.
+static void WriteComponent(Archetype &archetype, int componentID, int index, const uint32_t *source)
+{
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	if (!ComponentInfo::IsSplit(componentID))
+	{
+		memcpy(archetype.GetComponent(componentID, index), source, byteSize);
+		return;
+	}
+
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	for (int field = 0; field < byteSize / fieldSize; field++)
+		memcpy(archetype.GetField(componentID, index, field), (const char *)source + field * fieldSize, fieldSize);
+}
+
+ReplicationEncoder::ReplicationEncoder(World &world, const ComponentMask &components, int capacity)
+	: ReplicationSchema(components), world(&world), capacity(capacity), acknowledged(-1), nextSequence(0)
+{
+	assert(capacity > 0 && "Encoder has to keep at least one packet");
+}
+
+int64_t ReplicationEncoder::Encode(SnapshotWriter &writer)
+{
+	const ReplicationState *baseline = acknowledged == -1 ? nullptr : &states.front();
+	int baselineCount = baseline ? baseline->masks.size() : 0;
+	int slotCount = std::max((int)world->GetRegistry().GetSlots().size(), baselineCount);
+
+	// Entities in chunks not written since the baseline still have the baseline's components.
+	ReplicationState state = std::move(spare);
+	state.sequence = nextSequence++;
+	state.tick = world->AdvanceChangeTick();
+	state.masks.assign(slotCount, 0);
+	state.generations.assign(slotCount, 0);
+	if (baseline)
+		state.words.assign(baseline->words.begin(), baseline->words.end());
+	else
+		state.words.clear();
+	state.words.resize((size_t)slotCount * stride);
+	copied.assign(slotCount, false);
+
+	std::vector<std::pair<int, int>> columns;
+	for (Archetype &archetype : world->GetArchetypePool().GetArchetypes())
+	{
+		if (archetype.entityCount == 0 || !archetype.mask.Intersects(mask)) continue;
+
+		uint64_t bits = GetBits(archetype.mask);
+		columns.clear();
+		for (int i = 0; i < componentIDs.size(); i++)
+			if (archetype.columnIndex.Contains(componentIDs[i])) columns.push_back({i, componentIDs[i]});
+
+		for (int chunk = 0; chunk < archetype.GetChunkCount(); chunk++)
+		{
+			std::span<EntityHandle> entities = archetype.GetEntities(chunk);
+			for (EntityHandle entity : entities)
+			{
+				state.masks[entity.index] = bits;
+				state.generations[entity.index] = entity.generation;
+			}
+
+			const std::vector<uint64_t> &ticks = archetype.chunks[chunk].changedTicks;
+			if (baseline && std::none_of(columns.begin(), columns.end(), [&](std::pair<int, int> column) {
+					return ticks[archetype.columnIndex[column.second]] > baseline->tick;
+				}))
+				continue;
+
+			for (auto [component, componentID] : columns)
+				CopyColumn(archetype, componentID, chunk, entities, state.words.data() + wordOffsets[component], stride);
+			for (EntityHandle entity : entities) copied[entity.index] = true;
+		}
+	}
+
+	writer.WriteVarint(state.sequence);
+	writer.WriteVarint(baseline ? baseline->sequence + 1 : 0);
+	writer.WriteVarint(slotCount);
+	if (!baseline) writer.Write(key);
+
+	auto writeWords = [&](const uint32_t *words, int component) {
+		for (int i = wordOffsets[component]; i < wordOffsets[component + 1]; i++) writer.WriteVarint(words[i]);
+	};
+	auto forEachBit = [](uint64_t bits, auto &&func) {
+		for (; bits; bits &= bits - 1) func(std::countr_zero(bits));
+	};
+
+	int next = 0;
+	for (int index = 0; index < slotCount; index++)
+	{
+		uint64_t bits = state.masks[index];
+		uint64_t previousBits = index < baselineCount ? baseline->masks[index] : 0;
+		if (!bits && !previousBits) continue;
+
+		// Slots of entities without replicated columns are not copied, their generation shows whether they're new.
+		const uint32_t *words = state.words.data() + (size_t)index * stride;
+		bool isNew = bits && (!previousBits || state.generations[index] != baseline->generations[index]);
+		if (bits == previousBits && !isNew && !copied[index]) continue;
+		uint64_t written = 0;
+		if (!isNew && bits)
+		{
+			const uint32_t *previousWords = baseline->words.data() + (size_t)index * stride;
+			forEachBit(bits & previousBits, [&](int component) {
+				for (int i = wordOffsets[component]; i < wordOffsets[component + 1]; i++)
+					if (words[i] != previousWords[i])
+					{
+						written |= uint64_t(1) << component;
+						break;
+					}
+			});
+			if (!written && bits == previousBits) continue;
+		}
+
+		writer.WriteVarint(index - next + 1);
+		writer.WriteVarint(bits << 1 | isNew);
+		next = index + 1;
+		if (isNew)
+		{
+			writer.WriteVarint(state.generations[index]);
+			forEachBit(bits, [&](int component) { writeWords(words, component); });
+			continue;
+		}
+		if (!bits) continue;
+
+		const uint32_t *previousWords = baseline->words.data() + (size_t)index * stride;
+		writer.WriteVarint(written);
+		forEachBit(written, [&](int component) {
+			for (int group = wordOffsets[component]; group < wordOffsets[component + 1]; group += 64)
+			{
+				int end = std::min(group + 64, wordOffsets[component + 1]);
+				uint64_t changed = 0;
+				for (int i = group; i < end; i++)
+					if (words[i] != previousWords[i]) changed |= uint64_t(1) << (i - group);
+				writer.WriteVarint(changed);
+				forEachBit(changed, [&](int i) { writer.WriteVarint(words[group + i] ^ previousWords[group + i]); });
+			}
+		});
+		forEachBit(bits & ~previousBits, [&](int component) { writeWords(words, component); });
+	}
+	writer.WriteVarint(0);
+
+	// Without a baseline the oldest packets are dropped, otherwise the oldest ones after the baseline.
+	if (states.size() == capacity + (acknowledged != -1))
+	{
+		spare = std::move(states[acknowledged != -1]);
+		states.erase(states.begin() + (acknowledged != -1));
+	}
+	states.push_back(std::move(state));
+	return states.back().sequence;
+}
+
+bool ReplicationEncoder::Acknowledge(int64_t sequence)
+{
+	if (sequence <= acknowledged) return false;
+	auto it = std::find_if(states.begin(), states.end(),
+						   [&](const ReplicationState &state) { return state.sequence == sequence; });
+	if (it == states.end()) return false;
+
+	if (it != states.begin()) spare = std::move(*(it - 1));
+	states.erase(states.begin(), it);
+	acknowledged = sequence;
+	return true;
+}
+
+void ReplicationEncoder::Reset()
+{
+	if (acknowledged != -1) states.pop_front();
+	acknowledged = -1;
+}
+
+ReplicationDecoder::ReplicationDecoder(World &world, const ComponentMask &components, int capacity, int maxSlotCount)
+	: ReplicationSchema(components), world(&world), capacity(capacity), maxSlotCount(maxSlotCount)
+{
+	assert(capacity > 0 && "Decoder has to keep at least one packet");
+	assert(maxSlotCount >= 0 && "Negative slot limit");
+}
+
+bool ReplicationDecoder::Decode(SnapshotReader &reader)
+{
+	int64_t sequence = reader.ReadVarint();
+	uint64_t baselineSequence = reader.ReadVarint();
+	uint64_t slotCount = reader.ReadVarint();
+	if (reader.Failed() || sequence <= GetLastSequence() || slotCount > (uint64_t)maxSlotCount) return false;
+
+	const ReplicationState *baseline = nullptr;
+	if (baselineSequence == 0)
+	{
+		if (reader.Read<uint64_t>() != key) return false;
+	}
+	else
+	{
+		auto it = std::find_if(states.begin(), states.end(), [&](const ReplicationState &state) {
+			return state.sequence == (int64_t)baselineSequence - 1;
+		});
+		if (it == states.end()) return false;
+		baseline = &*it;
+	}
+
+	ReplicationState state = std::move(spare);
+	state.sequence = sequence;
+	state.tick = 0;
+	if (baseline)
+	{
+		state.masks.assign(baseline->masks.begin(), baseline->masks.end());
+		state.generations.assign(baseline->generations.begin(), baseline->generations.end());
+		state.words.assign(baseline->words.begin(), baseline->words.end());
+	}
+	else
+	{
+		state.masks.clear();
+		state.generations.clear();
+		state.words.clear();
+	}
+
+	// Records are applied to the new state only, the world is touched once the whole packet turned out to be valid.
+	uint64_t allBits = componentIDs.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << componentIDs.size()) - 1;
+	auto readWord = [&](uint32_t &word) {
+		uint64_t value = reader.ReadVarint();
+		word = value;
+		return value <= UINT32_MAX;
+	};
+	auto readWords = [&](uint32_t *words, int component) {
+		for (int i = wordOffsets[component]; i < wordOffsets[component + 1]; i++)
+			if (!readWord(words[i])) return false;
+		return true;
+	};
+	auto forEachBit = [](uint64_t bits, auto &&func) {
+		for (; bits; bits &= bits - 1)
+			if (!func(std::countr_zero(bits))) return false;
+		return true;
+	};
+
+	touched.clear();
+	bool valid = true;
+	for (uint64_t next = 0; valid;)
+	{
+		uint64_t gap = reader.ReadVarint();
+		if (gap == 0 || reader.Failed()) break;
+		uint64_t index = next + gap - 1;
+		// Slots grow only up to the sender's slot count, so a malformed record can't make the state allocate more.
+		if (gap > slotCount || index >= slotCount)
+		{
+			valid = false;
+			break;
+		}
+		next = index + 1;
+
+		if (index >= state.masks.size())
+		{
+			state.masks.resize(index + 1, 0);
+			state.generations.resize(index + 1, 0);
+			state.words.resize((index + 1) * stride, 0);
+		}
+		uint64_t header = reader.ReadVarint();
+		uint64_t bits = header >> 1;
+		uint64_t previousBits = state.masks[index];
+		uint32_t *words = state.words.data() + index * stride;
+		if (bits & ~allBits)
+			valid = false;
+		else if (header & 1)
+		{
+			uint64_t generation = reader.ReadVarint();
+			valid = bits && generation <= UINT32_MAX &&
+					forEachBit(bits, [&](int component) { return readWords(words, component); });
+			state.generations[index] = generation;
+		}
+		else if (bits)
+		{
+			uint64_t written = reader.ReadVarint();
+			valid = previousBits && !(written & ~(bits & previousBits)) && forEachBit(written, [&](int component) {
+						for (int group = wordOffsets[component]; group < wordOffsets[component + 1]; group += 64)
+						{
+							int count = std::min(64, wordOffsets[component + 1] - group);
+							uint64_t changed = reader.ReadVarint();
+							if (count < 64 && changed >> count) return false;
+							bool read = forEachBit(changed, [&](int i) {
+								uint32_t word;
+								if (!readWord(word)) return false;
+								words[group + i] ^= word;
+								return true;
+							});
+							if (!read) return false;
+						}
+						return true;
+					}) && forEachBit(bits & ~previousBits, [&](int component) { return readWords(words, component); });
+		}
+		else
+			valid = previousBits != 0;
+
+		state.masks[index] = bits;
+		touched.push_back(index);
+	}
+	if (!valid || reader.Failed())
+	{
+		spare = std::move(state);
+		return false;
+	}
+
+	// The world holds the newest decoded state, which is not the baseline if packets after it were decoded already.
+	const ReplicationState *previous = states.empty() ? nullptr : &states.back();
+	if (previous && previous != baseline)
+	{
+		int recordCount = touched.size();
+		for (int index = 0, record = 0; index < previous->masks.size(); index++)
+		{
+			for (; record < recordCount && touched[record] < index; record++);
+			if (record < recordCount && touched[record] == index) continue;
+
+			uint64_t bits = index < state.masks.size() ? state.masks[index] : 0;
+			if (bits != previous->masks[index] || (bits && state.generations[index] != previous->generations[index]) ||
+				(bits && memcmp(state.words.data() + (size_t)index * stride,
+								previous->words.data() + (size_t)index * stride, stride * sizeof(uint32_t)) != 0))
+				touched.push_back(index);
+		}
+		std::inplace_merge(touched.begin(), touched.begin() + recordCount, touched.end());
+	}
+
+	if (entities.size() < state.masks.size()) entities.resize(state.masks.size());
+	for (int index : touched) Apply(index, previous, state);
+
+	// Packets older than the baseline won't be baselines again, the encoder only moves it's baseline forward.
+	while (!states.empty() && (states.size() == capacity || states.front().sequence < (int64_t)baselineSequence - 1))
+	{
+		spare = std::move(states.front());
+		states.pop_front();
+	}
+	states.push_back(std::move(state));
+	return true;
+}
+
+void ReplicationDecoder::Apply(int index, const ReplicationState *previous, const ReplicationState &state)
+{
+	bool existed = previous && index < previous->masks.size() && previous->masks[index] != 0;
+	uint64_t previousBits = existed ? previous->masks[index] : 0;
+	uint64_t bits = state.masks[index];
+	EntityHandle &entity = entities[index];
+	if (existed && !world->IsAlive(entity)) previousBits = 0;
+
+	if (previousBits && (!bits || previous->generations[index] != state.generations[index]))
+	{
+		world->Destroy(entity);
+		previousBits = 0;
+	}
+	if (!bits)
+	{
+		entity = EntityHandle();
+		return;
+	}
+	if (!previousBits) entity = world->Create();
+
+	// Components that are not replicated stay on the entity.
+	EntityRegistry::Slot &slot = world->GetRegistry().GetSlot(entity);
+	ArchetypePool &archetypePool = world->GetArchetypePool();
+	uint64_t presentBits = slot.archetypeID == -1 ? 0 : GetBits(archetypePool.GetArchetypes()[slot.archetypeID].mask);
+	previousBits &= presentBits;
+	if (presentBits != bits || slot.archetypeID == -1)
+	{
+		ComponentMask components;
+		if (slot.archetypeID != -1) components = archetypePool.GetArchetypes()[slot.archetypeID].mask;
+		for (int i = 0; i < componentIDs.size(); i++)
+		{
+			if (bits >> i & 1)
+				components.Set(componentIDs[i]);
+			else
+				components.Reset(componentIDs[i]);
+		}
+
+		Archetype *destination = archetypePool.GetArchetype(components);
+		if (!destination) destination = archetypePool.AddArchetype(components);
+		if (slot.archetypeID == -1)
+			destination->AllocateEntities(std::span(&entity, 1));
+		else
+			archetypePool.GetArchetypes()[slot.archetypeID].MoveEntity(slot.index, destination);
+	}
+
+	Archetype &archetype = archetypePool.GetArchetypes()[slot.archetypeID];
+	const uint32_t *words = state.words.data() + (size_t)index * stride;
+	const uint32_t *previousWords = previousBits ? previous->words.data() + (size_t)index * stride : nullptr;
+	for (int i = 0; i < componentIDs.size(); i++)
+	{
+		if (!(bits >> i & 1) || GetWordCount(i) == 0) continue;
+		int offset = wordOffsets[i];
+		if (previousBits >> i & 1 &&
+			memcmp(words + offset, previousWords + offset, GetWordCount(i) * sizeof(uint32_t)) == 0)
+			continue;
+
+		WriteComponent(archetype, componentIDs[i], slot.index, words + offset);
+		archetype.MarkChanged(componentIDs[i], archetype.chunkCapacity == 0 ? 0 : slot.index / archetype.chunkCapacity,
+							  world->GetChangeTick());
+	}
+}
+
+EntityHandle ReplicationDecoder::GetLocalEntity(EntityHandle remote) const
+{
+	if (states.empty() || remote.index >= states.back().masks.size()) return EntityHandle();
+	const ReplicationState &state = states.back();
+	if (!state.masks[remote.index] || state.generations[remote.index] != remote.generation) return EntityHandle();
+	return entities[remote.index];
+}
+} // namespace ECS
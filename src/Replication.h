@@ -0,0 +1,143 @@
+#pragma once
+#include "ECS.h"
+#include "Snapshot.h"
+#include <deque>
+
+namespace ECS
+{
+/// @brief State of the replicated components of every entity of a sending world, as of one packet of a stream.
+struct ReplicationState
+{
+	int64_t sequence;
+
+	/// @brief Change tick ended by encoding the packet, only used by the encoder.
+	uint64_t tick;
+
+	/// @brief Sender's slot index -> bits of the replicated components the entity has, 0 if it's not mirrored.
+	std::vector<uint64_t> masks;
+	std::vector<uint32_t> generations;
+
+	/// @brief Components of every slot as 32 bit words, ReplicationSchema::stride words per slot.
+	std::vector<uint32_t> words;
+};
+
+/// @brief Components mirrored by a replication stream. Components are ordered by their keys, see
+/// ComponentInfo::GetKey, so both ends agree on the order even if they registered components in a different order.
+class ReplicationSchema
+{
+  protected:
+	std::vector<int> componentIDs;
+
+	/// @brief Position of every component's first word in a slot, components are padded to whole words.
+	std::vector<int> wordOffsets;
+	int stride;
+	ComponentMask mask;
+
+	/// @brief Hash of the keys and sizes of all components, sent with every packet without a baseline.
+	uint64_t key;
+
+	/// @param components replicated components, at most 64, stored in archetypes and trivially copyable
+	ReplicationSchema(const ComponentMask &components);
+
+	/// @brief Gets the bits of the replicated components present in a mask.
+	uint64_t GetBits(const ComponentMask &components) const;
+
+	int GetWordCount(int component) const { return wordOffsets[component + 1] - wordOffsets[component]; }
+};
+
+/// @brief Encodes the replicated components of a world into packets of a stream, for ReplicationDecoder to mirror into
+/// another world. Every packet is a delta against the newest packet the receiver acknowledged, or the full state if it
+/// acknowledged none, so packets can be lost or delivered late as long as the newest ones arrive.
+/// A packet holds a record for every entity that appeared, disappeared, or had a component added, removed or written
+/// since the baseline. Written components are sent as the XOR of their 32 bit words with the baseline, only words that
+/// changed, each as a varint. Only chunks written since the baseline are compared, found by their change ticks, so
+/// components written through spans of Archetype::GetComponents have to be marked with Archetype::MarkChanged.
+/// Entities are identified by the sender's handles, an entity that loses all replicated components is destroyed on the
+/// receiver.
+class ReplicationEncoder : public ReplicationSchema
+{
+	World *world;
+	int capacity;
+
+	/// @brief Packets not yet acknowledged, oldest first, preceded by the acknowledged baseline if there is one.
+	std::deque<ReplicationState> states;
+	int64_t acknowledged;
+	int64_t nextSequence;
+
+	ReplicationState spare;
+
+	/// @brief Slot index -> whether the entity's components were copied by the current encode.
+	std::vector<char> copied;
+
+  public:
+	/// @param world sending world, has to outlive the encoder
+	/// @param components replicated components, at most 64, stored in archetypes and trivially copyable
+	/// @param capacity number of unacknowledged packets kept, acknowledgements of older packets are ignored
+	ReplicationEncoder(World &world, const ComponentMask &components, int capacity = 32);
+	ReplicationEncoder(const ReplicationEncoder &) = delete;
+	ReplicationEncoder &operator=(const ReplicationEncoder &) = delete;
+
+	/// @brief Writes a packet with the current state of the world. No iteration may be in progress. Starts a new change
+	/// tick of the world.
+	/// @param writer destination of the packet
+	/// @return sequence number of the packet
+	int64_t Encode(SnapshotWriter &writer);
+
+	/// @brief Makes a packet the baseline of the following packets, once the receiver has decoded it.
+	/// @param sequence sequence number returned by Encode
+	/// @return false if the packet is older than the current baseline or no longer kept
+	bool Acknowledge(int64_t sequence);
+
+	/// @brief Forgets the baseline, so the next packet holds the full state, for a receiver that starts over.
+	void Reset();
+
+	/// @brief Gets the sequence number of the baseline, -1 if no packet was acknowledged.
+	int64_t GetAcknowledged() const { return acknowledged; }
+};
+
+/// @brief Applies packets of a ReplicationEncoder to a world. Mirrored entities are created in the receiving world
+/// with handles of it's own, components that are not replicated can be added to them freely and are kept.
+class ReplicationDecoder : public ReplicationSchema
+{
+	World *world;
+	int capacity;
+
+	/// @brief Decoded packets that can still be baselines, oldest first, the newest is the state of the world.
+	std::deque<ReplicationState> states;
+
+	/// @brief Sender's slot index -> local entity.
+	std::vector<EntityHandle> entities;
+
+	ReplicationState spare;
+	std::vector<int> touched;
+	int maxSlotCount;
+
+  public:
+	/// @param world receiving world, has to outlive the decoder
+	/// @param components replicated components, the same as the encoder's
+	/// @param capacity number of decoded packets kept as possible baselines
+	/// @param maxSlotCount largest number of entity slots of the sender that is accepted, bounds the memory a malformed
+	/// packet can make the decoder allocate
+	ReplicationDecoder(World &world, const ComponentMask &components, int capacity = 32, int maxSlotCount = 1 << 22);
+	ReplicationDecoder(const ReplicationDecoder &) = delete;
+	ReplicationDecoder &operator=(const ReplicationDecoder &) = delete;
+
+	/// @brief Applies a packet to the world. No iteration may be in progress, written components are marked as changed.
+	/// @param reader bytes of a packet written by ReplicationEncoder::Encode
+	/// @return false if the packet is malformed, older than the last decoded one, has a different set of components,
+	/// more slots than maxSlotCount or it's baseline is no longer kept, the world is left untouched then
+	bool Decode(SnapshotReader &reader);
+
+	/// @brief Gets the sequence number of the last decoded packet, to be acknowledged to the encoder, -1 if none.
+	int64_t GetLastSequence() const { return states.empty() ? -1 : states.back().sequence; }
+
+	/// @brief Gets the local entity mirroring an entity of the sender.
+	/// @param remote handle in the sending world
+	/// @return local handle, null handle if the entity is not mirrored
+	EntityHandle GetLocalEntity(EntityHandle remote) const;
+
+  private:
+	/// @brief Brings a local entity from the previous state to the new one.
+	void Apply(int index, const ReplicationState *previous, const ReplicationState &state);
+};
+} // namespace ECS
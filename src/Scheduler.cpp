@@ -0,0 +1,49 @@
+#include "Scheduler.h"
+#include <memory>
+
+namespace ECS
+{
+int Scheduler::AddSystem(std::string name, std::function<void(World &)> run, const ComponentMask &reads,
+						 const ComponentMask &writes)
+{
+	int id = systems.size();
+	System system = {std::move(name), std::move(run), reads, writes, {}, 0, std::chrono::nanoseconds(0)};
+
+	for (int i = 0; i < id; i++)
+	{
+		System &other = systems[i];
+		if (other.writes.Intersects(system.reads) || other.writes.Intersects(system.writes) ||
+			system.writes.Intersects(other.reads))
+		{
+			other.successors.push_back(id);
+			system.dependencyCount++;
+		}
+	}
+
+	systems.push_back(std::move(system));
+	return id;
+}
+
+void Scheduler::Run(World &world)
+{
+	ThreadPool &pool = world.GetThreadPool();
+	ThreadPool::TaskGroup group;
+
+	std::unique_ptr<std::atomic<int>[]> remaining(new std::atomic<int>[systems.size()]);
+	for (int i = 0; i < systems.size(); i++) remaining[i] = systems[i].dependencyCount;
+
+	std::function<void(int)> runSystem = [&](int id) {
+		System &system = systems[id];
+		auto start = std::chrono::high_resolution_clock::now();
+		system.run(world);
+		system.lastRunTime = std::chrono::high_resolution_clock::now() - start;
+
+		for (int successor : system.successors)
+			if (--remaining[successor] == 0) pool.Submit([&runSystem, successor]() { runSystem(successor); }, group);
+	};
+
+	for (int i = 0; i < systems.size(); i++)
+		if (systems[i].dependencyCount == 0) pool.Submit([&runSystem, i]() { runSystem(i); }, group);
+	pool.Wait(group);
+}
+} // namespace ECS
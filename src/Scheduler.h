@@ -0,0 +1,102 @@
+#pragma once
+#include "ECS.h"
+#include <chrono>
+#include <optional>
+#include <string>
+
+namespace ECS
+{
+/// @brief Components a system only reads, they are passed to the system as spans of const components.
+template <ComponentDerived... T> struct Read
+{
+};
+
+/// @brief Components a system reads and writes.
+template <ComponentDerived... T> struct Write
+{
+};
+
+template <typename R, typename W, typename E> struct SystemAccess;
+
+/// @brief Unpacks access declarations of a system, and runs it over all chunks matching them.
+template <ComponentDerived... R, ComponentDerived... W, Excludion E> struct SystemAccess<Read<R...>, Write<W...>, E>
+{
+	typedef Query<E, R..., W...> SystemQuery;
+
+	static ComponentMask GetReadMask() { return ComponentMask::Of<R...>(); }
+	static ComponentMask GetWriteMask() { return ComponentMask::Of<W...>(); }
+
+	template <typename F> static void Run(SystemQuery &query, F &func)
+	{
+		auto ranges = query.GetComponentsArrays();
+		for (auto it = ranges.begin(); it != ranges.end(); ++it)
+		{
+			// Only written columns are stamped, systems reading the same component run concurrently.
+			it.template MarkChanged<W...>();
+			std::apply(
+				[&](std::span<EntityHandle> entities, std::span<R>... reads, std::span<W>... writes) {
+					func(entities, std::span<const R>(reads)..., writes...);
+				},
+				it.GetColumns());
+		}
+	}
+};
+
+/// @brief Runs systems with declared component access, executing systems that don't conflict concurrently.
+/// Two systems conflict if one of them writes a component the other reads or writes. Conflicting systems run in the
+/// order they were added in, which makes the dependency graph acyclic.
+class Scheduler
+{
+  public:
+	struct System
+	{
+		std::string name;
+		std::function<void(World &)> run;
+		ComponentMask reads;
+		ComponentMask writes;
+
+		/// @brief Systems that have to wait for this one to finish.
+		std::vector<int> successors;
+		int dependencyCount;
+
+		/// @brief Duration of the last execution of the system.
+		std::chrono::nanoseconds lastRunTime;
+	};
+
+  private:
+	std::vector<System> systems;
+
+  public:
+	/// @brief Adds a system, which is called with spans of every chunk storing all read and written components and
+	/// none of the excluded ones: func(std::span<EntityHandle>, std::span<const R>..., std::span<W>...).
+	/// Matching archetypes are cached in a Query owned by the system.
+	/// No structural changes are allowed inside a system.
+	/// @tparam R Read<...> components
+	/// @tparam W Write<...> components
+	/// @tparam E Exclude<...> components
+	/// @param name name of the system
+	/// @param func system function
+	/// @return index of the system
+	template <typename R, typename W = Write<>, typename E = Exclude<>, typename F>
+	int AddSystem(std::string name, F &&func)
+	{
+		typedef SystemAccess<R, W, E> Access;
+		auto run = [func = std::forward<F>(func), query = std::optional<typename Access::SystemQuery>()](
+					   World &world) mutable {
+			if (!query || &query->GetWorld() != &world) query.emplace(world);
+			Access::Run(*query, func);
+		};
+		return AddSystem(std::move(name), std::move(run), Access::GetReadMask(), Access::GetWriteMask());
+	}
+
+	/// @brief Runs all systems once on the world's thread pool, and waits for them to finish.
+	/// @param world world the systems operate on
+	void Run(World &world);
+
+	std::span<const System> GetSystems() const { return systems; }
+
+  private:
+	int AddSystem(std::string name, std::function<void(World &)> run, const ComponentMask &reads,
+				  const ComponentMask &writes);
+};
+} // namespace ECS
@@ -0,0 +1,721 @@
+#include "Snapshot.h"
+#include <cstring>
+#include <fstream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ECS
+{
+static constexpr char snapshotMagic[4] = {'E', 'C', 'S', 'S'};
+static constexpr uint32_t snapshotVersion = 1;
+
+/// @brief Describes a column or a sparse set in a snapshot.
+struct ColumnHeader
+{
+	uint64_t key;
+	uint32_t byteSize;
+
+	/// @brief 1 if components were written by their serialize hook, 0 if they are raw bytes.
+	uint32_t serialized;
+};
+
+void SnapshotWriter::Write(const void *data, size_t byteSize)
+{
+	if (byteSize == 0) return;
+	Reserve(byteSize);
+	memcpy(bytes.data() + byteCount, data, byteSize);
+	byteCount += byteSize;
+}
+
+void SnapshotWriter::Align(int alignment)
+{
+	size_t padding = (byteCount + alignment - 1) / alignment * alignment - byteCount;
+	Reserve(padding);
+	memset(bytes.data() + byteCount, 0, padding);
+	byteCount += padding;
+}
+
+bool SnapshotReader::Read(void *data, size_t byteSize)
+{
+	const char *source = View(byteSize);
+	if (!source)
+	{
+		memset(data, 0, byteSize);
+		return false;
+	}
+	memcpy(data, source, byteSize);
+	return true;
+}
+
+const char *SnapshotReader::View(size_t byteSize)
+{
+	if (failed || byteSize > bytes.size() - position)
+	{
+		failed = true;
+		return nullptr;
+	}
+
+	const char *data = bytes.data() + position;
+	position += byteSize;
+	return data;
+}
+
+void SnapshotReader::Align(int alignment)
+{
+	size_t aligned = (position + alignment - 1) / alignment * alignment;
+	if (aligned > bytes.size())
+		failed = true;
+	else
+		position = aligned;
+}
+
+/// @brief Calls func(data, first, count) for every run of entities in a range whose component, or a field of it if the
+/// component is split, is stored contiguously in a column.
+template <typename F>
+static void ForEachRun(Archetype &archetype, int componentID, int field, int begin, int end, F &&func)
+{
+	bool split = ComponentInfo::IsSplit(componentID);
+	int blockSize = split ? archetype.GetSplitBlockSize(componentID) : 0;
+	for (int first = begin; first < end;)
+	{
+		int position = archetype.chunkCapacity == 0 ? first : first % archetype.chunkCapacity;
+		int count = end - first;
+		if (archetype.chunkCapacity != 0) count = std::min(count, archetype.chunkCapacity - position);
+		if (split) count = std::min(count, blockSize - position % blockSize);
+
+		func(split ? archetype.GetField(componentID, first, field) : archetype.GetComponent(componentID, first),
+			 first - begin, count);
+		first += count;
+	}
+}
+
+static void WriteColumn(SnapshotWriter &writer, Archetype &archetype, int componentID)
+{
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	ComponentInfo::SerializerPtr serializer = ComponentInfo::GetSerializer(componentID);
+	bool raw = !serializer || ComponentInfo::IsSplit(componentID);
+	assert((!raw || ComponentInfo::IsTriviallyCopyable(componentID)) &&
+		   "Components that are not trivially copyable need a Serialize hook to be saved");
+
+	writer.Write(ColumnHeader{ComponentInfo::GetKey(componentID), (uint32_t)byteSize, !raw});
+	if (!raw)
+	{
+		for (int i = 0; i < archetype.entityCount; i++) serializer(archetype.GetComponent(componentID, i), writer);
+		return;
+	}
+
+	writer.Align(cacheLineSize);
+	if (!ComponentInfo::IsSplit(componentID))
+	{
+		ForEachRun(archetype, componentID, 0, 0, archetype.entityCount,
+				   [&](void *data, int first, int count) { writer.Write(data, (size_t)count * byteSize); });
+		return;
+	}
+
+	// Split components are written as whole fields, independently of the block size of the columns.
+	int fieldSize = ComponentInfo::GetFieldSize(componentID);
+	for (int field = 0; field < byteSize / fieldSize; field++)
+		ForEachRun(archetype, componentID, field, 0, archetype.entityCount,
+				   [&](void *data, int first, int count) { writer.Write(data, (size_t)count * fieldSize); });
+}
+
+/// @brief Constructs a column of all entities of an archetype from a snapshot, or from zeros if reader has failed.
+static void ReadColumn(SnapshotReader &reader, Archetype &archetype, int componentID, bool serialized)
+{
+	int byteSize = ComponentInfo::GetByteSize(componentID);
+	if (serialized)
+	{
+		ComponentInfo::DeserializerPtr deserializer = ComponentInfo::GetDeserializer(componentID);
+		for (int i = 0; i < archetype.entityCount; i++) deserializer(archetype.GetComponent(componentID, i), reader);
+		return;
+	}
+
+	reader.Align(cacheLineSize);
+	const char *data = reader.View((size_t)archetype.entityCount * byteSize);
+	int fieldSize = ComponentInfo::IsSplit(componentID) ? ComponentInfo::GetFieldSize(componentID) : byteSize;
+	for (int field = 0; field < byteSize / fieldSize; field++)
+	{
+		const char *fieldData = data ? data + (size_t)field * archetype.entityCount * fieldSize : nullptr;
+		ForEachRun(archetype, componentID, field, 0, archetype.entityCount, [&](void *destination, int first, int count) {
+			if (fieldData)
+				memcpy(destination, fieldData + (size_t)first * fieldSize, (size_t)count * fieldSize);
+			else
+				memset(destination, 0, (size_t)count * fieldSize);
+		});
+	}
+}
+
+/// @brief Checks whether a column of a snapshot can be loaded into a component.
+static bool IsCompatible(int componentID, const ColumnHeader &header)
+{
+	if (componentID == -1 || header.byteSize != (uint32_t)ComponentInfo::GetByteSize(componentID)) return false;
+	if (header.serialized) return ComponentInfo::GetDeserializer(componentID) && !ComponentInfo::IsSplit(componentID);
+	return ComponentInfo::IsTriviallyCopyable(componentID);
+}
+
+/// @brief Reads count handles, checking that they reference distinct entities of the restored registry.
+/// @param claimed scratch flags, one per registry slot, all false before and after the call
+static bool ReadEntities(SnapshotReader &reader, const World &world, uint32_t count, std::vector<EntityHandle> &entities,
+						 std::vector<bool> &claimed)
+{
+	const char *data = reader.View((size_t)count * sizeof(EntityHandle));
+	if (!data) return false;
+
+	entities.resize(count);
+	memcpy(entities.data(), data, (size_t)count * sizeof(EntityHandle));
+	bool valid = true;
+	int checked = 0;
+	for (; checked < entities.size() && valid; checked++)
+	{
+		EntityHandle entity = entities[checked];
+		valid = world.IsAlive(entity) && !claimed[entity.index];
+		if (valid) claimed[entity.index] = true;
+	}
+	for (int i = 0; i < checked; i++) claimed[entities[i].index] = false;
+	return valid;
+}
+
+void SaveSnapshot(World &world, SnapshotWriter &writer)
+{
+	writer.Write(snapshotMagic);
+	writer.Write(snapshotVersion);
+
+	std::span<const EntityRegistry::Slot> slots = world.GetRegistry().GetSlots();
+	std::span<const uint32_t> freeSlots = world.GetRegistry().GetFreeSlots();
+	writer.Write((uint32_t)slots.size());
+	for (const EntityRegistry::Slot &slot : slots) writer.Write(slot.generation);
+	writer.Write((uint32_t)freeSlots.size());
+	writer.Write(freeSlots.data(), freeSlots.size_bytes());
+
+	std::span<Archetype> archetypes = world.GetArchetypePool().GetArchetypes();
+	writer.Write((uint32_t)std::count_if(archetypes.begin(), archetypes.end(),
+										 [](const Archetype &archetype) { return archetype.entityCount != 0; }));
+	for (Archetype &archetype : archetypes)
+	{
+		if (archetype.entityCount == 0) continue;
+
+		writer.Write((uint32_t)archetype.mask.Count());
+		archetype.mask.ForEach([&](int componentID) { writer.Write(ComponentInfo::GetKey(componentID)); });
+		writer.Write((uint32_t)archetype.entityCount);
+		for (int chunk = 0; chunk < archetype.GetChunkCount(); chunk++)
+			writer.Write(archetype.GetEntities(chunk).data(), archetype.GetEntities(chunk).size_bytes());
+
+		writer.Write((uint32_t)archetype.denseComponentMap.size());
+		for (int componentID : archetype.denseComponentMap) WriteColumn(writer, archetype, componentID);
+	}
+
+	std::vector<SparseSet *> sparseSets;
+	for (int componentID = 0; componentID < ComponentInfo::GetCount(); componentID++)
+		if (ComponentInfo::IsSparse(componentID) && world.FindSparseSet(componentID))
+			sparseSets.push_back(world.FindSparseSet(componentID));
+
+	writer.Write((uint32_t)sparseSets.size());
+	for (SparseSet *sparseSet : sparseSets)
+	{
+		int componentID = sparseSet->GetComponentID();
+		int byteSize = ComponentInfo::GetByteSize(componentID);
+		ComponentInfo::SerializerPtr serializer = ComponentInfo::GetSerializer(componentID);
+		assert((serializer || ComponentInfo::IsTriviallyCopyable(componentID)) &&
+			   "Components that are not trivially copyable need a Serialize hook to be saved");
+
+		std::span<const EntityHandle> entities = sparseSet->GetEntities();
+		writer.Write(ColumnHeader{ComponentInfo::GetKey(componentID), (uint32_t)byteSize, serializer != nullptr});
+		writer.Write((uint32_t)entities.size());
+		writer.Write(entities.data(), entities.size_bytes());
+		if (byteSize == 0) continue;
+		for (EntityHandle entity : entities)
+		{
+			if (serializer)
+				serializer(sparseSet->Get(entity), writer);
+			else
+				writer.Write(sparseSet->Get(entity), byteSize);
+		}
+	}
+}
+
+bool SaveSnapshot(World &world, const std::string &path)
+{
+	SnapshotWriter writer;
+	SaveSnapshot(world, writer);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(writer.GetBytes().data(), writer.GetBytes().size());
+	return file.good();
+}
+
+bool LoadSnapshot(World &world, SnapshotReader &reader)
+{
+	EntityRegistry &registry = world.GetRegistry();
+	assert(registry.GetSlots().empty() && "Snapshots can only be loaded into a world without entities");
+
+	auto magic = reader.Read<std::array<char, 4>>();
+	if (memcmp(magic.data(), snapshotMagic, sizeof(snapshotMagic)) != 0) return false;
+	if (reader.Read<uint32_t>() != snapshotVersion) return false;
+
+	// Counts are checked against the remaining bytes before anything is allocated for them.
+	auto readIndices = [&](std::vector<uint32_t> &indices) {
+		uint32_t count = reader.Read<uint32_t>();
+		const char *data = reader.View((size_t)count * sizeof(uint32_t));
+		if (!data) return false;
+		indices.resize(count);
+		if (count != 0) memcpy(indices.data(), data, (size_t)count * sizeof(uint32_t));
+		return true;
+	};
+	std::vector<uint32_t> generations, freeSlots;
+	if (!readIndices(generations) || !readIndices(freeSlots)) return false;
+	for (uint32_t index : freeSlots)
+		if (index >= generations.size()) return false;
+	registry.Assign(generations, freeSlots);
+
+	std::vector<EntityHandle> entities;
+	std::vector<bool> claimed(generations.size(), false);
+	uint32_t archetypeCount = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < archetypeCount && !reader.Failed(); i++)
+	{
+		ComponentMask mask;
+		uint32_t componentCount = reader.Read<uint32_t>();
+		for (uint32_t j = 0; j < componentCount && !reader.Failed(); j++)
+		{
+			int componentID = ComponentInfo::FindByKey(reader.Read<uint64_t>());
+			if (componentID == -1 || ComponentInfo::IsSparse(componentID)) return false;
+			mask.Set(componentID);
+		}
+		uint32_t entityCount = reader.Read<uint32_t>();
+		if (reader.Failed() || mask.Empty() || !ReadEntities(reader, world, entityCount, entities, claimed))
+			return false;
+
+		ArchetypePool &archetypePool = world.GetArchetypePool();
+		Archetype *archetype = archetypePool.GetArchetype(mask);
+		if (!archetype) archetype = archetypePool.AddArchetype(mask);
+		if (archetype->entityCount != 0) return false;
+		for (EntityHandle entity : entities)
+			if (registry.GetSlot(entity).archetypeID != -1) return false;
+
+		// From here on every column has to be constructed, from zeros if the snapshot turns out to be malformed.
+		archetype->AllocateEntities(entities);
+		std::vector<bool> loaded(archetype->denseComponentMap.size(), false);
+		bool valid = reader.Read<uint32_t>() == archetype->denseComponentMap.size();
+		for (int j = 0; j < archetype->denseComponentMap.size() && valid; j++)
+		{
+			auto header = reader.Read<ColumnHeader>();
+			int componentID = ComponentInfo::FindByKey(header.key);
+			valid = IsCompatible(componentID, header) && archetype->columnIndex.Contains(componentID) &&
+					!loaded[archetype->columnIndex[componentID]] && !reader.Failed();
+			if (!valid) break;
+
+			ReadColumn(reader, *archetype, componentID, header.serialized);
+			loaded[archetype->columnIndex[componentID]] = true;
+		}
+
+		SnapshotReader empty(std::span<const char>{});
+		for (int column = 0; column < loaded.size(); column++)
+		{
+			int componentID = archetype->denseComponentMap[column];
+			if (!loaded[column])
+				ReadColumn(empty, *archetype, componentID,
+						   ComponentInfo::GetDeserializer(componentID) && !ComponentInfo::IsSplit(componentID));
+		}
+		if (!valid) return false;
+	}
+
+	uint32_t sparseSetCount = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < sparseSetCount && !reader.Failed(); i++)
+	{
+		auto header = reader.Read<ColumnHeader>();
+		int componentID = ComponentInfo::FindByKey(header.key);
+		uint32_t entityCount = reader.Read<uint32_t>();
+		if (!IsCompatible(componentID, header) || !ComponentInfo::IsSparse(componentID) ||
+			!ReadEntities(reader, world, entityCount, entities, claimed))
+			return false;
+
+		SparseSet &sparseSet = world.GetSparseSet(componentID);
+		for (EntityHandle entity : entities)
+			if (sparseSet.Contains(entity)) return false;
+
+		int byteSize = ComponentInfo::GetByteSize(componentID);
+		for (EntityHandle entity : entities)
+		{
+			void *component = sparseSet.Add(entity);
+			if (byteSize == 0) continue;
+			if (header.serialized)
+				ComponentInfo::GetDeserializer(componentID)(component, reader);
+			else
+				reader.Read(component, byteSize);
+		}
+	}
+	return !reader.Failed();
+}
+
+bool LoadSnapshot(World &world, const std::string &path)
+{
+#ifdef __linux__
+	int file = open(path.c_str(), O_RDONLY);
+	if (file == -1) return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED) return false;
+
+	madvise(data, status.st_size, MADV_SEQUENTIAL);
+	SnapshotReader reader(std::span<const char>((const char *)data, status.st_size));
+	bool loaded = LoadSnapshot(world, reader);
+	munmap(data, status.st_size);
+	return loaded;
+#else
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) return false;
+
+	std::vector<char> bytes(file.tellg());
+	file.seekg(0);
+	file.read(bytes.data(), bytes.size());
+	if (!file) return false;
+
+	SnapshotReader reader(bytes);
+	return LoadSnapshot(world, reader);
+#endif
+}
+
+/// @brief Gets the number of entities a chunk of an archetype holds when the archetype holds entityCount entities.
+static int GetChunkSize(const Archetype &archetype, int entityCount, int chunk)
+{
+	if (archetype.chunkCapacity == 0) return chunk == 0 ? entityCount : 0;
+	return std::clamp(entityCount - chunk * archetype.chunkCapacity, 0, archetype.chunkCapacity);
+}
+
+static int GetChunkCount(const Archetype &archetype, int entityCount)
+{
+	if (archetype.chunkCapacity == 0) return entityCount != 0;
+	return (entityCount + archetype.chunkCapacity - 1) / archetype.chunkCapacity;
+}
+
+/// @brief Checks whether any column of a chunk was written after a tick. Chunks of archetypes without columns have no
+/// ticks, so they always count as written.
+static bool IsChunkWritten(const Archetype &archetype, int chunk, uint64_t tick)
+{
+	const std::vector<uint64_t> &ticks = archetype.chunks[chunk].changedTicks;
+	return ticks.empty() || std::any_of(ticks.begin(), ticks.end(), [&](uint64_t changed) { return changed > tick; });
+}
+
+/// @brief Calls func(data, byteSize) for the entity handles and then every column of a chunk, in runs of contiguous
+/// bytes. Split components are visited field by field.
+template <typename F> static void ForEachChunkRun(Archetype &archetype, int chunk, F &&func)
+{
+	int size = archetype.GetChunkSize(chunk);
+	int begin = archetype.chunkCapacity * chunk;
+	func(archetype.GetEntities(chunk).data(), (size_t)size * sizeof(EntityHandle));
+	for (int componentID : archetype.denseComponentMap)
+	{
+		assert(ComponentInfo::IsTriviallyCopyable(componentID) && "Snapshot rings need trivially copyable components");
+		int byteSize = ComponentInfo::GetByteSize(componentID);
+		int fieldSize = ComponentInfo::IsSplit(componentID) ? ComponentInfo::GetFieldSize(componentID) : byteSize;
+		for (int field = 0; field < byteSize / fieldSize; field++)
+			ForEachRun(archetype, componentID, field, begin, begin + size,
+					   [&](void *data, int first, int count) { func(data, (size_t)count * fieldSize); });
+	}
+}
+
+SnapshotRing::SnapshotRing(World &world, int capacity)
+	: world(&world), capacity(capacity), removalCount(world.GetArchetypePool().GetRemovalCount())
+{
+	assert(capacity > 0 && "Snapshot ring has to keep at least one save");
+}
+
+int64_t SnapshotRing::Save()
+{
+	ArchetypePool &archetypePool = world->GetArchetypePool();
+	if (archetypePool.GetRemovalCount() != removalCount)
+	{
+		frames.clear();
+		removalCount = archetypePool.GetRemovalCount();
+	}
+
+	const Frame *previous = frames.empty() ? nullptr : &frames.back();
+	Frame frame = std::move(spare);
+	frame.number = previous ? previous->number + 1 : 0;
+	frame.tick = world->AdvanceChangeTick();
+	frame.entityCounts.clear();
+	frame.blocks.clear();
+	frame.bytes.clear();
+
+	std::span<Archetype> archetypes = archetypePool.GetArchetypes();
+	for (Archetype &archetype : archetypes)
+	{
+		int previousCount = 0;
+		if (previous && archetype.archetypeID < previous->entityCounts.size())
+			previousCount = previous->entityCounts[archetype.archetypeID];
+		frame.entityCounts.push_back(archetype.entityCount);
+
+		for (int chunk = 0; chunk < archetype.GetChunkCount(); chunk++)
+		{
+			if (previous && !IsChunkWritten(archetype, chunk, previous->tick) &&
+				GetChunkSize(archetype, previousCount, chunk) == archetype.GetChunkSize(chunk))
+				continue;
+
+			size_t offset = frame.bytes.size();
+			ForEachChunkRun(archetype, chunk, [&](void *data, size_t byteSize) {
+				frame.bytes.insert(frame.bytes.end(), (char *)data, (char *)data + byteSize);
+			});
+			frame.blocks.push_back({archetype.archetypeID, chunk, offset, frame.bytes.size() - offset});
+		}
+	}
+
+	EntityRegistry &registry = world->GetRegistry();
+	std::span<const EntityRegistry::Slot> slots = registry.GetSlots();
+	frame.registryVersion = registry.GetVersion();
+	frame.slotCount = slots.size();
+	frame.pages.clear();
+	frame.generations.clear();
+	for (int page = 0; page < registry.GetPageCount(); page++)
+	{
+		if (previous && registry.GetPageVersion(page) <= previous->registryVersion) continue;
+
+		int first = page * EntityRegistry::pageSize;
+		int count = std::min(EntityRegistry::pageSize, frame.slotCount - first);
+		frame.pages.push_back({page, frame.generations.size(), count});
+		for (int i = first; i < first + count; i++) frame.generations.push_back(slots[i].generation);
+	}
+	frame.hasFreeSlots = !previous || previous->registryVersion != frame.registryVersion;
+	frame.freeSlots.clear();
+	if (frame.hasFreeSlots) frame.freeSlots.assign(registry.GetFreeSlots().begin(), registry.GetFreeSlots().end());
+
+	frame.sparseBytes.clear();
+	auto writeSparse = [&](const void *data, size_t byteSize) {
+		frame.sparseBytes.insert(frame.sparseBytes.end(), (const char *)data, (const char *)data + byteSize);
+	};
+	for (int componentID = 0; componentID < ComponentInfo::GetCount(); componentID++)
+	{
+		SparseSet *sparseSet = ComponentInfo::IsSparse(componentID) ? world->FindSparseSet(componentID) : nullptr;
+		if (!sparseSet || sparseSet->GetEntities().empty()) continue;
+		assert(ComponentInfo::IsTriviallyCopyable(componentID) && "Snapshot rings need trivially copyable components");
+
+		std::span<const EntityHandle> entities = sparseSet->GetEntities();
+		int count = entities.size();
+		int byteSize = ComponentInfo::GetByteSize(componentID);
+		writeSparse(&componentID, sizeof(componentID));
+		writeSparse(&count, sizeof(count));
+		writeSparse(entities.data(), entities.size_bytes());
+		for (EntityHandle entity : entities)
+			if (byteSize != 0) writeSparse(sparseSet->Get(entity), byteSize);
+	}
+
+	if (frames.size() == capacity) DropOldest(frame);
+	frames.push_back(std::move(frame));
+	return frames.back().number;
+}
+
+void SnapshotRing::DropOldest(Frame &incoming)
+{
+	Frame &oldest = frames.front();
+	Frame &next = frames.size() > 1 ? frames[1] : incoming;
+	std::span<Archetype> archetypes = world->GetArchetypePool().GetArchetypes();
+
+	// Chunks not saved again since the oldest save move to the next one, unless they are empty in it.
+	auto key = [](const Block &block) { return std::pair(block.archetypeID, block.chunk); };
+	std::vector<Block> blocks;
+	blocks.reserve(oldest.blocks.size() + next.blocks.size());
+	auto newer = next.blocks.begin();
+	for (const Block &block : oldest.blocks)
+	{
+		while (newer != next.blocks.end() && key(*newer) < key(block)) blocks.push_back(*newer++);
+		if (newer != next.blocks.end() && key(*newer) == key(block)) continue;
+		if (block.chunk >= GetChunkCount(archetypes[block.archetypeID], next.entityCounts[block.archetypeID])) continue;
+
+		blocks.push_back({block.archetypeID, block.chunk, next.bytes.size(), block.byteSize});
+		next.bytes.insert(next.bytes.end(), oldest.bytes.begin() + block.offset,
+						  oldest.bytes.begin() + block.offset + block.byteSize);
+	}
+	blocks.insert(blocks.end(), newer, next.blocks.end());
+	next.blocks = std::move(blocks);
+
+	std::vector<SlotPage> pages;
+	auto newerPage = next.pages.begin();
+	for (const SlotPage &page : oldest.pages)
+	{
+		while (newerPage != next.pages.end() && newerPage->page < page.page) pages.push_back(*newerPage++);
+		if (newerPage != next.pages.end() && newerPage->page == page.page) continue;
+		if (page.page * EntityRegistry::pageSize >= next.slotCount) continue;
+
+		pages.push_back({page.page, next.generations.size(), page.count});
+		next.generations.insert(next.generations.end(), oldest.generations.begin() + page.offset,
+								oldest.generations.begin() + page.offset + page.count);
+	}
+	pages.insert(pages.end(), newerPage, next.pages.end());
+	next.pages = std::move(pages);
+
+	if (!next.hasFreeSlots)
+	{
+		next.hasFreeSlots = true;
+		std::swap(next.freeSlots, oldest.freeSlots);
+	}
+
+	spare = std::move(oldest);
+	frames.pop_front();
+}
+
+const char *SnapshotRing::FindBlock(int frameIndex, int archetypeID, int chunk) const
+{
+	for (int i = frameIndex; i >= 0; i--)
+	{
+		const std::vector<Block> &blocks = frames[i].blocks;
+		auto it = std::lower_bound(blocks.begin(), blocks.end(), std::pair(archetypeID, chunk),
+								   [](const Block &block, std::pair<int, int> key) {
+									   return std::pair(block.archetypeID, block.chunk) < key;
+								   });
+		if (it != blocks.end() && it->archetypeID == archetypeID && it->chunk == chunk)
+			return frames[i].bytes.data() + it->offset;
+	}
+	return nullptr;
+}
+
+const uint32_t *SnapshotRing::FindPage(int frameIndex, int page) const
+{
+	for (int i = frameIndex; i >= 0; i--)
+	{
+		const std::vector<SlotPage> &pages = frames[i].pages;
+		auto it = std::lower_bound(pages.begin(), pages.end(), page,
+								   [](const SlotPage &slotPage, int page) { return slotPage.page < page; });
+		if (it != pages.end() && it->page == page) return frames[i].generations.data() + it->offset;
+	}
+	return nullptr;
+}
+
+bool SnapshotRing::Restore(int64_t number)
+{
+	ArchetypePool &archetypePool = world->GetArchetypePool();
+	if (frames.empty() || number < frames.front().number || number > frames.back().number ||
+		archetypePool.GetRemovalCount() != removalCount)
+		return false;
+
+	int frameIndex = number - frames.front().number;
+	const Frame &frame = frames[frameIndex];
+	EntityRegistry &registry = world->GetRegistry();
+	std::span<Archetype> archetypes = archetypePool.GetArchetypes();
+	auto getSavedCount = [&](const Archetype &archetype) {
+		return archetype.archetypeID < frame.entityCounts.size() ? frame.entityCounts[archetype.archetypeID] : 0;
+	};
+
+	// Chunks not written since the save hold the same entities at the same positions. Entities of all other chunks
+	// leave their archetype, those in restored chunks get their slots back once the chunks are copied.
+	std::vector<std::pair<int, int>> restored;
+	for (Archetype &archetype : archetypes)
+	{
+		int savedCount = getSavedCount(archetype);
+		for (int chunk = 0; chunk < std::max(archetype.GetChunkCount(), GetChunkCount(archetype, savedCount)); chunk++)
+		{
+			int savedSize = GetChunkSize(archetype, savedCount, chunk);
+			int size = GetChunkSize(archetype, archetype.entityCount, chunk);
+			if (savedSize == size && (size == 0 || !IsChunkWritten(archetype, chunk, frame.tick))) continue;
+
+			if (size != 0)
+				for (EntityHandle entity : archetype.GetEntities(chunk)) registry.GetSlot(entity).archetypeID = -1;
+			if (savedSize != 0) restored.emplace_back(archetype.archetypeID, chunk);
+		}
+	}
+
+	// Pages of slots not changed since the save are taken from the registry itself.
+	if (registry.GetVersion() != frame.registryVersion)
+	{
+		std::span<const EntityRegistry::Slot> slots = registry.GetSlots();
+		std::vector<uint32_t> generations(frame.slotCount);
+		for (int page = 0; page * EntityRegistry::pageSize < frame.slotCount; page++)
+		{
+			int first = page * EntityRegistry::pageSize;
+			int count = std::min(EntityRegistry::pageSize, frame.slotCount - first);
+			if (page < registry.GetPageCount() && registry.GetPageVersion(page) <= frame.registryVersion)
+			{
+				for (int i = first; i < first + count; i++) generations[i] = slots[i].generation;
+				continue;
+			}
+
+			const uint32_t *saved = FindPage(frameIndex, page);
+			assert(saved && "Snapshot ring lost a page of entity slots");
+			std::copy(saved, saved + count, generations.begin() + first);
+		}
+
+		int i = frameIndex;
+		while (!frames[i].hasFreeSlots) i--;
+		registry.Assign(generations, frames[i].freeSlots);
+	}
+
+	for (Archetype &archetype : archetypes)
+	{
+		int savedCount = getSavedCount(archetype);
+		if (savedCount > archetype.entityCapacity) archetype.Reserve(savedCount);
+		archetype.entityCount = savedCount;
+	}
+
+	for (auto [archetypeID, chunk] : restored)
+	{
+		Archetype &archetype = archetypes[archetypeID];
+		const char *data = FindBlock(frameIndex, archetypeID, chunk);
+		assert(data && "Snapshot ring lost a chunk");
+		ForEachChunkRun(archetype, chunk, [&](void *destination, size_t byteSize) {
+			memcpy(destination, data, byteSize);
+			data += byteSize;
+		});
+
+		int first = chunk * archetype.chunkCapacity;
+		std::span<EntityHandle> entities = archetype.GetEntities(chunk);
+		for (int i = 0; i < entities.size(); i++)
+		{
+			EntityRegistry::Slot &slot = registry.GetSlot(entities[i]);
+			slot.archetypeID = archetypeID;
+			slot.index = first + i;
+		}
+		archetype.MarkEntitiesChanged(first, entities.size());
+	}
+
+	for (int componentID = 0; componentID < ComponentInfo::GetCount(); componentID++)
+	{
+		SparseSet *sparseSet = ComponentInfo::IsSparse(componentID) ? world->FindSparseSet(componentID) : nullptr;
+		if (!sparseSet) continue;
+		std::vector<EntityHandle> entities(sparseSet->GetEntities().begin(), sparseSet->GetEntities().end());
+		for (EntityHandle entity : entities) sparseSet->Remove(entity);
+	}
+	for (const char *data = frame.sparseBytes.data(); data != frame.sparseBytes.data() + frame.sparseBytes.size();)
+	{
+		int componentID, count;
+		memcpy(&componentID, data, sizeof(componentID));
+		memcpy(&count, data + sizeof(componentID), sizeof(count));
+		data += sizeof(componentID) + sizeof(count);
+
+		std::vector<EntityHandle> entities(count);
+		memcpy(entities.data(), data, count * sizeof(EntityHandle));
+		data += count * sizeof(EntityHandle);
+
+		SparseSet &sparseSet = world->GetSparseSet(componentID);
+		int byteSize = ComponentInfo::GetByteSize(componentID);
+		for (EntityHandle entity : entities)
+		{
+			void *component = sparseSet.Add(entity);
+			memcpy(component, data, byteSize);
+			data += byteSize;
+		}
+	}
+
+	frames.erase(frames.begin() + frameIndex + 1, frames.end());
+	return true;
+}
+
+size_t SnapshotRing::GetByteSize() const
+{
+	size_t byteSize = 0;
+	for (const Frame &frame : frames)
+		byteSize += frame.bytes.size() + frame.blocks.size() * sizeof(Block) +
+					frame.pages.size() * sizeof(SlotPage) +
+					(frame.generations.size() + frame.freeSlots.size()) * sizeof(uint32_t) + frame.sparseBytes.size();
+	return byteSize;
+}
+} // namespace ECS
@@ -0,0 +1,235 @@
+#pragma once
+#include "ECS.h"
+#include <deque>
+#include <string>
+
+namespace ECS
+{
+/// @brief Growing buffer a snapshot is written into, passed to serialize hooks of SerializableComponents.
+class SnapshotWriter
+{
+	/// @brief Buffer grown ahead of the writes, only the first byteCount bytes are written.
+	std::vector<char> bytes;
+	size_t byteCount = 0;
+
+	/// @brief Makes space for byteSize more bytes.
+	void Reserve(size_t byteSize)
+	{
+		if (bytes.size() - byteCount < byteSize) bytes.resize(std::max(bytes.size() * 2, byteCount + byteSize));
+	}
+
+  public:
+	/// @brief Appends raw bytes.
+	/// @param data pointer to the bytes
+	/// @param byteSize number of bytes
+	void Write(const void *data, size_t byteSize);
+
+	/// @brief Appends a trivially copyable value as it's bytes.
+	template <typename T> void Write(const T &value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be written as bytes");
+		Write(&value, sizeof(T));
+	}
+
+	/// @brief Appends an unsigned integer in 7 bit groups, low groups first, so small values take a single byte.
+	void WriteVarint(uint64_t value)
+	{
+		Reserve(10);
+		char *begin = bytes.data() + byteCount, *end = begin;
+		for (; value >= 0x80; value >>= 7) *end++ = char(value | 0x80);
+		*end++ = char(value);
+		byteCount += end - begin;
+	}
+
+	/// @brief Appends zeros until the number of written bytes is a multiple of alignment.
+	void Align(int alignment);
+
+	/// @brief Gets all written bytes.
+	std::span<const char> GetBytes() const { return std::span(bytes.data(), byteCount); }
+
+	/// @brief Removes all written bytes, keeping the buffer's memory.
+	void Clear() { byteCount = 0; }
+};
+
+/// @brief Cursor over the bytes of a snapshot, passed to deserialize hooks of SerializableComponents. Reading past the
+/// end yields zeros and marks the reader as failed, so hooks don't have to check every read.
+class SnapshotReader
+{
+	std::span<const char> bytes;
+	size_t position;
+	bool failed;
+
+  public:
+	/// @param bytes bytes of the snapshot, have to outlive the reader
+	SnapshotReader(std::span<const char> bytes) : bytes(bytes), position(0), failed(false) {}
+
+	/// @brief Reads raw bytes.
+	/// @param data destination of the bytes, zeroed if there are not enough bytes left
+	/// @param byteSize number of bytes
+	/// @return false if there were not enough bytes left
+	bool Read(void *data, size_t byteSize);
+
+	/// @brief Reads a trivially copyable value written by SnapshotWriter::Write.
+	template <typename T> T Read()
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be read as bytes");
+		std::array<char, sizeof(T)> value;
+		Read(value.data(), sizeof(T));
+		return std::bit_cast<T>(value);
+	}
+
+	/// @brief Reads an integer written by SnapshotWriter::WriteVarint.
+	/// @return the integer, 0 if it is truncated or longer than 64 bits
+	uint64_t ReadVarint()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64 && !failed && position < bytes.size(); shift += 7)
+		{
+			uint8_t byte = bytes[position++];
+			value |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return value;
+		}
+		failed = true;
+		return 0;
+	}
+
+	/// @brief Skips bytes, returning a pointer to them so they can be used without copying.
+	/// @param byteSize number of bytes
+	/// @return pointer to the bytes, nullptr if there are not enough bytes left
+	const char *View(size_t byteSize);
+
+	/// @brief Skips bytes until the position is a multiple of alignment.
+	void Align(int alignment);
+
+	/// @brief Checks whether a read went past the end.
+	bool Failed() const { return failed; }
+};
+
+/// @brief Writes all entities of a world, their components and the handles referencing them.
+/// Every archetype is written as a list of component keys, see ComponentInfo::GetKey, followed by it's columns, each a
+/// single block aligned to cacheLineSize. Columns of trivially copyable components are copied chunk by chunk, split
+/// components are written field by field. SerializableComponents are written by their Serialize hook, all other
+/// components have to be trivially copyable. Bytes are in the native byte order and layout of the components.
+/// @param world saved world, no iteration may be in progress
+/// @param writer destination of the snapshot
+void SaveSnapshot(World &world, SnapshotWriter &writer);
+
+/// @brief Writes a snapshot of a world to a file.
+/// @param world saved world, no iteration may be in progress
+/// @param path path of the file, replaced if it exists
+/// @return false if the file couldn't be written
+bool SaveSnapshot(World &world, const std::string &path);
+
+/// @brief Restores a snapshot into a world without entities, handles from the saved world stay valid in it.
+/// Components are matched by their keys, so the loading program may register them in a different order. Columns of
+/// trivially copyable components are copied in runs as long as a chunk, without any per entity work.
+/// @param world empty world, keeps it's chunk byte size
+/// @param reader snapshot written by SaveSnapshot
+/// @return false if the snapshot is malformed, or has a component that is not registered or has a different size. The
+/// world is left with what was loaded before the failure, components of a partially loaded archetype are zeroed.
+bool LoadSnapshot(World &world, SnapshotReader &reader);
+
+/// @brief Restores a snapshot file into a world without entities. The file is memory mapped, so columns are copied
+/// straight from the page cache.
+/// @param world empty world
+/// @param path path of a file written by SaveSnapshot
+/// @return false if the file couldn't be read or the snapshot is malformed
+bool LoadSnapshot(World &world, const std::string &path);
+
+/// @brief Ring of the last few states of a world, for rollback and replay. Every Save copies only the chunks written,
+/// filled or emptied since the previous save, found by their change ticks, so saving a world where few entities change
+/// costs little. The world can be restored in place to any saved state in the ring, only chunks that differ from it are
+/// copied back. Sparse sets are small by design and are copied whole.
+/// Saves keep the newest copy of every chunk, and the oldest save holds copies of all chunks not written since, so
+/// memory is bounded by one copy of the world plus the chunks written during the last capacity saves.
+/// All components have to be trivially copyable. Archetypes must not be removed while the ring is used, if
+/// World::Trim removes some, the ring starts over with the next save.
+class SnapshotRing
+{
+	/// @brief Copy of a chunk, entity handles followed by every column, split components field by field.
+	struct Block
+	{
+		int archetypeID;
+		int chunk;
+		size_t offset;
+		size_t byteSize;
+	};
+
+	/// @brief Copy of generations of a page of entity slots.
+	struct SlotPage
+	{
+		int page;
+		size_t offset;
+		int count;
+	};
+
+	struct Frame
+	{
+		int64_t number;
+
+		/// @brief Change tick ended by the save, chunks written afterwards have a greater tick.
+		uint64_t tick;
+		std::vector<int> entityCounts;
+
+		/// @brief Copies of chunks that changed since the previous save, sorted by archetype and chunk.
+		std::vector<Block> blocks;
+		std::vector<char> bytes;
+
+		/// @brief Pages of slots changed since the previous save, and free slots if any entity was created or destroyed.
+		uint64_t registryVersion;
+		int slotCount;
+		std::vector<SlotPage> pages;
+		std::vector<uint32_t> generations;
+		bool hasFreeSlots;
+		std::vector<uint32_t> freeSlots;
+
+		std::vector<char> sparseBytes;
+	};
+
+	World *world;
+	int capacity;
+	std::deque<Frame> frames;
+	size_t removalCount;
+
+	/// @brief Storage of the last dropped frame, reused by the next save.
+	Frame spare;
+
+  public:
+	/// @param world saved world, has to outlive the ring
+	/// @param capacity number of saves kept
+	SnapshotRing(World &world, int capacity);
+	SnapshotRing(const SnapshotRing &) = delete;
+	SnapshotRing &operator=(const SnapshotRing &) = delete;
+
+	/// @brief Saves the current state of the world, dropping the oldest save if the ring is full. No iteration may be in
+	/// progress. Starts a new change tick of the world.
+	/// @return number of the save, one more than the number of the previous save
+	int64_t Save();
+
+	/// @brief Restores the world to a saved state, and drops all saves made after it, so the next save gets the number
+	/// following it. Handles of entities alive at the save become valid again. No iteration may be in progress, restored
+	/// chunks are marked as changed.
+	/// @param number number returned by Save
+	/// @return false if the save is no longer in the ring
+	bool Restore(int64_t number);
+
+	/// @brief Drops all saves.
+	void Clear() { frames.clear(); }
+
+	/// @brief Gets the number of saves in the ring.
+	int GetFrameCount() const { return frames.size(); }
+
+	/// @brief Gets the number of the newest save, -1 if the ring is empty.
+	int64_t GetLastFrame() const { return frames.empty() ? -1 : frames.back().number; }
+
+	/// @brief Gets the number of bytes of copied chunks, entity slots and sparse sets held by the ring.
+	size_t GetByteSize() const;
+
+  private:
+	/// @brief Moves chunks of the oldest save that are still needed into the save after it, which is incoming if the
+	/// ring holds a single save.
+	void DropOldest(Frame &incoming);
+	const char *FindBlock(int frameIndex, int archetypeID, int chunk) const;
+	const uint32_t *FindPage(int frameIndex, int page) const;
+};
+} // namespace ECS
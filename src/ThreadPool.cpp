@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace ECS
+{
+thread_local ThreadPool *ThreadPool::currentPool = nullptr;
+thread_local int ThreadPool::currentWorker = -1;
+
+ThreadPool::ThreadPool(int threadCount) : queuedTasks(0), nextQueue(0), stopping(false)
+{
+	threadCount = std::max(threadCount, 0);
+	for (int i = 0; i < std::max(threadCount, 1); i++) queues.push_back(std::make_unique<Queue>());
+	for (int i = 0; i < threadCount; i++) threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (auto &thread : threads) thread.join();
+}
+
+ThreadPool &ThreadPool::GetDefault()
+{
+	static ThreadPool pool((int)std::thread::hardware_concurrency() - 1);
+	return pool;
+}
+
+void ThreadPool::Submit(Task task, TaskGroup &group)
+{
+	group.pending++;
+
+	int queue = currentPool == this ? currentWorker : nextQueue++ % queues.size();
+	{
+		std::lock_guard lock(queues[queue]->mutex);
+		queues[queue]->tasks.push_back({std::move(task), &group});
+	}
+	{
+		std::lock_guard lock(sleepMutex);
+		queuedTasks++;
+	}
+	wakeUp.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup &group)
+{
+	int worker = currentPool == this ? currentWorker : -1;
+	while (group.pending.load() != 0)
+		if (!TryRunTask(worker)) std::this_thread::yield();
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)> &func)
+{
+	TaskGroup group;
+	for (int i = 0; i < count; i++) Submit([&func, i]() { func(i); }, group);
+	Wait(group);
+}
+
+bool ThreadPool::TryRunTask(int worker)
+{
+	QueuedTask task;
+	bool found = false;
+
+	if (worker != -1)
+	{
+		std::lock_guard lock(queues[worker]->mutex);
+		if (!queues[worker]->tasks.empty())
+		{
+			task = std::move(queues[worker]->tasks.front());
+			queues[worker]->tasks.pop_front();
+			found = true;
+		}
+	}
+
+	int start = worker == -1 ? 0 : worker + 1;
+	for (int i = 0; i < queues.size() && !found; i++)
+	{
+		Queue &victim = *queues[(start + i) % queues.size()];
+		std::lock_guard lock(victim.mutex);
+		if (victim.tasks.empty()) continue;
+
+		task = std::move(victim.tasks.back());
+		victim.tasks.pop_back();
+		found = true;
+	}
+
+	if (!found) return false;
+
+	queuedTasks--;
+	task.task();
+	task.group->pending--;
+	return true;
+}
+
+void ThreadPool::WorkerLoop(int worker)
+{
+	currentPool = this;
+	currentWorker = worker;
+
+	while (true)
+	{
+		if (TryRunTask(worker)) continue;
+
+		std::unique_lock lock(sleepMutex);
+		wakeUp.wait(lock, [this]() { return stopping || queuedTasks.load() > 0; });
+		if (stopping) return;
+	}
+}
+} // namespace ECS
@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ECS
+{
+/// @brief Work stealing thread pool.
+/// Every worker has it's own task queue, it takes tasks from the front of it's queue and steals from the back of other
+/// workers' queues when it runs out. Threads waiting for tasks help executing them, so a pool without worker threads
+/// still works, running everything on the waiting thread.
+class ThreadPool
+{
+  public:
+	typedef std::function<void()> Task;
+
+	/// @brief Counter of unfinished tasks, used to wait for a group of submitted tasks.
+	class TaskGroup
+	{
+		std::atomic<int> pending = 0;
+
+		friend ThreadPool;
+	};
+
+  private:
+	struct QueuedTask
+	{
+		Task task;
+		TaskGroup *group;
+	};
+
+	struct Queue
+	{
+		std::deque<QueuedTask> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<int> queuedTasks;
+	std::atomic<unsigned> nextQueue;
+	bool stopping;
+
+	static thread_local ThreadPool *currentPool;
+	static thread_local int currentWorker;
+
+  public:
+	/// @brief Creates a pool and starts it's worker threads.
+	/// @param threadCount number of worker threads, the thread waiting for tasks works as an additional one
+	ThreadPool(int threadCount);
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+	~ThreadPool();
+
+	/// @brief Gets the pool owned by the library, with a worker for every hardware thread except the calling one.
+	static ThreadPool &GetDefault();
+
+	/// @brief Gets the number of threads executing tasks, including the waiting thread.
+	int GetThreadCount() const { return threads.size() + 1; }
+
+	/// @brief Queues a task, tasks submitted from a worker go to that worker's queue.
+	/// @param task task to be executed
+	/// @param group group the task belongs to
+	void Submit(Task task, TaskGroup &group);
+
+	/// @brief Blocks until all tasks of a group finish, executing queued tasks in the meantime.
+	/// @param group group to wait for
+	void Wait(TaskGroup &group);
+
+	/// @brief Calls func(i) for every i in [0, count) in parallel, and waits for all calls to finish.
+	/// @param count number of calls
+	/// @param func function to be called
+	void ParallelFor(int count, const std::function<void(int)> &func);
+
+  private:
+	bool TryRunTask(int worker);
+	void WorkerLoop(int worker);
+};
+} // namespace ECS
@@ -0,0 +1,631 @@
+#include "ECS.h"
+#include "Replication.h"
+#include "Scheduler.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std::chrono;
+using namespace ECS;
+
+// Microbenchmarks of the ECS, every benchmark reports it's warm-up average, median, p90, p99 and min in nanoseconds per
+// entity, or per query for the query benchmarks. Timings depend on the machine and the build, so a baseline is only
+// meaningful on the machine and build type it was recorded with. To check for regressions, record one from an
+// optimized build before a change and compare against it after:
+//   ECSBench --json baseline.json
+//   ECSBench --baseline baseline.json
+// Runs compared against a baseline fail if a median is slower than the baseline's by more than --tolerance. Builds
+// define ECS_BENCH_BASELINE, a baseline in the build directory: runs given neither --json nor --baseline compare
+// against it, or record it if it doesn't exist yet and no --filter is given.
+// Some benchmarks also report metrics after their times, like the packet size of replication, which don't depend on
+// the machine and aren't compared.
+
+struct Position : public Component<Position> {
+    float x, y, z;
+    Position(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z) {}
+};
+
+struct Velocity : public Component<Velocity> {
+    float x, y, z;
+    Velocity(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z) {}
+};
+
+struct Acceleration : public Component<Acceleration> {
+    float x, y, z;
+    Acceleration(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z) {}
+};
+
+struct Mass : public Component<Mass> {
+    float value;
+    Mass(float value = 1) : value(value) {}
+};
+
+struct Frozen : public Component<Frozen> {};
+
+struct SplitBody : public Component<SplitBody> {
+    using SplitField = float;
+    static constexpr int splitBlockSize = 8;
+    enum Fields { X, Y, Z, VX, VY, VZ };
+    float x, y, z, vx, vy, vz;
+    SplitBody(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z), vx(1), vy(1), vz(1) {}
+};
+
+template <int N> struct Marker : public Component<Marker<N>> {
+    int value = N;
+};
+
+/// @brief Named values a benchmark reports besides it's times, like bytes per tick.
+using Metrics = std::vector<std::pair<std::string, double>>;
+
+/// @brief Timed operation, run once per sample on operationCount entities, or queries. Setup runs before every sample and
+/// is not timed, so destructive operations start from the same state. Metrics, if any, are read after the last sample.
+struct Benchmark {
+    std::string name;
+    int operationCount;
+    std::function<void()> setup;
+    std::function<void()> run;
+    std::function<Metrics()> metrics;
+};
+
+/// @brief Times of a benchmark in nanoseconds per entity, or query.
+struct Result {
+    std::string name;
+    int samples;
+    double warmup, median, p90, p99, min;
+    Metrics metrics;
+};
+
+struct Options {
+    int warmupCount = 5;
+    int sampleCount = 51;
+    int entityCount = 16 * 1024;
+    double tolerance = 0.25;
+    std::string filter;
+    std::string jsonPath;
+    std::string baselinePath;
+};
+
+static Result Measure(const Benchmark &benchmark, const Options &options) {
+    auto sample = [&]() {
+        if (benchmark.setup) benchmark.setup();
+        auto start = steady_clock::now();
+        benchmark.run();
+        auto end = steady_clock::now();
+        return duration<double, std::nano>(end - start).count() / benchmark.operationCount;
+    };
+
+    double warmup = 0;
+    for (int i = 0; i < options.warmupCount; i++) warmup += sample();
+
+    std::vector<double> samples;
+    for (int i = 0; i < options.sampleCount; i++) samples.push_back(sample());
+    std::sort(samples.begin(), samples.end());
+
+    // Nearest rank percentiles.
+    auto percentile = [&](double p) { return samples[std::max<int>(std::ceil(p * samples.size()) - 1, 0)]; };
+    return {benchmark.name,       options.sampleCount, warmup / std::max(options.warmupCount, 1),
+            percentile(0.5),      percentile(0.9),     percentile(0.99),
+            samples.front(),      benchmark.metrics ? benchmark.metrics() : Metrics()};
+}
+
+/// @brief Adds benchmarks of split components, parallel iteration, trimming, allocators, change filters, snapshots,
+/// replication and query caching.
+static void AddFeatureBenchmarks(std::vector<Benchmark> &benchmarks, int entityCount) {
+    // Plain arrays, the reference iterate_2 is compared to.
+    auto raw = std::make_shared<std::pair<std::vector<Position>, std::vector<Velocity>>>();
+    for (int i = 0; i < entityCount; i++) {
+        raw->first.push_back(Position(i, i, i));
+        raw->second.push_back(Velocity(1, 1, 1));
+    }
+    benchmarks.push_back({"iterate_raw", entityCount, nullptr, [=]() {
+                              Position *p = raw->first.data();
+                              Velocity *v = raw->second.data();
+                              for (int i = 0; i < entityCount; i++) {
+                                  p[i].x += v[i].x;
+                                  p[i].y += v[i].y;
+                                  p[i].z += v[i].z;
+                              }
+                          }});
+
+    auto splitWorld = std::make_shared<World>();
+    splitWorld->SpawnBatch<SplitBody>(entityCount, [](int i) { return SplitBody(i, i, i); });
+    benchmarks.push_back({"iterate_split", entityCount, nullptr, [=]() {
+                              for (auto &&[e, bodies] : splitWorld->GetComponentsArrays<SplitBody>()) {
+                                  for (size_t block = 0; block < bodies.GetBlockCount(); block++) {
+                                      float *x = bodies.GetBlock(block, SplitBody::X);
+                                      float *y = bodies.GetBlock(block, SplitBody::Y);
+                                      float *z = bodies.GetBlock(block, SplitBody::Z);
+                                      float *vx = bodies.GetBlock(block, SplitBody::VX);
+                                      float *vy = bodies.GetBlock(block, SplitBody::VY);
+                                      float *vz = bodies.GetBlock(block, SplitBody::VZ);
+                                      for (int i = 0; i < SplitBody::splitBlockSize; i++) {
+                                          x[i] += vx[i];
+                                          y[i] += vy[i];
+                                          z[i] += vz[i];
+                                      }
+                                  }
+                              }
+                          }});
+
+    auto parallelWorld = std::make_shared<World>();
+    parallelWorld->SpawnBatch<Position, Velocity>(
+        entityCount, [](int i) { return std::tuple(Position(i, i, i), Velocity(1, 1, 1)); });
+    benchmarks.push_back({"iterate_parallel", entityCount, nullptr, [=]() {
+                              parallelWorld->ParallelForEach<Position, Velocity>(
+                                  [](EntityHandle e, Position &p, Velocity &v) {
+                                      p.x += v.x;
+                                      p.y += v.y;
+                                      p.z += v.z;
+                                  });
+                          }});
+
+    // Run times of the individual systems are those of the last sample.
+    struct ScheduledWorld {
+        World world;
+        Scheduler scheduler;
+    };
+    auto scheduled = std::make_shared<ScheduledWorld>();
+    scheduled->world.SpawnBatch<Position, Velocity, Acceleration, Mass>(entityCount, [](int i) {
+        return std::tuple(Position(i, i, i), Velocity(1, 1, 1), Acceleration(0, -1, 0), Mass(2));
+    });
+    scheduled->scheduler.AddSystem<Read<Acceleration, Mass>, Write<Velocity>>(
+        "Accelerate", [](std::span<EntityHandle> e, std::span<const Acceleration> accelerations,
+                         std::span<const Mass> masses, std::span<Velocity> velocities) {
+            for (size_t i = 0; i < velocities.size(); i++) velocities[i].y += accelerations[i].y / masses[i].value;
+        });
+    scheduled->scheduler.AddSystem<Read<Velocity>, Write<Position>>(
+        "Move", [](std::span<EntityHandle> e, std::span<const Velocity> velocities, std::span<Position> positions) {
+            for (size_t i = 0; i < positions.size(); i++) positions[i].y += velocities[i].y;
+        });
+    scheduled->scheduler.AddSystem<Read<>, Write<Mass>>("Grow", [](std::span<EntityHandle> e, std::span<Mass> masses) {
+        for (Mass &mass : masses) mass.value += 1;
+    });
+    benchmarks.push_back({"schedule", entityCount, nullptr, [=]() { scheduled->scheduler.Run(scheduled->world); },
+                          [=]() {
+                              Metrics metrics;
+                              for (const Scheduler::System &system : scheduled->scheduler.GetSystems())
+                                  metrics.push_back(
+                                      {system.name + ".lastRunTimeNs", (double)system.lastRunTime.count()});
+                              return metrics;
+                          }});
+
+    // A spike of twice the entities, of which all but a few are destroyed before compacting.
+    auto trimWorld = std::make_shared<std::unique_ptr<World>>();
+    auto reclaimed = std::make_shared<size_t>(0);
+    benchmarks.push_back({"compact", 2 * entityCount,
+                          [=]() {
+                              *trimWorld = std::make_unique<World>();
+                              World &world = **trimWorld;
+                              std::vector<EntityHandle> entities = world.SpawnBatch<Position, Velocity>(
+                                  entityCount, [](int i) { return std::tuple(Position(i, i, i), Velocity(1, 1, 1)); });
+                              std::vector<EntityHandle> massive = world.SpawnBatch<Position, Mass>(
+                                  entityCount, [](int i) { return std::tuple(Position(i, i, i), Mass(2)); });
+                              world.DestroyBatch(massive);
+                              world.DestroyBatch(std::span(entities).subspan(std::min(entityCount, 64)));
+                          },
+                          [=]() { *reclaimed = (*trimWorld)->Compact(); },
+                          [=]() { return Metrics{{"bytesReclaimed", (double)*reclaimed}}; }});
+
+    // Every round spawns entities, moves some to another archetype, destroys all and trims the world.
+    struct ChurnWorlds {
+        HeapAllocator heap;
+        PoolAllocator pool;
+        ArenaAllocator arena;
+        HugePageAllocator hugePages;
+        ArenaAllocator hugePageArena{HugePageAllocator::hugePageSize, hugePages};
+        World heapWorld{heap}, poolWorld{pool}, arenaWorld{arena}, hugePageWorld{hugePageArena};
+    };
+    auto churnWorlds = std::make_shared<ChurnWorlds>();
+    auto churn = [=](World &world) {
+        std::vector<EntityHandle> entities = world.SpawnBatch<Position, Velocity>(
+            entityCount, [](int i) { return std::tuple(Position(i, i, i), Velocity(1, 1, 1)); });
+        for (int i = 0; i < entities.size(); i += 2) world.AddComponent(entities[i], Mass(2));
+        world.DestroyBatch(entities);
+        world.Trim();
+    };
+    benchmarks.push_back({"churn_heap", entityCount, nullptr, [=]() { churn(churnWorlds->heapWorld); }});
+    benchmarks.push_back({"churn_pool", entityCount, nullptr, [=]() { churn(churnWorlds->poolWorld); }});
+    benchmarks.push_back({"churn_arena", entityCount, nullptr, [=]() { churn(churnWorlds->arenaWorld); }});
+    benchmarks.push_back({"churn_huge_pages", entityCount, nullptr, [=]() { churn(churnWorlds->hugePageWorld); }});
+
+    // 5% of the entities are written before every sample, in a run of neighbouring entities.
+    auto writeSome = [=](World &world, const std::vector<EntityHandle> &entities, int &sample) {
+        int writtenCount = std::max(entityCount / 20, 1);
+        int first = sample++ * writtenCount % std::max(entityCount - writtenCount, 1);
+        for (int i = first; i < std::min(first + writtenCount, entityCount); i++)
+            world.GetComponent<Velocity>(entities[i]).x += 1;
+    };
+    auto spawnChunked = [=](World &world) {
+        world.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        return world.SpawnBatch<Position, Velocity>(
+            entityCount, [](int i) { return std::tuple(Position(i, i, i), Velocity(1, 1, 1)); });
+    };
+
+    struct FilteredWorld {
+        World world;
+        std::vector<EntityHandle> entities;
+        Query<Changed<Velocity>, Position, Velocity> changed{world};
+        int sample = 0;
+    };
+    auto filtered = std::make_shared<FilteredWorld>();
+    filtered->entities = spawnChunked(filtered->world);
+    benchmarks.push_back({"query_changed", entityCount,
+                          [=]() { writeSome(filtered->world, filtered->entities, filtered->sample); },
+                          [=]() {
+                              filtered->changed.ForEach([](EntityHandle e, Position &p, Velocity &v) { p.x += v.x; });
+                          }});
+
+    struct SnapshotWorlds {
+        World world;
+        std::unique_ptr<World> loaded;
+        SnapshotWriter writer, saved;
+    };
+    auto snapshots = std::make_shared<SnapshotWorlds>();
+    spawnChunked(snapshots->world);
+    SaveSnapshot(snapshots->world, snapshots->saved);
+    benchmarks.push_back({"snapshot_save", entityCount, [=]() { snapshots->writer.Clear(); },
+                          [=]() { SaveSnapshot(snapshots->world, snapshots->writer); }});
+    benchmarks.push_back({"snapshot_load", entityCount, [=]() { snapshots->loaded = std::make_unique<World>(); },
+                          [=]() {
+                              SnapshotReader reader(snapshots->saved.GetBytes());
+                              LoadSnapshot(*snapshots->loaded, reader);
+                          }});
+
+    struct RingWorld {
+        World world;
+        std::vector<EntityHandle> entities;
+        SnapshotRing ring{world, 16};
+        int sample = 0;
+        int64_t restored = 0;
+    };
+    auto saving = std::make_shared<RingWorld>();
+    saving->entities = spawnChunked(saving->world);
+    benchmarks.push_back({"ring_save", entityCount, [=]() { writeSome(saving->world, saving->entities, saving->sample); },
+                          [=]() { saving->ring.Save(); }});
+    auto restoring = std::make_shared<RingWorld>();
+    restoring->entities = spawnChunked(restoring->world);
+    benchmarks.push_back({"ring_restore", entityCount,
+                          [=]() {
+                              restoring->restored = restoring->ring.Save();
+                              writeSome(restoring->world, restoring->entities, restoring->sample);
+                              restoring->ring.Save();
+                          },
+                          [=]() { restoring->ring.Restore(restoring->restored); }});
+
+    // Every packet is acknowledged before the next one, so it's a delta against the previous packet. Ticks either write
+    // 5% of the entities or move all of them, both report the average packet size.
+    struct ReplicatedWorlds {
+        World sender, receiver;
+        std::vector<EntityHandle> entities;
+        ReplicationEncoder encoder{sender, ComponentMask::Of<Position, Velocity>()};
+        ReplicationDecoder decoder{receiver, ComponentMask::Of<Position, Velocity>()};
+        SnapshotWriter writer;
+        int sample = 0;
+        int64_t sequence = -1;
+        size_t bytes = 0;
+        int ticks = 0;
+    };
+    auto tick = [=](ReplicatedWorlds &worlds, bool moveAll) {
+        if (moveAll)
+            worlds.sender.ForEach<Position, Velocity>([](EntityHandle e, Position &p, Velocity &v) { p.x += v.x; });
+        else
+            writeSome(worlds.sender, worlds.entities, worlds.sample);
+        worlds.writer.Clear();
+    };
+    auto bytesPerTick = [](const std::shared_ptr<ReplicatedWorlds> &worlds) {
+        return [=]() { return Metrics{{"bytesPerTick", (double)worlds->bytes / std::max(worlds->ticks, 1)}}; };
+    };
+    for (bool moveAll : {false, true}) {
+        std::string suffix = moveAll ? "_moving" : "";
+        auto encoding = std::make_shared<ReplicatedWorlds>();
+        encoding->entities = spawnChunked(encoding->sender);
+        benchmarks.push_back({"replication_encode" + suffix, entityCount,
+                              [=]() {
+                                  encoding->encoder.Acknowledge(encoding->sequence);
+                                  tick(*encoding, moveAll);
+                              },
+                              [=]() {
+                                  encoding->sequence = encoding->encoder.Encode(encoding->writer);
+                                  encoding->bytes += encoding->writer.GetBytes().size();
+                                  encoding->ticks++;
+                              },
+                              bytesPerTick(encoding)});
+        auto decoding = std::make_shared<ReplicatedWorlds>();
+        decoding->entities = spawnChunked(decoding->sender);
+        benchmarks.push_back({"replication_decode" + suffix, entityCount,
+                              [=]() {
+                                  decoding->encoder.Acknowledge(decoding->decoder.GetLastSequence());
+                                  tick(*decoding, moveAll);
+                                  decoding->encoder.Encode(decoding->writer);
+                                  decoding->bytes += decoding->writer.GetBytes().size();
+                                  decoding->ticks++;
+                              },
+                              [=]() {
+                                  SnapshotReader reader(decoding->writer.GetBytes());
+                                  decoding->decoder.Decode(reader);
+                              },
+                              bytesPerTick(decoding)});
+    }
+
+    // Queries matching a single entity among 256 archetypes, times are per query.
+    const int queryCount = 1024;
+    struct QueriedWorld {
+        World world;
+        Query<Position, Mass> query{world};
+    };
+    auto queried = std::make_shared<QueriedWorld>();
+    for (int i = 0; i < 256; i++) {
+        EntityHandle e = queried->world.Create(Position(i, i, i));
+        [&]<int... B>(std::integer_sequence<int, B...>) {
+            ((i >> B & 1 ? queried->world.AddComponent(e, Marker<B>()) : void()), ...);
+        }(std::make_integer_sequence<int, 8>());
+        if (i == 255) queried->world.AddComponent(e, Mass(2));
+    }
+    benchmarks.push_back({"query_uncached", queryCount, nullptr, [=]() {
+                              for (int n = 0; n < queryCount; n++)
+                                  for (auto &&[e, positions, masses] :
+                                       queried->world.GetComponentsArrays<Position, Mass>())
+                                      positions[0].x += masses[0].value;
+                          }});
+    benchmarks.push_back({"query_cached", queryCount, nullptr, [=]() {
+                              for (int n = 0; n < queryCount; n++)
+                                  for (auto &&[e, positions, masses] : queried->query.GetComponentsArrays())
+                                      positions[0].x += masses[0].value;
+                          }});
+}
+
+static std::vector<Benchmark> GetBenchmarks(int entityCount) {
+    // Worlds are shared by the closures, setup rebuilds them before every sample.
+    auto world = std::make_shared<std::unique_ptr<World>>();
+    auto entities = std::make_shared<std::vector<EntityHandle>>();
+    auto reset = [=]() {
+        entities->clear();
+        *world = std::make_unique<World>();
+    };
+    auto spawn = [=]() {
+        reset();
+        *entities = (*world)->SpawnBatch<Position, Velocity>(entityCount, [](int i) {
+            return std::tuple(Position(i, i, i), Velocity(1, 1, 1));
+        });
+    };
+    auto spawnFour = [=]() {
+        reset();
+        *entities = (*world)->SpawnBatch<Position, Velocity, Acceleration, Mass>(entityCount, [](int i) {
+            return std::tuple(Position(i, i, i), Velocity(1, 1, 1), Acceleration(0, -1, 0), Mass(2));
+        });
+    };
+
+    std::vector<Benchmark> benchmarks;
+    benchmarks.push_back({"spawn", entityCount, reset, [=]() {
+                              for (int i = 0; i < entityCount; i++)
+                                  entities->push_back((*world)->Create(Position(i, i, i), Velocity(1, 1, 1)));
+                          }});
+    benchmarks.push_back({"spawn_batch", entityCount, reset, spawn});
+    benchmarks.push_back({"destroy", entityCount, spawn, [=]() {
+                              for (EntityHandle e : *entities) (*world)->Destroy(e);
+                          }});
+    benchmarks.push_back(
+        {"destroy_batch", entityCount, spawn, [=]() { (*world)->DestroyBatch(*entities); }});
+    benchmarks.push_back({"add_component", entityCount, spawn, [=]() {
+                              for (EntityHandle e : *entities) (*world)->AddComponent(e, Mass(2));
+                          }});
+    benchmarks.push_back({"remove_component", entityCount,
+                          [=]() {
+                              spawn();
+                              for (EntityHandle e : *entities) (*world)->AddComponent(e, Mass(2));
+                          },
+                          [=]() {
+                              for (EntityHandle e : *entities) (*world)->RemoveComponent<Mass>(e);
+                          }});
+
+    // Iteration doesn't change the structure of a world, so samples share one built up front.
+    auto iterationWorld = std::make_shared<World>();
+    iterationWorld->SpawnBatch<Position, Velocity, Acceleration, Mass>(entityCount, [](int i) {
+        return std::tuple(Position(i, i, i), Velocity(1, 1, 1), Acceleration(0, -1, 0), Mass(2));
+    });
+    benchmarks.push_back({"iterate_1", entityCount, nullptr, [=]() {
+                              iterationWorld->ForEach<Position>([](EntityHandle e, Position &p) { p.y += 1; });
+                          }});
+    benchmarks.push_back({"iterate_2", entityCount, nullptr, [=]() {
+                              iterationWorld->ForEach<Position, Velocity>([](EntityHandle e, Position &p, Velocity &v) {
+                                  p.x += v.x;
+                                  p.y += v.y;
+                                  p.z += v.z;
+                              });
+                          }});
+    benchmarks.push_back({"iterate_4", entityCount, nullptr, [=]() {
+                              iterationWorld->ForEach<Position, Velocity, Acceleration, Mass>(
+                                  [](EntityHandle e, Position &p, Velocity &v, Acceleration &a, Mass &m) {
+                                      v.x += a.x / m.value;
+                                      v.y += a.y / m.value;
+                                      v.z += a.z / m.value;
+                                      p.x += v.x;
+                                      p.y += v.y;
+                                      p.z += v.z;
+                                  });
+                          }});
+
+    // Every entity gets a combination of 8 markers, spreading them over 256 archetypes.
+    auto fragmentedWorld = std::make_shared<World>();
+    for (int i = 0; i < entityCount; i++) {
+        EntityHandle e = fragmentedWorld->Create(Position(i, i, i), Velocity(1, 1, 1));
+        [&]<int... B>(std::integer_sequence<int, B...>) {
+            ((i >> B & 1 ? fragmentedWorld->AddComponent(e, Marker<B>()) : void()), ...);
+        }(std::make_integer_sequence<int, 8>());
+    }
+    // Column tables are sized by the components of an archetype, instead of by the largest component ID in it.
+    auto columnTables = [=]() {
+        size_t dense = 0, indexedByID = 0;
+        for (const Archetype &archetype : fragmentedWorld->GetArchetypePool().GetArchetypes()) {
+            int maxID = -1;
+            archetype.mask.ForEach([&](int id) { maxID = id; });
+            dense += archetype.chunks.size() * archetype.denseComponentMap.size() * sizeof(PopbackArray) +
+                     sizeof(ColumnIndex);
+            indexedByID += archetype.chunks.size() * (maxID + 1) * sizeof(PopbackArray);
+        }
+        return Metrics{{"columnTableBytes", (double)dense}, {"indexedByIDBytes", (double)indexedByID}};
+    };
+    benchmarks.push_back({"iterate_fragmented", entityCount, nullptr,
+                          [=]() {
+                              fragmentedWorld->ForEach<Position, Velocity>(
+                                  [](EntityHandle e, Position &p, Velocity &v) {
+                                      p.x += v.x;
+                                      p.y += v.y;
+                                      p.z += v.z;
+                                  });
+                          },
+                          columnTables});
+
+    // Half of the entities are frozen, in archetypes of their own.
+    struct ExcludingWorld {
+        World world;
+        Query<Exclude<Frozen>, Position, Velocity> query{world};
+    };
+    auto excluding = std::make_shared<ExcludingWorld>();
+    std::vector<EntityHandle> excluded = excluding->world.SpawnBatch<Position, Velocity>(
+        entityCount, [](int i) { return std::tuple(Position(i, i, i), Velocity(1, 1, 1)); });
+    for (int i = 0; i < entityCount; i += 2) excluding->world.AddComponent(excluded[i], Frozen());
+    benchmarks.push_back({"query_exclude", entityCount, nullptr, [=]() {
+                              excluding->query.ForEach([](EntityHandle e, Position &p, Velocity &v) {
+                                  p.x += v.x;
+                                  p.y += v.y;
+                                  p.z += v.z;
+                              });
+                          }});
+    AddFeatureBenchmarks(benchmarks, entityCount);
+    return benchmarks;
+}
+
+static void WriteJson(std::ostream &stream, const std::vector<Result> &results, const Options &options) {
+    stream << "{\n  \"unit\": \"ns per operation\",\n  \"entityCount\": " << options.entityCount
+           << ",\n  \"benchmarks\": [\n";
+    for (int i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        stream << "    {\"name\": \"" << r.name << "\", \"samples\": " << r.samples << ", \"warmup\": " << r.warmup
+               << ", \"median\": " << r.median << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99
+               << ", \"min\": " << r.min;
+        if (!r.metrics.empty()) {
+            stream << ", \"metrics\": {";
+            for (int j = 0; j < r.metrics.size(); j++)
+                stream << (j == 0 ? "" : ", ") << "\"" << r.metrics[j].first << "\": " << r.metrics[j].second;
+            stream << "}";
+        }
+        stream << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n}\n";
+}
+
+/// @brief Reads medians from a file written by WriteJson, one benchmark per line.
+static std::map<std::string, double> ReadBaseline(const std::string &path) {
+    std::map<std::string, double> medians;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t median = line.find("\"median\": ");
+        if (name == std::string::npos || median == std::string::npos) continue;
+
+        name += 9;
+        medians[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(median + 10));
+    }
+    return medians;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json" && hasValue)
+            options.jsonPath = argv[++i];
+        else if (arg == "--baseline" && hasValue)
+            options.baselinePath = argv[++i];
+        else if (arg == "--tolerance" && hasValue)
+            options.tolerance = std::stod(argv[++i]);
+        else if (arg == "--filter" && hasValue)
+            options.filter = argv[++i];
+        else if (arg == "--samples" && hasValue)
+            options.sampleCount = std::max(std::stoi(argv[++i]), 1);
+        else if (arg == "--warmup" && hasValue)
+            options.warmupCount = std::max(std::stoi(argv[++i]), 0);
+        else if (arg == "--entities" && hasValue)
+            options.entityCount = std::max(std::stoi(argv[++i]), 1);
+        else {
+            std::cout << "Usage: ECSBench [--json path] [--baseline path] [--tolerance fraction]\n"
+                         "                [--filter substring] [--samples count] [--warmup count] [--entities count]\n";
+            return 2;
+        }
+    }
+
+#ifdef ECS_BENCH_BASELINE
+    if (options.jsonPath.empty() && options.baselinePath.empty()) {
+        if (std::filesystem::exists(ECS_BENCH_BASELINE))
+            options.baselinePath = ECS_BENCH_BASELINE;
+        else if (options.filter.empty())
+            options.jsonPath = ECS_BENCH_BASELINE;
+    }
+#endif
+
+    std::vector<Result> results;
+    std::cout << "Benchmark                     warm-up    median       p90       p99       min  (ns per entity or query, "
+              << options.entityCount << " entities)\n";
+    for (const Benchmark &benchmark : GetBenchmarks(options.entityCount)) {
+        if (benchmark.name.find(options.filter) == std::string::npos) continue;
+
+        Result r = Measure(benchmark, options);
+        results.push_back(r);
+        std::cout << r.name << std::string(28 - std::min<size_t>(r.name.size(), 27), ' ');
+        for (double value : {r.warmup, r.median, r.p90, r.p99, r.min}) {
+            std::string text = std::to_string(value);
+            text = text.substr(0, text.find('.') + 3);
+            std::cout << std::string(10 - std::min<size_t>(text.size(), 9), ' ') << text;
+        }
+        for (auto &[metric, value] : r.metrics) std::cout << "  " << metric << " " << value;
+        std::cout << "\n";
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream file(options.jsonPath);
+        WriteJson(file, results, options);
+        if (!file.good()) {
+            std::cout << "Failed to write " << options.jsonPath << "\n";
+            return 1;
+        }
+    }
+
+    if (options.baselinePath.empty()) return 0;
+    std::map<std::string, double> baseline = ReadBaseline(options.baselinePath);
+    if (baseline.empty()) {
+        std::cout << "\nNo baseline in " << options.baselinePath << ", write one with --json\n";
+        return 1;
+    }
+
+    // Medians are compared, they are the most stable of the reported times.
+    int regressions = 0;
+    std::cout << "\nCompared to " << options.baselinePath << ":\n";
+    for (const Result &r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end()) {
+            std::cout << "\t" << r.name << " not in baseline\n";
+            continue;
+        }
+        double ratio = r.median / it->second;
+        bool regressed = ratio > 1 + options.tolerance;
+        regressions += regressed;
+        std::cout << "\t" << r.name << " " << ratio << "x" << (regressed ? "  REGRESSION" : "") << "\n";
+    }
+    if (regressions != 0) {
+        std::cout << "Failed benchmark: " << regressions << " benchmarks slower than the baseline by more than "
+                  << options.tolerance * 100 << "%\n";
+        return 1;
+    }
+    return 0;
+}
@@ -47,7 +47,7 @@ int main() {
     /* } */
     Entity a(Name("A"));
     std::cout << '\n' << '\n';
-    std::cout << a.id << '\n';
+    std::cout << a.GetHandle().index << '\n';
     {
         Entity b(Name("B"));
         Entity c(Name("C"), Test("C"));
@@ -66,11 +66,11 @@ int main() {
     }
     /*  */
     /* std::cout << '\n' << '\n'; */
-    /* std::cout << a.id << '\n'; */
+    /* std::cout << a.GetHandle().index << '\n'; */
     /* { */
     /* 	Entity *b = new Entity(Test("C")); */
     /* } */
     /* std::cout << '\n' << '\n'; */
-    /* std::cout << a.id << '\n'; */
+    /* std::cout << a.GetHandle().index << '\n'; */
     return 0;
 }
@@ -1,10 +1,14 @@
 #include "ECS.h"
-#include <chrono>
+#include "CommandBuffer.h"
+#include "Replication.h"
+#include "Scheduler.h"
+#include "Snapshot.h"
+#include <climits>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <random>
 #include <thread>
-using namespace std::chrono_literals;
-using namespace std::chrono;
 using namespace ECS;
 
 struct Name : public Component<Name> {
@@ -27,6 +31,23 @@ struct Particle : public Component<Particle> {
     bool operator!=(const Particle &rhs) const { return x != rhs.x || y != rhs.y || vx != rhs.vx || vy != rhs.vy; }
 };
 
+struct SplitParticle : public Component<SplitParticle> {
+    using SplitField = float;
+    enum Fields { X, Y, VX, VY };
+    float x, y, vx, vy;
+
+    SplitParticle(float x, float y) : x(x), y(y), vx(0), vy(0) {}
+};
+
+struct BlockParticle : public Component<BlockParticle> {
+    using SplitField = float;
+    static constexpr int splitBlockSize = 8;
+    enum Fields { X, Y, VX, VY };
+    float x, y, vx, vy;
+
+    BlockParticle(float x, float y) : x(x), y(y), vx(0), vy(0) {}
+};
+
 struct FrictionConstraint : public Component<FrictionConstraint> {
     float frictionCeofficient;
     FrictionConstraint(float frictionCeofficient) : frictionCeofficient(frictionCeofficient) {}
@@ -37,6 +58,54 @@ struct BoxConstraint : public Component<BoxConstraint> {
     BoxConstraint(float w = 0.0f, float h = 0.0f) : w(w), h(h) {}
 };
 
+struct Lifetime : public Component<Lifetime> {
+    int ticks;
+    Lifetime(int ticks) : ticks(ticks) {}
+};
+
+struct alignas(32) Vector8 : public Component<Vector8> {
+    float values[8];
+    Vector8(float value) : values{value} {}
+};
+
+struct alignas(128) PaddedCounter : public Component<PaddedCounter> {
+    int count;
+    PaddedCounter(int count) : count(count) {}
+};
+
+template <int N> struct Marker : public Component<Marker<N>> {
+    int value = N;
+};
+
+struct Frozen : public Component<Frozen> {};
+struct Visible : public Component<Visible> {};
+
+struct Stunned : public Component<Stunned> {
+    static constexpr bool sparseStorage = true;
+    int ticks;
+    Stunned(int ticks) : ticks(ticks) {}
+};
+
+struct DamagedThisTick : public Component<DamagedThisTick> {
+    static constexpr bool sparseStorage = true;
+};
+
+struct Label : public Component<Label> {
+    static constexpr const char *componentName = "Label";
+    std::string text;
+    Label(std::string text) : text(std::move(text)) {}
+
+    void Serialize(SnapshotWriter &writer) const {
+        writer.Write((uint32_t)text.size());
+        writer.Write(text.data(), text.size());
+    }
+    static Label Deserialize(SnapshotReader &reader) {
+        std::string text(reader.Read<uint32_t>(), '\0');
+        reader.Read(text.data(), text.size());
+        return Label(std::move(text));
+    }
+};
+
 int main() {
     {
         std::vector<Entity> entities;
@@ -90,21 +159,431 @@ int main() {
         }
     }
 
-    // Performance test.
+    {
+        std::vector<Entity> entities;
+        std::vector<EntityHandle> handles;
+        for (int i = 0; i < 100; i++) {
+            entities.push_back(Entity(Name(i)));
+            handles.push_back(entities.back().GetHandle());
+        }
+        EntityHandle destroyed = handles[10];
+        World::GetDefault().Destroy(destroyed);
+        EntityHandle recycled = World::GetDefault().Create(Name(1000));
+
+        if (World::GetDefault().IsAlive(destroyed) || !World::GetDefault().IsAlive(recycled) ||
+            recycled.index != destroyed.index || recycled.generation == destroyed.generation ||
+            entities[10].HasComponent<Name>()) {
+            std::cout << "Failed entity handle test: Stale handle not detected\n";
+            return 1;
+        }
+        for (int i = 0; i < 100; i++)
+            if (i != 10 && World::GetDefault().GetComponent<Name>(handles[i]).id != i) {
+                std::cout << "Failed entity handle test: Impropper component at handle " << i << "\n";
+                return 1;
+            }
+        World::GetDefault().Destroy(recycled);
+    }
+
+    {
+        const int chunkByteSize = 1024;
+        const int entityCount = 1000;
+        World::GetDefault().GetArchetypePool().SetChunkByteSize(chunkByteSize);
+        std::vector<Entity> entities;
+        for (int i = 0; i < entityCount; i++) entities.push_back(Entity(Lifetime(i), Name(i)));
+        for (int i = 0; i < entityCount; i += 2) entities[i].AddComponent(Test(i));
+        for (int i = 0; i < entityCount; i += 4) entities[i].RemoveComponent<Lifetime>();
+        World::GetDefault().GetArchetypePool().SetChunkByteSize(0);
+
+        long long sum = 0;
+        int count = 0;
+        for (auto &&[e, lifetime, name] : GetComponents<Lifetime, Name>()) {
+            if (lifetime.ticks != name.id || World::GetDefault().GetComponent<Lifetime>(e).ticks != lifetime.ticks) {
+                std::cout << "Failed chunked storage test: Impropper component data\n";
+                return 1;
+            }
+            sum += lifetime.ticks;
+            count++;
+        }
+        for (auto &&[entities, lifetimes] : GetComponentsArrays<Lifetime>()) {
+            if (lifetimes.size() > chunkByteSize / (sizeof(Lifetime) + sizeof(Name) + sizeof(EntityHandle))) {
+                std::cout << "Failed chunked storage test: Chunk larger than chunk capacity\n";
+                return 1;
+            }
+        }
+        for (int i = 0; i < entityCount; i += 2)
+            if (entities[i].GetComponent<Test>().id != i) {
+                std::cout << "Failed chunked storage test: Impropper added component\n";
+                return 1;
+            }
+
+        entities.erase(entities.begin(), entities.begin() + entityCount / 2);
+        long long remainingSum = 0;
+        for (auto &&[e, lifetime] : GetComponents<Lifetime>()) remainingSum += lifetime.ticks;
+        if (count != entityCount * 3 / 4 || sum != 375000 || remainingSum != 281250) {
+            std::cout << "Failed chunked storage test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    {
+        // Filling exactly one chunk, in a batch or one entity at a time, allocates no spare chunk.
+        World batched, single;
+        batched.GetArchetypePool().SetChunkByteSize(1024);
+        single.GetArchetypePool().SetChunkByteSize(1024);
+        EntityHandle first = batched.Create(Lifetime(0), Name(0));
+        int archetypeID = batched.GetRegistry().GetSlot(first).archetypeID;
+        int chunkCapacity = batched.GetArchetypePool().GetArchetypes()[archetypeID].chunkCapacity;
+        batched.SpawnBatch<Lifetime, Name>(chunkCapacity - 1, [](int i) { return std::tuple(Lifetime(i), Name(i)); });
+        for (int i = 0; i < chunkCapacity; i++) single.Create(Lifetime(i), Name(i));
+
+        for (World *world : {&batched, &single})
+            for (Archetype &archetype : world->GetArchetypePool().GetArchetypes())
+                if (archetype.entityCount != 0 && (archetype.entityCount != chunkCapacity || archetype.chunks.size() != 1)) {
+                    std::cout << "Failed chunked storage test: Spare chunk allocated for a full chunk\n";
+                    return 1;
+                }
+    }
+
+    {
+        auto simulate = [](World &world, int seed, long long &result) {
+            std::vector<Entity> entities;
+            for (int i = 0; i < 10000; i++) entities.push_back(Entity(world, Name(i + seed)));
+            for (int i = 0; i < 10000; i += 3) entities[i].AddComponent(Test(i));
+            entities.erase(entities.begin(), entities.begin() + 5000);
+
+            result = 0;
+            for (auto &&[e, name] : world.GetComponents<Exclude<Test>, Name>()) result += name.id;
+        };
+
+        World worlds[2];
+        long long results[2];
+        std::thread thread(simulate, std::ref(worlds[1]), 1, std::ref(results[1]));
+        simulate(worlds[0], 0, results[0]);
+        thread.join();
+
+        if (results[0] != 24995000 || results[1] != results[0] + 3333) {
+            std::cout << "Failed world test: Impropper results " << results[0] << ", " << results[1] << "\n";
+            return 1;
+        }
+        for (auto &&[e, name] : GetComponents<Name>()) {
+            std::cout << "Failed world test: Entities leaked into the default world\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        for (int i = 0; i < 1000; i++) entities.push_back(Entity(world, Name(i), Test(0)));
+        for (int i = 0; i < 1000; i++) entities.push_back(Entity(world, Name(i)));
+
+        long long nameSum = 0;
+        Scheduler scheduler;
+        scheduler.AddSystem<Read<>, Write<Test>>("SetTest", [](std::span<EntityHandle> e, std::span<Test> tests) {
+            for (auto &test : tests) test.id = 1;
+        });
+        scheduler.AddSystem<Read<Name>>("SumNames", [&](std::span<EntityHandle> e, std::span<const Name> names) {
+            for (auto &name : names) nameSum += name.id;
+        });
+        scheduler.AddSystem<Read<Test>, Write<Name>>(
+            "AddTestToName", [](std::span<EntityHandle> e, std::span<const Test> tests, std::span<Name> names) {
+                for (size_t i = 0; i < names.size(); i++) names[i].id += tests[i].id;
+            });
+        scheduler.AddSystem<Read<Name>, Write<>, Exclude<Test>>(
+            "CheckNames", [](std::span<EntityHandle> e, std::span<const Name> names) {});
+        scheduler.Run(world);
+
+        auto systems = scheduler.GetSystems();
+        if (systems[0].successors != std::vector<int>{2} || systems[1].successors != std::vector<int>{2} ||
+            systems[2].dependencyCount != 2 || systems[3].dependencyCount != 1) {
+            std::cout << "Failed scheduler test: Impropper dependencies\n";
+            return 1;
+        }
+        int i = 0;
+        for (auto &&[e, name, test] : world.GetComponents<Name, Test>())
+            if (name.id != i++ + 1 || nameSum != 999000) {
+                std::cout << "Failed scheduler test: Systems ran out of order\n";
+                return 1;
+            }
+    }
+
+    {
+        World world;
+        std::vector<EntityHandle> handles;
+        for (int i = 0; i < 1000; i++) handles.push_back(world.Create(Name(i)));
+
+        CommandBuffer commands;
+        for (auto &&[e, name] : world.GetComponents<Name>()) {
+            if (name.id % 2 == 0) commands.AddComponent(e, Test(name.id));
+            if (name.id % 3 == 0) commands.Destroy(e);
+            if (name.id % 5 == 0) commands.RemoveComponent<Name>(e);
+        }
+        world.ParallelForEach<Name>([&](EntityHandle e, Name &name) {
+            if (name.id % 7 == 0) commands.Create(Name(-name.id), Test(1));
+        });
+        commands.Playback(world);
+
+        for (int i = 0; i < 1000; i++) {
+            EntityHandle e = handles[i];
+            if (world.IsAlive(e) != (i % 3 != 0) ||
+                (world.IsAlive(e) &&
+                 (world.HasComponent<Name>(e) != (i % 5 != 0) || world.HasComponent<Test>(e) != (i % 2 == 0) ||
+                  (world.HasComponent<Name>(e) && world.GetComponent<Name>(e).id != i) ||
+                  (world.HasComponent<Test>(e) && world.GetComponent<Test>(e).id != i)))) {
+                std::cout << "Failed command buffer test: Impropper entity " << i << "\n";
+                return 1;
+            }
+        }
+        int created = 0, createdSum = 0;
+        for (auto &&[e, name, test] : world.GetComponents<Name, Test>())
+            if (test.id == 1) created++, createdSum -= name.id;
+        if (created != 143 || createdSum != 71071 || !commands.Empty()) {
+            std::cout << "Failed command buffer test: Impropper created entities\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        Query<Name> names(world);
+        Query<Exclude<Test>, Name> namesWithoutTest(world);
+        for (int i = 0; i < 100; i++) entities.push_back(Entity(world, Name(i)));
+
+        int count = 0;
+        for (auto &&[e, name] : names) count++;
+        for (int i = 0; i < 100; i += 2) entities[i].AddComponent(Test(i));
+        for (int i = 0; i < 100; i += 5) entities[i].AddComponent(Lifetime(i));
+        for (auto &&[e, name] : names) count++;
+        for (auto &&[e, name] : namesWithoutTest.GetComponents()) count++;
+        for (auto &&[e, names] : namesWithoutTest.GetComponentsArrays()) count += names.size();
+
+        if (count != 300 || names.GetArchetypeIDs().size() != 4 || namesWithoutTest.GetArchetypeIDs().size() != 2) {
+            std::cout << "Failed query test: Impropper matched entities\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        for (int chunkByteSize : {0, 4096}) {
+            world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+            for (int i = 0; i < 1000; i++)
+                entities.push_back(chunkByteSize ? Entity(world, Vector8(i), PaddedCounter(i), Name(i))
+                                                 : Entity(world, Vector8(i), PaddedCounter(i)));
+        }
+
+        int count = 0;
+        for (auto &&[e, vectors, counters] : world.GetComponentsArrays<Vector8, PaddedCounter>()) {
+            if ((uintptr_t)vectors.data() % cacheLineSize != 0 || (uintptr_t)counters.data() % 128 != 0 ||
+                (uintptr_t)e.data() % cacheLineSize != 0) {
+                std::cout << "Failed alignment test: Column not aligned\n";
+                return 1;
+            }
+            for (size_t i = 0; i < vectors.size(); i++, count++)
+                if ((uintptr_t)&vectors[i] % 32 != 0 || vectors[i].values[0] != counters[i].count) {
+                    std::cout << "Failed alignment test: Impropper component\n";
+                    return 1;
+                }
+        }
+        if (count != 2000) {
+            std::cout << "Failed alignment test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        for (int chunkByteSize : {0, 512}) {
+            world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+            for (int i = 0; i < 500; i++) {
+                int id = entities.size();
+                entities.push_back(Entity(world, SplitParticle(id, -id), BlockParticle(id, -id)));
+            }
+        }
+        for (int i = 0; i < 1000; i += 3) entities[i].AddComponent(Name(i));
+        for (int i = 0; i < 1000; i += 7) entities[i].RemoveComponent<BlockParticle>();
+        CommandBuffer commands;
+        for (int i = 1000; i < 1100; i++) commands.Create(SplitParticle(i, -i), BlockParticle(i, -i));
+        commands.Playback(world);
+
+        long long sum = 0;
+        int count = 0;
+        for (auto &&[e, splits, blocks] : world.GetComponentsArrays<SplitParticle, BlockParticle>()) {
+            for (size_t i = 0; i < splits.size(); i++, count++) {
+                SplitParticle split = splits.Load(i);
+                if (split.x != -split.y || blocks.Get(i, BlockParticle::X) != split.x ||
+                    blocks.GetBlock(i / 8, BlockParticle::Y)[i % 8] != split.y ||
+                    splits.GetField(SplitParticle::X)[i] != split.x) {
+                    std::cout << "Failed split component test: Impropper fields\n";
+                    return 1;
+                }
+                sum += split.x;
+            }
+        }
+        if (count != 1100 - 143 || sum != 1100 * 1099 / 2 - 7 * 142 * 143 / 2) {
+            std::cout << "Failed split component test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<EntityHandle> destroyed;
+        long long expectedSum = 0;
+        for (int chunkByteSize : {0, 4096}) {
+            world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+            std::vector<EntityHandle> entities = world.SpawnBatch<Name, Particle, SplitParticle>(
+                3000, [](int i) { return std::tuple(Name(i), Particle(i, -i), SplitParticle(i, -i)); });
+            std::vector<EntityHandle> blocks =
+                world.SpawnBatch<BlockParticle>(1000, [](int i) { return BlockParticle(i, -i); });
+            world.DestroyBatch(blocks);
+            for (int i = 0; i < 3000; i++) {
+                if (i % 3 == 0)
+                    destroyed.push_back(entities[i]);
+                else
+                    expectedSum += i;
+            }
+            world.Destroy(world.Create(Name(0), Particle(), SplitParticle(0, 0)));
+        }
+        world.DestroyBatch(destroyed);
+
+        long long sum = 0;
+        int count = 0;
+        for (auto &&[e, names, particles, splits] : world.GetComponentsArrays<Name, Particle, SplitParticle>()) {
+            for (size_t i = 0; i < names.size(); i++, count++) {
+                if (particles[i].x != names[i].id || particles[i].y != -names[i].id ||
+                    splits.Get(i, SplitParticle::X) != names[i].id) {
+                    std::cout << "Failed batch test: Impropper components\n";
+                    return 1;
+                }
+                sum += names[i].id;
+            }
+        }
+        for (auto &&[e, blocks] : world.GetComponentsArrays<BlockParticle>()) count += blocks.size();
+        if (count != 4000 || sum != expectedSum || world.IsAlive(destroyed[0])) {
+            std::cout << "Failed batch test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    for (int chunkByteSize : {0, 1024}) {
+        World world;
+        world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+        std::vector<EntityHandle> entities =
+            world.SpawnBatch<Name, Particle>(1000, [](int i) { return std::tuple(Name(i), Particle(i, -i)); });
+        world.SpawnBatch<Name, SplitParticle>(
+            500, [](int i) { return std::tuple(Name(1000 + i), SplitParticle(1000 + i, -1000 - i)); });
+        std::vector<EntityHandle> lifetimes = world.SpawnBatch<Lifetime>(100, [](int i) { return Lifetime(i); });
+        for (int i = 0; i < 1000; i += 4) world.AddComponent(entities[i], FrictionConstraint(1.0f));
+
+        world.AddComponentToAll<Exclude<SplitParticle>, Name>(FrictionConstraint(0.5f));
+        world.AddComponentToAll<Name>(Test(7));
+        world.RemoveComponentFromAll<Name, SplitParticle>();
+        world.RemoveComponentFromAll<Lifetime>();
+
+        float friction = 0;
+        int count = 0;
+        for (auto &&[e, name, p, f, test] : world.GetComponents<Name, Particle, FrictionConstraint, Test>()) {
+            if (p.x != name.id || p.y != -name.id || test.id != 7) {
+                std::cout << "Failed bulk migration test: Impropper components\n";
+                return 1;
+            }
+            friction += f.frictionCeofficient;
+            count++;
+        }
+        for (auto &&[e, splits, tests] : world.GetComponentsArrays<Exclude<Name>, SplitParticle, Test>())
+            for (size_t i = 0; i < splits.size(); i++, count++)
+                if (splits.Get(i, SplitParticle::X) != -splits.Get(i, SplitParticle::Y)) count = -1;
+        if (count != 1500 || friction != 625 || !world.IsAlive(lifetimes[0]) || world.HasComponent<Lifetime>(lifetimes[0])) {
+            std::cout << "Failed bulk migration test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    for (int chunkByteSize : {0, 1024}) {
+        World world;
+        world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+        std::vector<EntityHandle> entities =
+            world.SpawnBatch<Particle>(1000, [](int i) { return Particle(i, -i); });
+        for (int i = 0; i < 1000; i += 3) world.AddComponent(entities[i], Frozen());
+        CommandBuffer commands;
+        for (int i = 1; i < 1000; i += 3) commands.AddComponent(entities[i], Frozen());
+        commands.Create(Frozen());
+        commands.Playback(world);
+        world.AddComponentToAll<Exclude<Frozen>, Particle>(Visible());
+        EntityHandle tagOnly = world.Create(Visible());
+        world.RemoveComponent<Visible>(tagOnly);
+
+        Archetype *tagged = world.GetArchetypePool().GetArchetype<Particle, Frozen>();
+        Archetype *untagged = world.GetArchetypePool().GetArchetype<Particle>();
+        if (tagged->denseComponentMap.size() != 1 || tagged->chunkCapacity != untagged->chunkCapacity) {
+            std::cout << "Failed tag test: Tag has a column\n";
+            return 1;
+        }
+
+        int frozen = 0, visible = 0, tags = 0;
+        float sum = 0;
+        for (auto &&[e, p, f] : world.GetComponents<Particle, Frozen>()) frozen++, sum += p.x + p.y;
+        for (auto &&[e, p, v] : world.GetComponents<Exclude<Frozen>, Particle, Visible>()) visible++, sum += p.x + p.y;
+        for (auto &&[e, f] : world.GetComponentsArrays<Frozen>()) tags += f.size();
+        if (frozen != 667 || visible != 333 || tags != 668 || sum != 0 || !world.IsAlive(tagOnly) ||
+            world.HasComponent<Visible>(tagOnly) || !world.HasComponent<Visible>(entities[2])) {
+            std::cout << "Failed tag test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        std::vector<EntityHandle> entities = world.SpawnBatch<Particle>(1000, [](int i) { return Particle(i, -i); });
+        for (int i = 0; i < 1000; i += 5) world.AddComponent(entities[i], Stunned(i));
+        for (int i = 0; i < 1000; i += 2) world.AddComponent(entities[i], DamagedThisTick());
+        for (int i = 0; i < 1000; i += 10) world.RemoveComponent<Stunned>(entities[i]);
+        for (int i = 1; i < 1000; i += 10) world.Destroy(entities[i]);
+        EntityHandle recycled = world.Create(Particle(0, 0));
+        EntityHandle sparseOnly = world.Create(Stunned(-1));
+
+        CommandBuffer commands;
+        commands.AddComponent(entities[3], Stunned(3));
+        commands.RemoveComponent<DamagedThisTick>(entities[4]);
+        commands.AddComponent(entities[6], Frozen());
+        commands.Destroy(entities[995]);
+        commands.Create(Stunned(-1), DamagedThisTick());
+        commands.Playback(world);
+
+        int stunned = 0, undamaged = 0;
+        long long ticks = 0;
+        for (auto &&[e, p, s] : world.GetComponents<Particle, Stunned>()) {
+            if (s.ticks != p.x) {
+                std::cout << "Failed sparse test: Impropper component\n";
+                return 1;
+            }
+            stunned++, ticks += s.ticks;
+        }
+        Query<Exclude<DamagedThisTick>, Particle> query(world);
+        query.ForEach([&](EntityHandle e, Particle &p) { undamaged++; });
+        if (stunned != 100 || ticks != 50000 - 995 + 3 || undamaged != 401 ||
+            world.GetArchetypePool().GetArchetypes().size() != 2 || world.HasComponent<Stunned>(recycled) ||
+            world.GetSparseSet<Stunned>().GetEntities().size() != 102 || !world.HasComponent<Stunned>(sparseOnly) ||
+            world.GetComponent<Stunned>(sparseOnly).ticks != -1) {
+            std::cout << "Failed sparse test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    // Particles simulated in a plain array, the expected results of iterating them through the ECS.
     const int particleCount = 1024 * 32;
     const int iterationCount = 1024;
 
-    std::cout << "Ground truth: \n";
     Particle particles[particleCount];
     {
-        auto start = high_resolution_clock::now();
         srand(0);
         for (int i = 0; i < particleCount; i++)
             particles[i] = Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
-        auto end = high_resolution_clock::now();
-        std::cout << "\tSetup time " << (end - start).count() / 1000000.0 << "ms\n";
 
-        start = high_resolution_clock::now();
         for (int n = 0; n < iterationCount; n++) {
             for (int i = 0; i < particleCount; i++) {
                 Particle &p = particles[i];
@@ -114,25 +593,18 @@ int main() {
                 p.y += p.vy;
             }
         }
-        end = high_resolution_clock::now();
-        std::cout << "\tRun time " << (end - start).count() / 1000000.0 << "ms\n";
     }
 
     {
-        std::cout << "\nMy ECS with all Extra Components: \n";
         Entity entities[particleCount];
         {
-            auto start = high_resolution_clock::now();
             srand(0);
             for (int i = 0; i < particleCount; i++) {
                 entities[i] = Entity(Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX));
                 entities[i].AddComponent(FrictionConstraint(0.1f));
                 entities[i].AddComponent(BoxConstraint(10.1f, 10.1f));
             }
-            auto end = high_resolution_clock::now();
-            std::cout << "\tSetup time " << (end - start).count() / 1000000.0 << "ms\n";
 
-            start = high_resolution_clock::now();
             for (int n = 0; n < iterationCount; n++) {
                 for (auto &&[e, p] : GetComponents<Particle>()) {
                     p.vy -= p.y * 0.1;
@@ -141,8 +613,6 @@ int main() {
                     p.y += p.vy;
                 }
             }
-            end = high_resolution_clock::now();
-            std::cout << "\tRun time " << (end - start).count() / 1000000.0 << "ms\n";
         }
 
         int i = 0;
@@ -158,17 +628,12 @@ int main() {
         }
     }
     {
-        std::cout << "\nSame with my ECS: \n";
         Entity entities[particleCount];
         {
-            auto start = high_resolution_clock::now();
             srand(0);
             for (int i = 0; i < particleCount; i++)
                 entities[i] = Entity(Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX));
-            auto end = high_resolution_clock::now();
-            std::cout << "\tSetup time " << (end - start).count() / 1000000.0 << "ms\n";
 
-            start = high_resolution_clock::now();
             for (int n = 0; n < iterationCount; n++) {
                 for (auto &&[e, p] : GetComponents<Particle>()) {
                     p.vy -= p.y * 0.1;
@@ -177,8 +642,6 @@ int main() {
                     p.y += p.vy;
                 }
             }
-            end = high_resolution_clock::now();
-            std::cout << "\tRun time " << (end - start).count() / 1000000.0 << "ms\n";
         }
 
         int i = 0;
@@ -195,10 +658,106 @@ int main() {
     }
 
     {
-        std::this_thread::sleep_for(1s);
+        World world;
+        std::vector<Entity> entities;
+        entities.reserve(particleCount);
+        srand(0);
+        for (int i = 0; i < particleCount; i++)
+            entities.push_back(Entity(world, Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX)));
+
+        for (int n = 0; n < iterationCount; n++) {
+            world.ForEach<Particle>([](EntityHandle e, Particle &p) {
+                p.vy -= p.y * 0.1;
+                p.vx -= p.x * 0.1;
+                p.x += p.vx;
+                p.y += p.vy;
+            });
+        }
+
+        int i = 0;
+        for (auto &&[e, p] : world.GetComponents<Particle>()) {
+            if (p != particles[i++]) {
+                std::cout << "Failed ForEach test: Impopper particle data\n";
+                return 1;
+            }
+        }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        entities.reserve(particleCount);
+        srand(0);
+        for (int i = 0; i < particleCount; i++)
+            entities.push_back(Entity(world, BlockParticle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX)));
+
+        for (int n = 0; n < iterationCount; n++) {
+            for (auto &&[e, p] : world.GetComponentsArrays<BlockParticle>()) {
+                for (size_t block = 0; block < p.GetBlockCount(); block++) {
+                    float *x = p.GetBlock(block, BlockParticle::X), *y = p.GetBlock(block, BlockParticle::Y);
+                    float *vx = p.GetBlock(block, BlockParticle::VX), *vy = p.GetBlock(block, BlockParticle::VY);
+                    for (int i = 0; i < BlockParticle::splitBlockSize; i++) {
+                        vy[i] -= y[i] * 0.1;
+                        vx[i] -= x[i] * 0.1;
+                        x[i] += vx[i];
+                        y[i] += vy[i];
+                    }
+                }
+            }
+        }
+
+        int i = 0;
+        for (auto &&[e, p] : world.GetComponentsArrays<BlockParticle>())
+            for (size_t j = 0; j < p.size(); j++, i++) {
+                BlockParticle particle = p.Load(j);
+                if (particle.x != particles[i].x || particle.y != particles[i].y || particle.vx != particles[i].vx ||
+                    particle.vy != particles[i].vy) {
+                    std::cout << "Failed AoSoA test: Impopper particle data\n";
+                    return 1;
+                }
+            }
+    }
+
+    {
+        World world;
+        std::vector<Entity> entities;
+        entities.reserve(particleCount);
+        {
+            srand(0);
+            for (int i = 0; i < particleCount; i++)
+                entities.push_back(Entity(world, Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX)));
+
+            for (int n = 0; n < iterationCount; n++) {
+                world.ParallelForEach<Particle>([](EntityHandle e, Particle &p) {
+                    p.vy -= p.y * 0.1;
+                    p.vx -= p.x * 0.1;
+                    p.x += p.vx;
+                    p.y += p.vy;
+                });
+            }
+        }
+
+        int i = 0;
+        for (auto &&[e, p] : world.GetComponents<Particle>()) {
+            if (p != particles[i++]) {
+                std::cout << "Failed parallel test: Impopper particle data\n";
+                return 1;
+            }
+        }
+
+        ThreadPool pool(3);
+        world.SetThreadPool(&pool);
+        std::atomic<int> count = 0;
+        world.ParallelForEach<Exclude<Name>, Particle>([&](EntityHandle e, Particle &p) { count++; });
+        if (i != particleCount || count != particleCount) {
+            std::cout << "Failed parallel test: Impropper particle count\n";
+            return 1;
+        }
+    }
+
+    {
         Entity entities[particleCount];
         {
-            auto start = high_resolution_clock::now();
             srand(0);
             for (int i = 0; i < particleCount; i++) {
                 entities[i] = Entity(Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX));
@@ -207,26 +766,491 @@ int main() {
                 if (rand() < RAND_MAX / 2) entities[i].AddComponent(FrictionConstraint(0.1f));
                 if (rand() < RAND_MAX / 2) entities[i].AddComponent(BoxConstraint(10.1f, 10.1f));
             }
-            auto end = high_resolution_clock::now();
-            std::cout << "\tSetup time " << (end - start).count() / 1000000.0 << "ms\n";
+        }
 
-            start = high_resolution_clock::now();
-            for (int n = 0; n < iterationCount; n++) {
-                for (auto &&[e, p] : GetComponents<Particle>()) {
+        int i = 0;
+        for (auto &&[e, p] : GetComponents<Particle>()) i++;
+        if (i != particleCount) {
+            std::cout << "Failed performance test: Impropper particle count\n";
+            return 1;
+        }
+    }
+
+    {
+        const int toggleCount = 32;
+        std::vector<Entity> entities;
+        entities.reserve(particleCount);
+        for (int i = 0; i < particleCount; i++) entities.push_back(Entity(Particle(i, i)));
+
+        for (int n = 0; n < toggleCount; n++) {
+            for (auto &e : entities) e.AddComponent(FrictionConstraint(0.1f));
+            for (auto &e : entities) e.RemoveComponent<FrictionConstraint>();
+            AddComponentToAll<Particle>(FrictionConstraint(0.1f));
+            RemoveComponentFromAll<FrictionConstraint>();
+            for (auto &e : entities) e.AddComponent(Frozen());
+            for (auto &e : entities) e.RemoveComponent<Frozen>();
+            for (auto &e : entities) e.AddComponent(Stunned(n));
+            for (auto &e : entities) e.RemoveComponent<Stunned>();
+        }
+
+        for (auto &e : entities) {
+            if (!e.HasComponent<Particle>() || e.HasComponent<FrictionConstraint>()) {
+                std::cout << "Failed add/remove test: Impropper components\n";
+                return 1;
+            }
+        }
+    }
+
+    {
+        World world;
+        std::vector<EntityHandle> entities;
+        entities.reserve(particleCount);
+        for (int i = 0; i < particleCount; i++) entities.push_back(world.Create(Particle(i, i)));
+        for (EntityHandle entity : entities) world.Destroy(entity);
+
+        entities = world.SpawnBatch<Particle>(particleCount, [](int i) { return Particle(i, i); });
+        world.DestroyBatch(entities);
+
+        int count = 0;
+        for (auto &&[e, p] : world.GetComponents<Particle>()) count++;
+        if (count != 0) {
+            std::cout << "Failed batch test: Entities left after DestroyBatch\n";
+            return 1;
+        }
+    }
+
+    {
+        const int keptCount = 64;
+        for (int chunkByteSize : {0, 16 * 1024}) {
+            World world;
+            world.GetArchetypePool().SetChunkByteSize(chunkByteSize);
+            Query<Particle> query(world);
+            std::vector<EntityHandle> entities =
+                world.SpawnBatch<Particle>(particleCount, [](int i) { return Particle(i, i); });
+            std::vector<EntityHandle> constrained = world.SpawnBatch<Particle, FrictionConstraint>(
+                particleCount, [](int i) { return std::tuple(Particle(i, i), FrictionConstraint(0.5f)); });
+            for (auto &&[e, particles] : query.GetComponentsArrays()) {}
+
+            world.DestroyBatch(constrained);
+            world.DestroyBatch(std::span(entities).subspan(keptCount));
+            size_t reclaimed = world.Compact();
+
+            int count = 0;
+            for (auto &&[e, p] : query) count++;
+            for (int i = 0; i < keptCount; i++) count += world.GetComponent<Particle>(entities[i]).x == i;
+            world.AddComponent(entities[0], FrictionConstraint(0.5f));
+            if (count != 2 * keptCount || reclaimed < (particleCount - keptCount) * sizeof(Particle) ||
+                world.GetArchetypePool().GetArchetypes().size() != 2 ||
+                !world.HasComponent<FrictionConstraint>(entities[0]) ||
+                world.GetComponent<Particle>(entities[0]).x != 0) {
+                std::cout << "Failed trim test: Impropper entities after Compact\n";
+                return 1;
+            }
+        }
+    }
+
+    {
+        const int roundCount = 20;
+        bool failed = false;
+        auto churn = [&](Allocator &allocator) {
+            World world(allocator);
+            for (int round = 0; round < roundCount; round++) {
+                std::vector<EntityHandle> entities =
+                    world.SpawnBatch<Particle>(particleCount / 4, [](int i) { return Particle(i, i); });
+                for (int i = 0; i < entities.size(); i += 2) world.AddComponent(entities[i], FrictionConstraint(0.5f));
+                for (int i = 0; i < entities.size(); i += 3) world.AddComponent(entities[i], Lifetime(i));
+
+                int count = 0;
+                for (auto &&[e, p, f] : world.GetComponents<Particle, FrictionConstraint>()) count += f.frictionCeofficient == 0.5f;
+                failed |= count != particleCount / 8;
+                world.DestroyBatch(entities);
+                world.Trim();
+            }
+        };
+
+        HeapAllocator heap;
+        churn(heap);
+        PoolAllocator pool;
+        churn(pool);
+        ArenaAllocator arena;
+        churn(arena);
+        HugePageAllocator hugePages;
+        ArenaAllocator hugePageArena(HugePageAllocator::hugePageSize, hugePages);
+        churn(hugePageArena);
+
+        if (failed) {
+            std::cout << "Failed allocator test: Impropper components\n";
+            return 1;
+        }
+    }
+
+    {
+        const int tickCount = 100;
+        const int writtenCount = particleCount / 20;
+        World filteredWorld, fullWorld;
+        filteredWorld.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        fullWorld.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        std::vector<EntityHandle> entities =
+            filteredWorld.SpawnBatch<Particle>(particleCount, [](int i) { return Particle(i, i); });
+        std::vector<EntityHandle> fullEntities =
+            fullWorld.SpawnBatch<Particle>(particleCount, [](int i) { return Particle(i, i); });
+        Query<Changed<Particle>, Particle> changed(filteredWorld);
+        Query<Particle> full(fullWorld);
+
+        int firstCount = 0, secondCount = 0;
+        for (auto &&[e, p] : changed) firstCount++;
+        for (auto &&[e, p] : changed) secondCount++;
+
+        float sum = 0;
+        bool seesWrites = true;
+        for (int tick = 0; tick < tickCount; tick++) {
+            int first = tick * writtenCount % (particleCount - writtenCount);
+            for (int i = first; i < first + writtenCount; i++) {
+                filteredWorld.GetComponent<Particle>(entities[i]).vx += 1;
+                fullWorld.GetComponent<Particle>(fullEntities[i]).vx += 1;
+            }
+
+            int count = 0;
+            changed.ForEach([&](EntityHandle e, Particle &p) { sum += p.vx, count++; });
+            full.ForEach([&](EntityHandle e, Particle &p) { sum += p.vx; });
+            seesWrites &= count >= writtenCount && count < particleCount / 2;
+        }
+
+        Query<Added<FrictionConstraint>, Particle> added(filteredWorld);
+        int addedBefore = 0, addedAfter = 0, addedAgain = 0;
+        for (auto &&[e, p] : added) addedBefore++;
+        for (int i = 0; i < 10; i++) filteredWorld.AddComponent(entities[i * 100], FrictionConstraint(0.5f));
+        for (auto &&[e, p] : added) addedAfter++;
+        for (auto &&[e, p] : added) addedAgain++;
+
+        // Systems only reading particles don't stamp them, a system writing them does.
+        Scheduler readers, writers;
+        for (int i = 0; i < 2; i++)
+            readers.AddSystem<Read<Particle>>("ReadParticles", [&](std::span<EntityHandle> e,
+                                                                   std::span<const Particle> particles) {
+                for (auto &p : particles) sum += p.x;
+            });
+        writers.AddSystem<Read<>, Write<Particle>>("WriteParticles",
+                                                   [](std::span<EntityHandle> e, std::span<Particle> particles) {
+                                                       for (auto &p : particles) p.vx += 1;
+                                                   });
+        int readCount = 0, writeCount = 0;
+        for (auto &&[e, p] : changed) sum += p.x;
+        readers.Run(filteredWorld);
+        for (auto &&[e, p] : changed) readCount++;
+        writers.Run(filteredWorld);
+        for (auto &&[e, p] : changed) writeCount++;
+
+        // Const reads through the world or an entity don't stamp either.
+        const Entity tracked(filteredWorld, Particle(1, 1));
+        const World &constWorld = filteredWorld;
+        int constReadCount = 0;
+        for (auto &&[e, p] : changed) sum += p.x;
+        for (int i = 0; i < writtenCount; i++) sum += constWorld.GetComponent<Particle>(entities[i]).x;
+        sum += tracked.GetComponent<Particle>().x;
+        for (auto &&[e, p] : changed) constReadCount++;
+
+        if (firstCount != particleCount || secondCount != 0 || !seesWrites || addedBefore != 0 || addedAfter != 10 ||
+            addedAgain != 0 || readCount != 0 || writeCount != particleCount || constReadCount != 0 || sum == 0) {
+            std::cout << "Failed change filter test: Impropper chunks visited\n";
+            return 1;
+        }
+    }
+
+    {
+        World world;
+        world.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        std::vector<EntityHandle> entities = world.SpawnBatch<Particle, Lifetime>(
+            particleCount, [](int i) { return std::tuple(Particle(i, -i), Lifetime(i)); });
+        std::vector<EntityHandle> blocks = world.SpawnBatch<BlockParticle, SplitParticle>(
+            1000, [](int i) { return std::tuple(BlockParticle(i, 1), SplitParticle(i, 2)); });
+        for (int i = 0; i < particleCount; i += 100) world.AddComponent(entities[i], Label(std::to_string(i)));
+        for (int i = 0; i < particleCount; i += 7) world.AddComponent(entities[i], Stunned(i));
+        for (int i = 1; i < particleCount; i += 1000) world.Destroy(entities[i]);
+
+        std::string path = (std::filesystem::temp_directory_path() / "ECSSnapshot.bin").string();
+        bool saved = SaveSnapshot(world, path);
+        World loaded;
+        bool restored = LoadSnapshot(loaded, path);
+        std::filesystem::remove(path);
+
+        bool equal = saved && restored;
+        for (int i = 0; i < particleCount && equal; i++) {
+            EntityHandle e = entities[i];
+            if (i % 1000 == 1) {
+                equal = !loaded.IsAlive(e);
+                continue;
+            }
+            equal = loaded.IsAlive(e) && !(loaded.GetComponent<Particle>(e) != Particle(i, -i)) &&
+                    loaded.GetComponent<Lifetime>(e).ticks == i && loaded.HasComponent<Label>(e) == (i % 100 == 0) &&
+                    (i % 100 != 0 || loaded.GetComponent<Label>(e).text == std::to_string(i)) &&
+                    loaded.HasComponent<Stunned>(e) == (i % 7 == 0) &&
+                    (i % 7 != 0 || loaded.GetComponent<Stunned>(e).ticks == i);
+        }
+        for (auto &&[e, blockColumns, splitColumns] : loaded.GetComponentsArrays<BlockParticle, SplitParticle>())
+            for (int i = 0; i < blockColumns.size(); i++) {
+                int id = (int)blockColumns.Get(i, BlockParticle::X);
+                equal &= e[i] == blocks[id] && blockColumns.Get(i, BlockParticle::Y) == 1 &&
+                         splitColumns.Get(i, SplitParticle::X) == id && splitColumns.Get(i, SplitParticle::Y) == 2;
+            }
+        if (!equal || world.Create() != loaded.Create()) {
+            std::cout << "Failed snapshot test: Loaded world differs\n";
+            return 1;
+        }
+
+        // A snapshot listing the same entity twice in one archetype is rejected.
+        World small;
+        std::vector<EntityHandle> pair = small.SpawnBatch<Particle>(2, [](int i) { return Particle(i, i); });
+        SnapshotWriter writer;
+        SaveSnapshot(small, writer);
+        std::vector<char> bytes(writer.GetBytes().begin(), writer.GetBytes().end());
+        const char *handles = (const char *)pair.data();
+        auto list = std::search(bytes.begin(), bytes.end(), handles, handles + 2 * sizeof(EntityHandle));
+        World duplicated;
+        bool rejected = list != bytes.end();
+        if (rejected) {
+            memcpy(&*list + sizeof(EntityHandle), handles, sizeof(EntityHandle));
+            SnapshotReader reader(bytes);
+            rejected = !LoadSnapshot(duplicated, reader);
+        }
+        if (!rejected) {
+            std::cout << "Failed snapshot test: Duplicate entity accepted\n";
+            return 1;
+        }
+    }
+
+    {
+        const int tickCount = 64;
+        const int writtenCount = particleCount / 20;
+        World world;
+        world.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        srand(0);
+        std::vector<EntityHandle> entities = world.SpawnBatch<Particle>(
+            particleCount, [](int i) { return Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX); });
+        SnapshotRing ring(world, 16);
+
+        // Columns are read straight from archetypes, iterating would mark every chunk as written.
+        auto checksum = [&]() {
+            double sum = 0;
+            for (Archetype &archetype : world.GetArchetypePool().GetArchetypes())
+                if (archetype.StoresComponent<Particle>())
+                    for (int chunk = 0; chunk < archetype.GetChunkCount(); chunk++)
+                        for (Particle &p : archetype.GetComponents<Particle>(chunk)) sum += p.x + 2 * p.y + 3 * p.vx;
+            for (EntityHandle e : world.GetSparseSet<Stunned>().GetEntities())
+                sum += world.GetComponent<Stunned>(e).ticks;
+            return sum;
+        };
+
+        struct Spawned {
+            EntityHandle entity;
+            int created, destroyed;
+        };
+        std::vector<Spawned> spawned;
+        std::vector<double> checksums;
+        bool numbered = true;
+        for (int tick = 0; tick < tickCount; tick++) {
+            checksums.push_back(checksum());
+            numbered &= ring.Save() == tick;
+
+            if (tick < tickCount / 2) {
+                world.ForEach<Particle>([](EntityHandle e, Particle &p) {
                     p.vy -= p.y * 0.1;
                     p.vx -= p.x * 0.1;
                     p.x += p.vx;
                     p.y += p.vy;
-                }
+                });
+                continue;
             }
-            end = high_resolution_clock::now();
-            std::cout << "\tRun time " << (end - start).count() / 1000000.0 << "ms\n";
+
+            int first = tick * writtenCount % (particleCount - writtenCount);
+            for (int i = first; i < first + writtenCount; i++) world.GetComponent<Particle>(entities[i]).vx += 1;
+            for (int i = 0; i < 16; i++) spawned.push_back({world.Create(Particle(tick, i)), tick, tickCount});
+            for (int i = 0; i < 8; i++) {
+                Spawned &oldest = spawned[(tick - tickCount / 2) * 8 + i];
+                world.Destroy(oldest.entity);
+                oldest.destroyed = tick;
+            }
+            if (world.HasComponent<Stunned>(entities[tick % 8]))
+                world.RemoveComponent<Stunned>(entities[tick % 8]);
+            else
+                world.AddComponent(entities[tick % 8], Stunned(tick));
         }
 
-        int i = 0;
-        for (auto &&[e, p] : GetComponents<Particle>()) i++;
-        if (i != particleCount) {
-            std::cout << "Failed performance test: Impropper particle count\n";
+        const int restoredTick = tickCount - 12;
+        bool restored = ring.Restore(restoredTick);
+        bool restoredAgain = ring.Restore(restoredTick - 3);
+
+        bool equal = numbered && restored && restoredAgain && !ring.Restore(0) &&
+                     checksum() == checksums[restoredTick - 3] && ring.GetLastFrame() == restoredTick - 3;
+        for (Spawned &s : spawned)
+            equal &= world.IsAlive(s.entity) == (s.created < restoredTick - 3 && s.destroyed >= restoredTick - 3);
+        world.GetComponent<Particle>(entities[0]).vx += 1;
+        if (!equal || ring.Save() != restoredTick - 2) {
+            std::cout << "Failed snapshot ring test: Restored world differs\n";
+            return 1;
+        }
+    }
+
+    {
+        const int tickCount = 64;
+        const int latency = 2;
+        const int writtenCount = particleCount / 20;
+        World sender, receiver;
+        sender.GetArchetypePool().SetChunkByteSize(16 * 1024);
+        srand(0);
+        std::vector<EntityHandle> entities = sender.SpawnBatch<Particle, Lifetime>(particleCount, [](int i) {
+            return std::tuple(Particle(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX), Lifetime(i));
+        });
+        for (int i = 0; i < 64; i++) entities.push_back(sender.Create(BlockParticle(i, -i), Frozen()));
+
+        ComponentMask replicated = ComponentMask::Of<Particle, BlockParticle, Frozen>();
+        ReplicationEncoder encoder(sender, replicated);
+        ReplicationDecoder decoder(receiver, replicated);
+
+        // Packets and acknowledgements are delivered latency ticks after they were sent, one packet is lost.
+        std::deque<std::pair<int, std::vector<char>>> packets;
+        std::deque<std::pair<int, int64_t>> acknowledgements;
+        SnapshotWriter writer;
+        bool decoded = true;
+        auto deliver = [&](int tick) {
+            while (!packets.empty() && packets.front().first <= tick) {
+                SnapshotReader reader(packets.front().second);
+                decoded &= decoder.Decode(reader);
+                acknowledgements.push_back({tick + latency, decoder.GetLastSequence()});
+                packets.pop_front();
+            }
+            while (!acknowledgements.empty() && acknowledgements.front().first <= tick) {
+                encoder.Acknowledge(acknowledgements.front().second);
+                acknowledgements.pop_front();
+            }
+        };
+
+        for (int tick = 0; tick < tickCount; tick++) {
+            if (tick < tickCount / 2) {
+                sender.ForEach<Particle>([](EntityHandle e, Particle &p) {
+                    p.vy -= p.y * 0.1;
+                    p.vx -= p.x * 0.1;
+                    p.x += p.vx;
+                    p.y += p.vy;
+                });
+            } else {
+                int first = tick * writtenCount % (particleCount - writtenCount);
+                for (int i = first; i < first + writtenCount; i++)
+                    if (sender.HasComponent<Particle>(entities[i])) sender.GetComponent<Particle>(entities[i]).vx += 1;
+                for (int i = 0; i < 16; i++) entities.push_back(sender.Create(Particle(tick, i)));
+                for (int i = 0; i < 8; i++) sender.Destroy(entities[particleCount + 64 + (tick - tickCount / 2) * 8 + i]);
+                if (sender.HasComponent<Frozen>(entities[tick % 8]))
+                    sender.RemoveComponent<Frozen>(entities[tick % 8]);
+                else
+                    sender.AddComponent(entities[tick % 8], Frozen());
+                sender.RemoveComponent<Particle>(entities[tick]);
+            }
+
+            writer.Clear();
+            decoded &= encoder.Encode(writer) == tick;
+            if (tick != tickCount / 2 + 5)
+                packets.push_back({tick + latency, std::vector<char>(writer.GetBytes().begin(), writer.GetBytes().end())});
+            deliver(tick);
+        }
+        deliver(tickCount + 2 * latency);
+        sender.ForEach<Particle>([](EntityHandle e, Particle &p) { p.x += 1; });
+        writer.Clear();
+        encoder.Encode(writer);
+        SnapshotReader truncated(writer.GetBytes().first(writer.GetBytes().size() / 2));
+        decoded &= !decoder.Decode(truncated);
+
+        // Packets claiming more slots than the decoder accepts, or records past the sender's slots, are rejected.
+        for (uint64_t slotCount : {uint64_t(1) << 40, uint64_t(10)}) {
+            SnapshotWriter malformed;
+            malformed.WriteVarint(decoder.GetLastSequence() + 1);
+            malformed.WriteVarint(decoder.GetLastSequence() + 1);
+            malformed.WriteVarint(slotCount);
+            malformed.WriteVarint(INT_MAX);
+            malformed.WriteVarint(0);
+            SnapshotReader malformedReader(malformed.GetBytes());
+            decoded &= !decoder.Decode(malformedReader);
+        }
+        SnapshotReader reader(writer.GetBytes());
+        decoded &= decoder.Decode(reader);
+
+        // Every mirrored entity has the sender's replicated components, and only those.
+        int mirrored = 0;
+        bool equal = decoded;
+        for (EntityHandle e : entities) {
+            EntityHandle local = sender.IsAlive(e) ? decoder.GetLocalEntity(e) : EntityHandle();
+            if (!sender.IsAlive(e) || !(sender.HasComponent<Particle>(e) || sender.HasComponent<BlockParticle>(e))) {
+                equal &= local == EntityHandle();
+                continue;
+            }
+            mirrored++;
+            equal &= receiver.IsAlive(local) && !receiver.HasComponent<Lifetime>(local) &&
+                     sender.HasComponent<Frozen>(e) == receiver.HasComponent<Frozen>(local) &&
+                     sender.HasComponent<Particle>(e) == receiver.HasComponent<Particle>(local);
+            if (equal && sender.HasComponent<Particle>(e))
+                equal &= !(sender.GetComponent<Particle>(e) != receiver.GetComponent<Particle>(local));
+        }
+        int receiverCount = 0;
+        for (Archetype &archetype : receiver.GetArchetypePool().GetArchetypes()) receiverCount += archetype.entityCount;
+        for (auto &&[e, particles] : receiver.GetComponentsArrays<BlockParticle>())
+            for (int i = 0; i < particles.size(); i++)
+                equal &= particles.Get(i, BlockParticle::X) == -particles.Get(i, BlockParticle::Y);
+        if (!equal || mirrored != receiverCount) {
+            std::cout << "Failed replication test: Receiver differs from sender\n";
+            return 1;
+        }
+    }
+
+    {
+        const int queryCount = 1000;
+        World world;
+        std::vector<Entity> entities;
+        for (int i = 0; i < 256; i++) {
+            entities.push_back(Entity(world, Name(i)));
+            [&]<int... B>(std::integer_sequence<int, B...>) {
+                ((i >> B & 1 ? entities.back().AddComponent(Marker<B>()) : void()), ...);
+            }(std::make_integer_sequence<int, 8>());
+        }
+        entities[255].AddComponent(Test(0));
+
+        int count = 0;
+        for (int n = 0; n < queryCount; n++)
+            for (auto &&[e, names, tests] : world.GetComponentsArrays<Name, Test>()) count += names.size();
+        Query<Name, Test> query(world);
+        for (int n = 0; n < queryCount; n++)
+            for (auto &&[e, names, tests] : query.GetComponentsArrays()) count += names.size();
+
+        if (count != queryCount * 2) {
+            std::cout << "Failed query test: Impropper entity count\n";
+            return 1;
+        }
+    }
+
+    {
+        [&]<int... N>(std::integer_sequence<int, N...>) {
+            ComponentMask::Of<Marker<16 + N>...>();
+        }(std::make_integer_sequence<int, 880>());
+        World world;
+        std::vector<Entity> entities;
+        for (int i = 0; i < 256; i++) {
+            entities.push_back(Entity(world, Marker<16 + 879>(), Name(i)));
+            [&]<int... B>(std::integer_sequence<int, B...>) {
+                ((i >> B & 1 ? entities.back().AddComponent(Marker<B>()) : void()), ...);
+            }(std::make_integer_sequence<int, 8>());
+        }
+
+        size_t dense = 0, indexedByID = 0;
+        for (Archetype &archetype : world.GetArchetypePool().GetArchetypes()) {
+            int maxID = -1;
+            archetype.mask.ForEach([&](int id) { maxID = id; });
+            dense += archetype.chunks.size() * archetype.denseComponentMap.size() * sizeof(PopbackArray) +
+                     sizeof(ColumnIndex);
+            indexedByID += archetype.chunks.size() * (maxID + 1) * sizeof(PopbackArray);
+        }
+        int count = 0;
+        for (auto &&[e, names] : world.GetComponentsArrays<Name>())
+            for (Name &name : names) count += name.id;
+        if (count != 255 * 256 / 2 || dense * 10 > indexedByID) {
+            std::cout << "Failed column table test: Impropper components\n";
             return 1;
         }
     }